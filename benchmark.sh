@@ -0,0 +1,12 @@
+#!/bin/bash
+
+# Benchmark the problems from the paper with a fixed number of threads and
+# append the results to results/benchmark.csv. Arguments are passed to
+# code/benchmark.py (e.g., --threads 8 --sizes small medium).
+python3 code/benchmark.py "$@"
+
+# If this script is being run inside a Docker container, copy the results to
+# a folder that a user could mount from their local file system.
+if [ -f /.dockerenv ]; then
+    cp results/benchmark.csv /output/
+fi
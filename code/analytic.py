@@ -8,7 +8,7 @@ from moco_paper_result import MocoPaperResult
 class Analytic(MocoPaperResult):
     def __init__(self):
         self.solution_file = '%s/results/analytic_solution.sto'
-    def generate_results(self, root_dir, args):
+    def create_study(self, num_mesh_intervals=50):
         model = osim.Model()
         body = osim.Body("b", 1, osim.Vec3(0), osim.Inertia(0))
         model.addBody(body)
@@ -37,7 +37,11 @@ class Analytic(MocoPaperResult):
         problem.addGoal(osim.MocoControlGoal("effort", 0.5))
 
         solver = moco.initCasADiSolver()
-        solver.set_num_mesh_intervals(50)
+        solver.set_num_mesh_intervals(num_mesh_intervals)
+        return moco
+
+    def generate_results(self, root_dir, args):
+        moco = self.create_study()
         solution = moco.solve()
         solution.write(self.solution_file % root_dir)
 
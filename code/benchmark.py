@@ -0,0 +1,254 @@
+"""Benchmark the problems from the paper at small, medium and large mesh sizes.
+
+Each run solves one problem with a fixed number of mesh intervals and a fixed
+number of threads, and appends one row to results/benchmark.csv (see
+COLUMNS). The columns and their order are part of the format; add new columns
+at the end and increment FORMAT_VERSION when changing the meaning of a column.
+An existing file with different columns is moved aside to
+benchmark.v<version>.csv rather than appended to. Rows from different Moco
+versions and machines can be concatenated and compared directly.
+
+The C++ problems from exampleMocoTrack.cpp are benchmarked by
+resources/Rajagopal2016/benchmarkMocoTrack.cpp, which writes the same format.
+
+Examples
+--------
+Benchmark all problems at all sizes with 4 threads:
+    python3 benchmark.py --threads 4
+Benchmark only the small squat-to-stand and suspended mass problems:
+    python3 benchmark.py --problems squat-to-stand suspended-mass --sizes small
+Benchmark without the known differences in results between thread counts
+(see deterministic.py), to separate timing changes from numerical changes:
+    python3 benchmark.py --threads 8 --deterministic
+"""
+import os
+import csv
+import time
+import random
+import socket
+import platform
+from collections import OrderedDict
+
+import numpy as np
+import opensim as osim
+
+from analytic import Analytic
+from suspended_mass import SuspendedMass
+from prescribed_walking import MotionPrescribedWalking
+from tracking_walking import MotionTrackingWalking, MocoTrackConfig
+from squat_to_stand import SquatToStand
+import deterministic
+import utilities
+
+FORMAT_VERSION = 2
+COLUMNS = ['format_version', 'moco_version', 'host', 'processor', 'problem',
+           'size', 'num_mesh_intervals', 'num_threads', 'repeat', 'success',
+           'num_iterations', 'solver_duration', 'time_per_iteration',
+           'wall_time', 'objective', 'deterministic']
+SIZES = ['small', 'medium', 'large']
+
+
+def analytic(root_dir, num_mesh_intervals, parallel):
+    study = Analytic().create_study(num_mesh_intervals)
+    osim.MocoCasADiSolver.safeDownCast(study.updSolver()).set_parallel(
+        parallel)
+    return study.solve()
+
+
+def linear_tangent_steering(root_dir, num_mesh_intervals, parallel):
+    study = osim.MocoStudyFactory.createLinearTangentSteeringStudy(
+        5.0, 1.0, 1.0)
+    solver = osim.MocoCasADiSolver.safeDownCast(study.updSolver())
+    solver.set_num_mesh_intervals(num_mesh_intervals)
+    solver.set_parallel(parallel)
+    return study.solve()
+
+
+def suspended_mass(root_dir, num_mesh_intervals, parallel):
+    solution, _ = SuspendedMass().predict(
+        num_mesh_intervals=num_mesh_intervals, parallel=parallel)
+    return solution
+
+
+def prescribed_walking(root_dir, num_mesh_intervals, parallel):
+    result = MotionPrescribedWalking()
+    duration = result.final_time - result.initial_time
+    inverse = result.create_inverse(root_dir,
+                                    result.create_model_processor(root_dir),
+                                    duration / num_mesh_intervals)
+    study = inverse.initialize()
+    osim.MocoCasADiSolver.safeDownCast(study.updSolver()).set_parallel(
+        parallel)
+    return study.solve()
+
+
+def tracking_walking(root_dir, num_mesh_intervals, parallel):
+    result = MotionTrackingWalking()
+    result.parse_args([])
+    duration = result.half_time - result.initial_time
+    # Use the default guess so that the run does not depend on earlier
+    # solutions.
+    config = MocoTrackConfig(
+        name=f'benchmark_{num_mesh_intervals}',
+        legend_entry='benchmark',
+        tracking_weight=result.config_track.tracking_weight,
+        effort_weight=result.config_track.effort_weight,
+        mesh_interval=duration / num_mesh_intervals,
+        color='black',
+        guess='default')
+    # Only the solve: no full gait cycle or ground reaction forces, and the
+    # solution is not added to the warm start library.
+    return result.solve_tracking_problem(root_dir, config, index=False,
+                                         parallel=parallel)
+
+
+def squat_to_stand(root_dir, num_mesh_intervals, parallel):
+    study = SquatToStand().create_predict_study(
+        root_dir, num_mesh_intervals=num_mesh_intervals)
+    osim.MocoCasADiSolver.safeDownCast(study.updSolver()).set_parallel(
+        parallel)
+    return study.solve()
+
+
+# For each problem: the function that solves it, and the number of mesh
+# intervals for each size.
+PROBLEMS = OrderedDict()
+PROBLEMS['analytic'] = (analytic, [25, 50, 100])
+PROBLEMS['linear-tangent-steering'] = (linear_tangent_steering, [25, 50, 100])
+PROBLEMS['suspended-mass'] = (suspended_mass, [25, 50, 100])
+PROBLEMS['prescribed-walking'] = (prescribed_walking, [10, 25, 50])
+PROBLEMS['tracking-walking'] = (tracking_walking, [10, 20, 40])
+PROBLEMS['squat-to-stand'] = (squat_to_stand, [10, 25, 50])
+
+
+def run(root_dir, problem, size, num_threads, repeat=0):
+    """Solve the problem and return a benchmark row (a dict with COLUMNS).
+    Each problem function receives MocoCasADiSolver's 'parallel' setting for
+    num_threads, and returns either a MocoSolution or the path to the
+    solution file that it wrote."""
+    solve, sizes = PROBLEMS[problem]
+    num_mesh_intervals = sizes[SIZES.index(size)]
+    # Nothing in these problems is random, but fix the seeds in case a
+    # problem (or a future problem) creates a random guess.
+    random.seed(0)
+    np.random.seed(0)
+    start = time.perf_counter()
+    solution = solve(root_dir, num_mesh_intervals,
+                     utilities.moco_parallel(num_threads))
+    wall_time = time.perf_counter() - start
+
+    if isinstance(solution, str):
+        # The problem wrote its solution to this file; MocoSolution.write()
+        # stores the solver statistics in the file's metadata.
+        table = osim.TimeSeriesTable(solution)
+        success = table.getTableMetaDataAsString('success') == 'true'
+        num_iterations = int(table.getTableMetaDataAsString('num_iterations'))
+        solver_duration = float(
+            table.getTableMetaDataAsString('solver_duration'))
+        objective = float(table.getTableMetaDataAsString('objective'))
+    else:
+        success = solution.success()
+        num_iterations = solution.getNumIterations()
+        solver_duration = solution.getSolverDuration()
+        objective = solution.getObjective()
+    return OrderedDict([
+        ('format_version', FORMAT_VERSION),
+        ('moco_version', osim.GetMocoVersion()),
+        ('host', socket.gethostname()),
+        ('processor', platform.processor() or platform.machine()),
+        ('problem', problem),
+        ('size', size),
+        ('num_mesh_intervals', num_mesh_intervals),
+        ('num_threads', num_threads),
+        ('repeat', repeat),
+        ('success', int(success)),
+        ('num_iterations', num_iterations),
+        ('solver_duration', f'{solver_duration:.6f}'),
+        ('time_per_iteration',
+         f'{solver_duration / max(num_iterations, 1):.6f}'),
+        ('wall_time', f'{wall_time:.6f}'),
+        ('objective', f'{objective:.12e}'),
+        ('deterministic', int(deterministic.is_enabled())),
+    ])
+
+
+def rotate(fpath):
+    """Rename an existing CSV file whose header differs from COLUMNS (e.g.,
+    one written with an older FORMAT_VERSION) to <name>.v<version>.csv, so
+    that rows of different formats are never mixed in one file. Returns the
+    new path, or None if the file was left in place."""
+    if not os.path.exists(fpath):
+        return None
+    with open(fpath, newline='') as f:
+        reader = csv.reader(f)
+        header = next(reader, [])
+        first = next(reader, [])
+    if header == COLUMNS:
+        return None
+    version = 'unknown'
+    if header and header[0] == 'format_version' and first:
+        version = first[0]
+    stem, extension = os.path.splitext(fpath)
+    rotated = f'{stem}.v{version}{extension}'
+    count = 1
+    while os.path.exists(rotated):
+        rotated = f'{stem}.v{version}-{count}{extension}'
+        count += 1
+    os.rename(fpath, rotated)
+    print(f'Moved {fpath}, which has different columns, to {rotated}.')
+    return rotated
+
+
+def write_rows(fpath, rows):
+    """Append rows to the CSV file, writing the header if the file is new.
+    A file with different columns is first moved aside (see rotate())."""
+    rotate(fpath)
+    new_file = not os.path.exists(fpath)
+    with open(fpath, 'a', newline='') as f:
+        writer = csv.DictWriter(f, fieldnames=COLUMNS)
+        if new_file:
+            writer.writeheader()
+        for row in rows:
+            writer.writerow(row)
+
+
+if __name__ == "__main__":
+    import argparse
+
+    parser = argparse.ArgumentParser(
+        description='Benchmark the OpenSim Moco paper problems.',
+        epilog=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--problems', type=str, nargs='+',
+                        choices=list(PROBLEMS.keys()),
+                        default=list(PROBLEMS.keys()))
+    parser.add_argument('--sizes', type=str, nargs='+', choices=SIZES,
+                        default=SIZES)
+    parser.add_argument('--threads', type=int, default=4,
+                        help='Number of threads for each solve (default: 4).')
+    parser.add_argument('--repeats', type=int, default=1,
+                        help='Number of times to solve each problem.')
+    parser.add_argument('--output', type=str, default=None,
+                        help='CSV file to append to (default: '
+                             'results/benchmark.csv).')
+    parser.add_argument('--deterministic', action='store_true',
+                        help='Remove the known differences in the results '
+                             'between thread counts (see deterministic.py).')
+    args = parser.parse_args()
+    if args.deterministic:
+        # This restarts the process if the environment lacks the settings.
+        deterministic.enable()
+
+    root_dir = os.path.abspath(
+        os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+    output = args.output or os.path.join(root_dir, 'results', 'benchmark.csv')
+
+    print(f'OpenSim Moco {osim.GetMocoVersionAndDate()}')
+    for problem in args.problems:
+        for size in args.sizes:
+            for repeat in range(args.repeats):
+                print(f'Benchmarking {problem} ({size}, repeat {repeat}).')
+                row = run(root_dir, problem, size, args.threads, repeat)
+                # Write each row immediately so that a failure in a later
+                # (larger) problem does not lose earlier rows.
+                write_rows(output, [row])
+                print(','.join(str(row[column]) for column in COLUMNS))
@@ -0,0 +1,161 @@
+"""Read and write the columnar binary trajectory format (.trj) described in
+resources/Rajagopal2016/BinaryTrajectory.h.
+
+Files are opened with numpy.memmap, so opening a file does not parse or copy
+the data, and reading a column reads only that column from disk. This is
+useful for reporting on large solutions (e.g., the fine-mesh convergence
+solutions), where we often need only the metadata and a few columns.
+
+Convert .sto files from the command line (report_convergence.py uses the
+binary files of the convergence solutions if they exist, and reads the .sto
+files otherwise):
+    python3 binary_trajectory.py <file.sto> [<file.sto> ...]
+"""
+import os
+import numpy as np
+
+from utilities import toarray
+
+MAGIC = b'MOCOBTRJ'
+VERSION = 1
+ALIGNMENT = 64
+HEADER_DTYPE = np.dtype([('magic', 'S8'),
+                         ('version', '<u4'),
+                         ('reserved', '<u4'),
+                         ('num_rows', '<u8'),
+                         ('num_columns', '<u8'),
+                         ('header_size', '<u8'),
+                         ('data_offset', '<u8')])
+
+
+def binary_path(sto_fpath):
+    return os.path.splitext(sto_fpath)[0] + '.trj'
+
+
+class BinaryTrajectory(object):
+    def __init__(self, fpath):
+        self.fpath = fpath
+        header = np.fromfile(fpath, dtype=HEADER_DTYPE, count=1)
+        if len(header) == 0 or header['magic'][0] != MAGIC:
+            raise Exception(f'{fpath} is not a binary trajectory.')
+        header = header[0]
+        if header['version'] != VERSION:
+            raise Exception(f'{fpath} has unsupported version '
+                            f'{header["version"]}.')
+        self.num_rows = int(header['num_rows'])
+        num_columns = int(header['num_columns'])
+        with open(fpath, 'rb') as f:
+            f.seek(HEADER_DTYPE.itemsize)
+            lines = f.read(int(header['header_size'])).decode('utf-8').split(
+                '\n')
+        self.labels = lines[:num_columns]
+        self.metadata = dict()
+        for line in lines[num_columns:]:
+            if '=' in line:
+                key, value = line.split('=', 1)
+                self.metadata[key] = value
+        self._indices = {label: i for i, label in enumerate(self.labels)}
+        # Shape is (column, row) so that each column is contiguous.
+        self._data = np.memmap(fpath, dtype='<f8', mode='r',
+                               offset=int(header['data_offset']),
+                               shape=(num_columns + 1, self.num_rows))
+
+    @property
+    def time(self):
+        return self._data[0]
+
+    def has_column(self, label):
+        return label in self._indices
+
+    def column(self, label):
+        """A read-only view of the column; no data is copied."""
+        return self._data[self._indices[label] + 1]
+
+    def to_time_series_table(self, labels=None):
+        """Create an opensim.TimeSeriesTable with the given columns (or all
+        columns). The table owns its data, so the columns are copied."""
+        import opensim as osim
+        if labels is None:
+            labels = self.labels
+        table = osim.TimeSeriesTable()
+        table.setColumnLabels(labels)
+        columns = [self.column(label) for label in labels]
+        for irow in range(self.num_rows):
+            row = osim.RowVector([float(c[irow]) for c in columns])
+            table.appendRow(float(self.time[irow]), row)
+        for key, value in self.metadata.items():
+            table.addTableMetaDataString(key, value)
+        return table
+
+
+def write(fpath, time, labels, columns, metadata=None):
+    """Write a binary trajectory. `columns` is a sequence of 1D arrays (or a 2D
+    array with one row per column), in the same order as `labels`."""
+    time = np.ascontiguousarray(time, dtype='<f8')
+    text = ''.join(f'{label}\n' for label in labels)
+    if metadata:
+        text += ''.join(f'{key}={value}\n' for key, value in metadata.items())
+    text = text.encode('utf-8')
+    end = HEADER_DTYPE.itemsize + len(text)
+    data_offset = (end + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+    header = np.zeros(1, dtype=HEADER_DTYPE)
+    header['magic'] = MAGIC
+    header['version'] = VERSION
+    header['num_rows'] = len(time)
+    header['num_columns'] = len(labels)
+    header['header_size'] = len(text)
+    header['data_offset'] = data_offset
+    with open(fpath, 'wb') as f:
+        f.write(header.tobytes())
+        f.write(text)
+        f.write(b'\0' * (data_offset - end))
+        f.write(time.tobytes())
+        for column in columns:
+            column = np.ascontiguousarray(column, dtype='<f8')
+            if column.shape != time.shape:
+                raise Exception('Columns must have the same length as time.')
+            f.write(column.tobytes())
+
+
+def convert_from_sto(sto_fpath, fpath=None):
+    """Convert an .sto or .mot file, including its metadata. By default, the
+    binary file is written next to the .sto file with the extension .trj."""
+    import opensim as osim
+    if fpath is None:
+        fpath = binary_path(sto_fpath)
+    table = osim.TimeSeriesTable(sto_fpath)
+    time = np.array(table.getIndependentColumn())
+    labels = list(table.getColumnLabels())
+    columns = [toarray(table.getDependentColumnAtIndex(i))
+               for i in range(len(labels))]
+    metadata = dict()
+    for key in table.getTableMetaDataKeys():
+        metadata[key] = table.getTableMetaDataAsString(key)
+    write(fpath, time, labels, columns, metadata)
+    return fpath
+
+
+def open_existing(sto_fpath):
+    """Open the binary version of an .sto file if it exists and is not older
+    than the .sto file; otherwise, return None (without converting)."""
+    fpath = binary_path(sto_fpath)
+    if (os.path.exists(fpath) and
+            os.path.getmtime(fpath) >= os.path.getmtime(sto_fpath)):
+        return BinaryTrajectory(fpath)
+    return None
+
+
+def load(sto_fpath):
+    """Open the binary version of an .sto file, converting the .sto file first
+    if the binary file does not exist or is older than the .sto file."""
+    fpath = binary_path(sto_fpath)
+    if (not os.path.exists(fpath) or
+            os.path.getmtime(fpath) < os.path.getmtime(sto_fpath)):
+        convert_from_sto(sto_fpath, fpath)
+    return BinaryTrajectory(fpath)
+
+
+if __name__ == "__main__":
+    import sys
+    for sto_fpath in sys.argv[1:]:
+        print(f'Wrote {convert_from_sto(sto_fpath)}.')
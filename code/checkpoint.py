@@ -0,0 +1,126 @@
+"""Checkpoint long MocoCasADiSolver solves so that they can be resumed after
+the process is killed (e.g., on a preempted node). See
+resources/Rajagopal2016/MocoCheckpoint.h for the C++ version.
+
+MocoCasADiSolver writes the current iterate to
+MocoCasADiSolver_<date>_trajectory<iteration>.sto in the working directory
+every `output_interval` iterations. The Python bindings hold the interpreter
+lock during MocoStudy.solve(), so no Python code can run during the solve;
+instead, these files are collected when the next solve starts (after a
+kill) or when the solve ends. The newest iterate becomes the checkpoint and
+the other files are deleted.
+"""
+import os
+import re
+import json
+import time
+
+import opensim as osim
+
+INTERMEDIATE_PATTERN = re.compile(
+    r'^MocoCasADiSolver_.*_trajectory(\d+)\.sto$')
+
+
+def find_intermediate_files(since):
+    """The (iteration, path) of each iterate that MocoCasADiSolver wrote to
+    the working directory at or after `since` (seconds since the epoch),
+    ordered by iteration."""
+    files = list()
+    for name in os.listdir('.'):
+        match = INTERMEDIATE_PATTERN.match(name)
+        if match and os.path.getmtime(name) >= since:
+            files.append((int(match.group(1)), name))
+    return sorted(files)
+
+
+class Checkpoint(object):
+    """Checkpoint a solve every `interval` iterations to `fpath` (an .sto
+    file). If the checkpoint exists when solve() is called, the solve resumes
+    from it: the checkpoint is the initial guess, and IPOPT's initial barrier
+    parameter is lowered to `resume_mu`, since the iterate is already close to
+    the central path. IPOPT's multipliers are not part of the iterates, so
+    they are re-initialized from the guess.
+
+    The checkpoint is deleted after a successful solve. Concurrent solves in
+    the same working directory must not use checkpoints, since the
+    intermediate files are identified by name and modification time.
+    """
+    def __init__(self, fpath, interval=50, resume_mu=1e-3):
+        self.fpath = fpath
+        self.interval = interval
+        self.resume_mu = resume_mu
+        # The time at which the current solve started and the iteration of
+        # the checkpoint it resumed from; if this file exists when a solve
+        # starts, the previous solve was killed.
+        self.state_fpath = fpath + '.json'
+
+    def exists(self):
+        return os.path.exists(self.fpath)
+
+    def get_iteration(self):
+        with open(self.state_fpath) as f:
+            return json.load(f)['checkpoint_iteration']
+
+    def _write_state(self, start, iteration):
+        temporary = self.state_fpath + '.tmp'
+        with open(temporary, 'w') as f:
+            json.dump({'start': start, 'checkpoint_iteration': iteration}, f)
+        os.replace(temporary, self.state_fpath)
+
+    def _collect(self, start, iteration_offset, keep_newest):
+        """Turn the newest iterate written since `start` into the checkpoint
+        and delete the other iterates. Returns the checkpoint's iteration."""
+        files = find_intermediate_files(start)
+        iteration = iteration_offset
+        if files:
+            # If the process was killed, the newest file may be incomplete.
+            newest = -1 if keep_newest or len(files) == 1 else -2
+            iteration = iteration_offset + files[newest][0]
+            os.replace(files[newest][1], self.fpath)
+            for _, fpath in files:
+                if os.path.exists(fpath):
+                    os.remove(fpath)
+        return iteration
+
+    def solve(self, study):
+        """Solve the study (with a MocoCasADiSolver), resuming from the
+        checkpoint if it exists or if the previous solve was killed."""
+        iteration = 0
+        if os.path.exists(self.state_fpath):
+            with open(self.state_fpath) as f:
+                state = json.load(f)
+            iteration = self._collect(state['start'] - 1,
+                                      state['checkpoint_iteration'], False)
+            self._write_state(state['start'], iteration)
+
+        solver = osim.MocoCasADiSolver.safeDownCast(study.updSolver())
+        solver.set_output_interval(self.interval)
+        option_file = False
+        if self.exists():
+            print(f'Checkpoint: resuming from iteration {iteration} '
+                  f'({self.fpath}).')
+            solver.setGuess(osim.MocoTrajectory(self.fpath))
+            if self.resume_mu and not os.path.exists('ipopt.opt'):
+                with open('ipopt.opt', 'w') as f:
+                    f.write(f'mu_init {self.resume_mu}\n')
+                option_file = True
+
+        start = time.time()
+        self._write_state(start, iteration)
+        try:
+            solution = study.solve()
+        finally:
+            if option_file:
+                os.remove('ipopt.opt')
+        if solution.success():
+            for _, fpath in find_intermediate_files(start - 1):
+                os.remove(fpath)
+            if self.exists():
+                os.remove(self.fpath)
+            os.remove(self.state_fpath)
+        else:
+            # Keep the last iterate so that the solve can be continued (e.g.,
+            # after reaching the maximum number of iterations).
+            self._write_state(start, self._collect(start - 1, iteration,
+                                                   True))
+        return solution
@@ -0,0 +1,276 @@
+"""Evaluate the forces of all SmoothSphereHalfSpaceForce contacts in a model
+at once.
+
+A ContactBank stores the parameters of every SmoothSphereHalfSpaceForce in a
+model (e.g., the foot spheres of subject_walk_armless_contact_bounded_80musc)
+as numpy arrays (one entry per sphere), and evaluates the contact forces for
+all spheres and all time points in a single vectorized expression, instead
+of one force element (and one record) at a time. Only the kinematics of the
+sphere frames require realizing the model.
+
+The forces are the same smooth functions as in Simbody's
+SmoothSphereHalfSpaceForce (Serrancoli et al., 2019, IEEE Transactions on
+Neural Systems and Rehabilitation Engineering): a smoothed Hertz force with
+Hunt-Crossley dissipation, and smoothed Stribeck friction. Spheres whose
+indentation is so negative that the smoothed contact step is below
+`tolerance` are skipped (their force is zero); the step has the same bound
+on its derivatives, so the skipped forces and their derivatives differ from
+those of the smooth model by less than `tolerance` relative to the Hertz
+force. calc_normal_force() gives the partial derivatives of the normal force
+with respect to the indentation and its rate.
+
+Arrays of kinematics and forces have shape (num_times, num_spheres, 3), with
+the spheres in the order of ContactBank.paths. The half spaces must be fixed
+to ground.
+"""
+import numpy as np
+import opensim as osim
+
+from utilities import toarray
+
+
+def _to_numpy(vec3):
+    return np.array([vec3[0], vec3[1], vec3[2]])
+
+
+def _rotation_body_fixed_xyz(angles):
+    cx, cy, cz = np.cos(angles)
+    sx, sy, sz = np.sin(angles)
+    rx = np.array([[1, 0, 0], [0, cx, -sx], [0, sx, cx]])
+    ry = np.array([[cy, 0, sy], [0, 1, 0], [-sy, 0, cy]])
+    rz = np.array([[cz, -sz, 0], [sz, cz, 0], [0, 0, 1]])
+    return rx @ ry @ rz
+
+
+class ContactBank(object):
+    """The parameters of the SmoothSphereHalfSpaceForces with the given paths
+    (all of them in the model by default), stored as arrays."""
+    def __init__(self, model, paths=None, tolerance=1e-12):
+        model.finalizeConnections()
+        state = model.initSystem()
+        if paths is None:
+            paths = list()
+            forces = model.getForceSet()
+            for iforce in range(forces.getSize()):
+                if osim.SmoothSphereHalfSpaceForce.safeDownCast(
+                        forces.get(iforce)):
+                    paths.append(forces.get(iforce).getAbsolutePathString())
+        self.paths = list(paths)
+        self.tolerance = tolerance
+        parameters = {key: list() for key in [
+            'stiffness', 'dissipation', 'static_friction',
+            'dynamic_friction', 'viscous_friction', 'transition_velocity',
+            'constant_contact_force', 'hertz_smoothing',
+            'hunt_crossley_smoothing', 'radius']}
+        self.sphere_frames = list()
+        self.sphere_locations = list()
+        normals = list()
+        origins = list()
+        for path in self.paths:
+            force = osim.SmoothSphereHalfSpaceForce.safeDownCast(
+                model.getComponent(path))
+            if not force:
+                raise Exception(f'{path} is not a SmoothSphereHalfSpaceForce.')
+            for key in parameters:
+                if key == 'radius':
+                    parameters[key].append(force.get_contact_sphere_radius())
+                else:
+                    parameters[key].append(getattr(force, f'get_{key}')())
+            self.sphere_frames.append(osim.PhysicalFrame.safeDownCast(
+                force.getSocket('sphere_frame').getConnecteeAsObject()))
+            self.sphere_locations.append(
+                force.get_contact_sphere_location())
+
+            half_space = osim.PhysicalFrame.safeDownCast(
+                force.getSocket('half_space_frame').getConnecteeAsObject())
+            if (half_space.findBaseFrame().getAbsolutePathString() !=
+                    model.getGround().getAbsolutePathString()):
+                raise Exception(f'The half space of {path} must be fixed to '
+                                f'ground.')
+            # The half space occupies x > 0 in its frame, so that its outward
+            # normal is -x.
+            rotation = _rotation_body_fixed_xyz(
+                _to_numpy(force.get_contact_half_space_orientation()))
+            axes = np.array([_to_numpy(half_space.expressVectorInGround(
+                state, osim.Vec3(*axis))) for axis in np.eye(3)]).T
+            normals.append(axes @ rotation @ np.array([-1.0, 0.0, 0.0]))
+            origins.append(_to_numpy(half_space.findStationLocationInGround(
+                state, force.get_contact_half_space_location())))
+        for key, value in parameters.items():
+            setattr(self, key, np.array(value, dtype=float))
+        self.normal = np.array(normals).reshape(-1, 3)
+        self.half_space_origin = np.array(origins).reshape(-1, 3)
+
+        # Quantities that do not depend on the state.
+        k = 0.5 * self.stiffness**(2.0 / 3.0)
+        self.hertz_coefficient = (4.0 / 3.0) * k * np.sqrt(self.radius * k)
+        # Below this indentation, 0.5 + 0.5 tanh(hertz_smoothing *
+        # indentation) ~ exp(2 hertz_smoothing indentation) < tolerance.
+        self.min_indentation = np.log(tolerance) / (2.0 * self.hertz_smoothing)
+
+    @property
+    def num_spheres(self):
+        return len(self.paths)
+
+    def calc_sphere_kinematics(self, model, trajectory):
+        """Compute the location and velocity of each sphere's center, and the
+        angular velocity of its frame, in ground over a MocoTrajectory. This
+        is the only part that requires realizing the model."""
+        model.initSystem()
+        states = trajectory.exportToStatesTrajectory(model)
+        num_times = states.getSize()
+        shape = (num_times, self.num_spheres, 3)
+        center = np.empty(shape)
+        velocity = np.empty(shape)
+        angular_velocity = np.empty(shape)
+        for itime in range(num_times):
+            state = states.get(itime)
+            model.realizeVelocity(state)
+            for isphere, (frame, location) in enumerate(
+                    zip(self.sphere_frames, self.sphere_locations)):
+                center[itime, isphere] = _to_numpy(
+                    frame.findStationLocationInGround(state, location))
+                velocity[itime, isphere] = _to_numpy(
+                    frame.findStationVelocityInGround(state, location))
+                angular_velocity[itime, isphere] = _to_numpy(
+                    frame.getAngularVelocityInGround(state))
+        return center, velocity, angular_velocity
+
+    def calc_normal_force(self, indentation, indentation_rate,
+                          spheres=slice(None), derivatives=False):
+        """The normal force for the given indentations and indentation rates
+        (arrays of shape (..., num_spheres), or with the last axis indexed by
+        `spheres`), and, if `derivatives`, its partial derivatives with
+        respect to each."""
+        cf = self.constant_contact_force[spheres]
+        c = self.dissipation[spheres]
+        hertz_smoothing = self.hertz_smoothing[spheres]
+        hc_smoothing = self.hunt_crossley_smoothing[spheres]
+        hertz = self.hertz_coefficient[spheres] * (indentation**2 + cf)**0.75
+        dissipation = 1.0 + 1.5 * c * indentation_rate
+        tanh_hertz = np.tanh(hertz_smoothing * indentation)
+        tanh_hc = np.tanh(hc_smoothing * (indentation_rate + 2.0 / (3.0 * c)))
+        step_hertz = 0.5 + 0.5 * tanh_hertz
+        step_hc = 0.5 + 0.5 * tanh_hc
+        normal_force = hertz * dissipation * step_hertz * step_hc
+        if not derivatives:
+            return normal_force
+        dhertz = 1.5 * hertz * indentation / (indentation**2 + cf)
+        dstep_hertz = 0.5 * hertz_smoothing * (1.0 - tanh_hertz**2)
+        dstep_hc = 0.5 * hc_smoothing * (1.0 - tanh_hc**2)
+        dindentation = (dhertz * step_hertz + hertz * dstep_hertz) * \
+            dissipation * step_hc
+        drate = hertz * step_hertz * (1.5 * c * step_hc +
+                                      dissipation * dstep_hc)
+        return normal_force, dindentation, drate
+
+    def calc_contact_forces(self, center, velocity, angular_velocity):
+        """The force that the half space applies to each sphere, and the
+        point (the sphere's lowest point along the half space's normal) at
+        which it is applied, from the kinematics returned by
+        calc_sphere_kinematics()."""
+        normal = self.normal
+        # The bounding test: the indentation of the center, offset by the
+        # radius.
+        indentation = self.radius - np.einsum(
+            '...j,...j->...', center - self.half_space_origin, normal)
+        point = center - self.radius[:, np.newaxis] * normal
+        force = np.zeros(np.shape(center))
+        active = indentation > self.min_indentation
+        if not np.any(active):
+            return force, point
+        isphere = np.nonzero(active)[1]
+        n = normal[isphere]
+        radius = self.radius[isphere, np.newaxis]
+        point_velocity = (velocity[active] +
+                          np.cross(angular_velocity[active], -radius * n))
+        normal_velocity = np.einsum('ij,ij->i', point_velocity, n)
+        tangent_velocity = point_velocity - normal_velocity[:, np.newaxis] * n
+
+        normal_force = self.calc_normal_force(indentation[active],
+                                              -normal_velocity, isphere)
+
+        slip_velocity = np.sqrt(
+            np.einsum('ij,ij->i', tangent_velocity, tangent_velocity) +
+            self.constant_contact_force[isphere])
+        relative_velocity = slip_velocity / self.transition_velocity[isphere]
+        us = self.static_friction[isphere]
+        ud = self.dynamic_friction[isphere]
+        uv = self.viscous_friction[isphere]
+        friction_force = normal_force * (
+            np.minimum(relative_velocity, 1.0) *
+            (ud + 2.0 * (us - ud) / (1.0 + relative_velocity**2)) +
+            uv * slip_velocity)
+        force[active] = (normal_force[:, np.newaxis] * n -
+                         (friction_force / slip_velocity)[:, np.newaxis] *
+                         tangent_velocity)
+        return force, point
+
+    def create_external_loads_table(self, model, trajectory,
+                                    right_force_paths, left_force_paths):
+        """The ground reaction forces, centers of pressure and free torques
+        of the right and left feet over a MocoTrajectory. The force columns
+        ('ground_force_r_vx', etc.) are those of
+        osim.createExternalLoadsTableForGait() (see compare_with_gait()).
+        That function's points ('ground_force_r_px', etc.) are zero and its
+        torques ('ground_torque_r_x', etc.) are the sums of the spheres'
+        torques about their bodies' origins; here, the point is instead the
+        center of pressure on the plane y = 0 ('ground_cop_r_x', etc.), and
+        the torque is the free torque about it
+        ('ground_free_torque_r_x', etc.), so these columns have other
+        names. An ExternalForce applies them with the point and torque
+        expressed in ground."""
+        center, velocity, angular_velocity = self.calc_sphere_kinematics(
+            model, trajectory)
+        force, point = self.calc_contact_forces(center, velocity,
+                                                angular_velocity)
+        indices = {path.lstrip('/'): i for i, path in enumerate(self.paths)}
+        labels = list()
+        columns = list()
+        for side, paths in [('r', right_force_paths), ('l', left_force_paths)]:
+            spheres = [indices[path.lstrip('/')] for path in paths]
+            total_force = force[:, spheres].sum(axis=1)
+            moment = np.cross(point[:, spheres],
+                              force[:, spheres]).sum(axis=1)
+            cop = np.zeros(np.shape(total_force))
+            loaded = np.abs(total_force[:, 1]) > np.finfo(float).eps
+            cop[loaded, 0] = moment[loaded, 2] / total_force[loaded, 1]
+            cop[loaded, 2] = -moment[loaded, 0] / total_force[loaded, 1]
+            torque = moment - np.cross(cop, total_force)
+            labels += [f'ground_force_{side}_v{x}' for x in 'xyz']
+            labels += [f'ground_cop_{side}_{x}' for x in 'xyz']
+            labels += [f'ground_free_torque_{side}_{x}' for x in 'xyz']
+            columns += [total_force, cop, torque]
+        data = np.hstack(columns)
+        table = osim.TimeSeriesTable()
+        table.setColumnLabels(labels)
+        time = trajectory.getTimeMat()
+        for itime in range(data.shape[0]):
+            table.appendRow(float(time[itime]), osim.RowVector(
+                [float(value) for value in data[itime]]))
+        return table
+
+    def compare_with_gait(self, model, trajectory, right_force_paths,
+                          left_force_paths, tolerance=1e-6):
+        """Compare the forces of create_external_loads_table() with those of
+        osim.createExternalLoadsTableForGait(), and raise an exception if any
+        value differs by more than tolerance (relative to the largest force
+        magnitude). Returns the largest relative difference."""
+        table = self.create_external_loads_table(
+            model, trajectory, right_force_paths, left_force_paths)
+        reference = osim.createExternalLoadsTableForGait(
+            model, trajectory, right_force_paths, left_force_paths)
+        labels = [f'ground_force_{side}_v{x}' for side in 'rl'
+                  for x in 'xyz']
+        values = np.array([toarray(table.getDependentColumn(label))
+                           for label in labels])
+        expected = np.array([toarray(reference.getDependentColumn(label))
+                             for label in labels])
+        scale = max(np.max(np.abs(expected)), 1e-10)
+        difference = np.max(np.abs(values - expected)) / scale
+        if difference > tolerance:
+            raise Exception(f'ContactBank: the ground reaction forces differ '
+                            f'from osim.createExternalLoadsTableForGait() by '
+                            f'{difference:g} (relative), more than the '
+                            f'tolerance {tolerance:g}.')
+        return difference
@@ -0,0 +1,76 @@
+"""Opt-in deterministic mode, which removes the known sources of differences
+in benchmark and regression results between thread counts.
+
+The transcription itself does not depend on the number of threads:
+MocoCasADiSolver evaluates the integrands, path constraints and finite
+differences of each mesh point independently (in CasADi maps), and sums the
+integrals in the same fixed order for any 'parallel' setting. The
+differences come from the libraries underneath: threaded BLAS (and the
+OpenMP threads of the linear solver) split dot products and matrix products
+into a number of partial sums that depends on the thread count, and MKL and
+OpenBLAS choose kernels (vector widths, FMA) for the CPU they run on. The
+deterministic mode runs these libraries single-threaded and, for MKL, with
+conditional numerical reproducibility. The paper's own parallel code
+(StaticOptimization, MultiStart, TrajectoryDynamicsEvaluator) computes each
+result independently of how the work is split, except MultiStart's pruning,
+which depends on which start finishes a round first, and is disabled in
+this mode.
+
+The libraries read these settings when they are loaded, so they must be in
+the environment when the process starts: enable() re-executes the current
+process if necessary, and the command line runs another program (e.g.,
+benchmarkMocoTrack) in the deterministic environment:
+    python3 deterministic.py <program> [arguments...]
+
+This is not a guarantee of bitwise stability: it has not been verified
+that CasADi, IPOPT and the OpenSim libraries have no other thread-dependent
+reductions. Compare the objectives in benchmark.csv across thread counts
+(e.g., run benchmark.py --deterministic with --threads 1 and --threads 8)
+before relying on it. MKL also selects kernels per CPU without MKL_CBWR, as
+OpenBLAS always does; set `coretype` (OPENBLAS_CORETYPE, e.g., 'Haswell', a
+kernel that all of the machines support) to also compare results across
+CPUs with OpenBLAS.
+"""
+import os
+import sys
+
+FLAG = 'MOCOPAPER_DETERMINISTIC'
+
+
+def create_environment(coretype=None):
+    environment = {
+        FLAG: '1',
+        'OMP_NUM_THREADS': '1',
+        'OPENBLAS_NUM_THREADS': '1',
+        'MKL_NUM_THREADS': '1',
+        'MKL_CBWR': 'COMPATIBLE',
+        # Fix the iteration order of sets and dicts of strings.
+        'PYTHONHASHSEED': '0',
+    }
+    if coretype:
+        environment['OPENBLAS_CORETYPE'] = coretype
+    return environment
+
+
+def is_enabled():
+    return os.environ.get(FLAG) == '1'
+
+
+def enable(coretype=None):
+    """Enable the deterministic mode for this process, re-executing it (with
+    the same arguments) if its environment lacks any of the settings."""
+    environment = create_environment(coretype)
+    if all(os.environ.get(key) == value
+           for key, value in environment.items()):
+        return
+    os.environ.update(environment)
+    sys.stdout.flush()
+    os.execv(sys.executable, [sys.executable] + sys.argv)
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2:
+        print(__doc__)
+        sys.exit(1)
+    os.environ.update(create_environment(os.environ.get('OPENBLAS_CORETYPE')))
+    os.execvp(sys.argv[1], sys.argv[1:])
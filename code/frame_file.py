@@ -0,0 +1,164 @@
+"""Read the frame files (and socket streams) written by MocoFrameSink; see
+resources/Rajagopal2016/MocoFrameSink.h for the format.
+
+Each record holds the pose of every body at each time point of one
+trajectory (an IPOPT iterate or a final solution), so the motion can be
+rendered without the model or a second pass over the solution. No script in
+this repository renders them yet; parse() and read() return numpy arrays
+for that purpose.
+
+Receive frames from MocoFrameSink::setSocket() into a file, and summarize a
+frame file, from the command line:
+    python3 frame_file.py listen <port> <file>
+    python3 frame_file.py summary <file>
+"""
+import sys
+import socket
+import collections
+
+import numpy as np
+
+MAGIC = b'MOCOFRMS'
+VERSION = 1
+HEADER_DTYPE = np.dtype([('magic', 'S8'),
+                         ('version', '<u4'),
+                         ('num_bodies', '<u4'),
+                         ('header_size', '<u8')])
+RECORD_DTYPE = np.dtype([('iteration', '<i4'),
+                         ('num_times', '<u4')])
+
+Record = collections.namedtuple('Record',
+                                ['iteration', 'time', 'positions',
+                                 'quaternions'])
+
+
+class FrameStream(object):
+    """Parse a frame file or stream incrementally: feed() takes the next
+    bytes and returns the records that they complete. Bytes of a
+    partially-received record are kept until the rest of it arrives, and the
+    bytes of parsed records are discarded, so the total cost is linear in the
+    length of the stream. body_paths is None until the header is complete."""
+    def __init__(self):
+        self.buffer = bytearray()
+        self.body_paths = None
+        self.num_bodies = 0
+
+    def _parse_header(self):
+        if len(self.buffer) < HEADER_DTYPE.itemsize:
+            return False
+        header = np.frombuffer(bytes(self.buffer[:HEADER_DTYPE.itemsize]),
+                               dtype=HEADER_DTYPE, count=1)[0]
+        if header['magic'] != MAGIC:
+            raise Exception('Not a frame file.')
+        if header['version'] != VERSION:
+            raise Exception(f'Unsupported frame file version '
+                            f'{header["version"]}.')
+        end = HEADER_DTYPE.itemsize + int(header['header_size'])
+        if len(self.buffer) < end:
+            return False
+        self.num_bodies = int(header['num_bodies'])
+        text = bytes(self.buffer[HEADER_DTYPE.itemsize:end]).decode('utf-8')
+        self.body_paths = text.split('\n')[:self.num_bodies]
+        del self.buffer[:end]
+        return True
+
+    def feed(self, data):
+        self.buffer += data
+        if self.body_paths is None and not self._parse_header():
+            return list()
+        records = list()
+        offset = 0
+        while offset + RECORD_DTYPE.itemsize <= len(self.buffer):
+            record = np.frombuffer(
+                bytes(self.buffer[offset:offset + RECORD_DTYPE.itemsize]),
+                dtype=RECORD_DTYPE, count=1)[0]
+            num_times = int(record['num_times'])
+            begin = offset + RECORD_DTYPE.itemsize
+            end = begin + 8 * num_times + 4 * 7 * num_times * self.num_bodies
+            if end > len(self.buffer):
+                break
+            block = bytes(self.buffer[begin:end])
+            time = np.frombuffer(block, dtype='<f8', count=num_times)
+            poses = np.frombuffer(block, dtype='<f4',
+                                  count=7 * num_times * self.num_bodies,
+                                  offset=8 * num_times).reshape(
+                num_times, self.num_bodies, 7)
+            records.append(Record(int(record['iteration']), time,
+                                  poses[:, :, :3], poses[:, :, 3:]))
+            offset = end
+        del self.buffer[:offset]
+        return records
+
+
+def parse(data):
+    """The body paths and the complete records in the bytes of a frame file
+    or stream. A partially-written last record (e.g., while the sink is still
+    writing) is ignored. positions has shape (time, body, 3) and quaternions
+    (w, x, y, z) has shape (time, body, 4)."""
+    stream = FrameStream()
+    records = stream.feed(data)
+    if stream.body_paths is None:
+        raise Exception('Incomplete frame header.')
+    return stream.body_paths, records
+
+
+def read(fpath):
+    with open(fpath, 'rb') as f:
+        return parse(f.read())
+
+
+def listen(port, fpath):
+    """Accept connections from MocoFrameSinks and append each stream to
+    fpath.<n> (one file per connection), printing each record's iteration as
+    it arrives."""
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(('', port))
+    server.listen(1)
+    num_connections = 0
+    while True:
+        connection, address = server.accept()
+        out_fpath = f'{fpath}.{num_connections}'
+        num_connections += 1
+        print(f'Receiving frames from {address[0]} into {out_fpath}.')
+        stream = FrameStream()
+        with connection, open(out_fpath, 'wb') as f:
+            while True:
+                chunk = connection.recv(1 << 20)
+                if not chunk:
+                    break
+                f.write(chunk)
+                f.flush()
+                if stream is None:
+                    continue
+                try:
+                    records = stream.feed(chunk)
+                except Exception as e:
+                    # Keep saving the stream, but stop parsing it.
+                    print(f'  {e}')
+                    stream = None
+                    continue
+                for record in records:
+                    name = ('final' if record.iteration < 0
+                            else f'iteration {record.iteration}')
+                    print(f'  {name}: {len(record.time)} time points')
+
+
+def summary(fpath):
+    body_paths, records = read(fpath)
+    print(f'{len(body_paths)} bodies, {len(records)} records')
+    for record in records:
+        name = ('final' if record.iteration < 0
+                else f'iteration {record.iteration}')
+        print(f'  {name}: {len(record.time)} time points, '
+              f'[{record.time[0]}, {record.time[-1]}] s')
+
+
+if __name__ == '__main__':
+    if len(sys.argv) == 4 and sys.argv[1] == 'listen':
+        listen(int(sys.argv[2]), sys.argv[3])
+    elif len(sys.argv) == 3 and sys.argv[1] == 'summary':
+        summary(sys.argv[2])
+    else:
+        print(__doc__)
+        sys.exit(1)
@@ -0,0 +1,75 @@
+import opensim as osim
+
+
+def solve_mesh_refinement(create_study, mesh_intervals, tolerance=None,
+                          solution_fpaths=None, guess=None):
+    """Solve a problem on a sequence of increasingly fine meshes, using the
+    solution on each mesh as the initial guess for the next mesh.
+
+    Parameters
+    ----------
+    create_study : callable
+        create_study(num_mesh_intervals) returns a MocoStudy (with a
+        MocoCasADiSolver) using the given number of mesh intervals.
+    mesh_intervals : list of int
+        Numbers of mesh intervals, from coarse to fine.
+    tolerance : float, optional
+        Stop once the relative change in the objective between consecutive
+        meshes is below this value. If None, solve on every mesh.
+    solution_fpaths : list of str, optional
+        Write the solution on each mesh to these files (same length as
+        mesh_intervals).
+    guess : MocoTrajectory, optional
+        Guess for the coarsest mesh; otherwise, the study's guess is used.
+
+    Returns
+    -------
+    solution : MocoSolution
+        The solution on the finest mesh that was solved.
+    history : list of dict
+        For each mesh solved: 'num_mesh_intervals', 'objective',
+        'num_iterations', 'solver_duration' and 'success'.
+    """
+    history = list()
+    solution = None
+    for i, num_mesh_intervals in enumerate(mesh_intervals):
+        print(f'Mesh refinement: solving with {num_mesh_intervals} mesh '
+              'intervals.')
+        study = create_study(num_mesh_intervals)
+        if guess is not None:
+            solver = osim.MocoCasADiSolver.safeDownCast(study.updSolver())
+            # The solver resamples the guess onto the new mesh.
+            solver.setGuess(guess)
+        solution = study.solve()
+        solution.unseal()
+        history.append({
+            'num_mesh_intervals': num_mesh_intervals,
+            'objective': solution.getObjective(),
+            'num_iterations': solution.getNumIterations(),
+            'solver_duration': solution.getSolverDuration(),
+            'success': solution.success(),
+        })
+        if solution_fpaths:
+            solution.write(solution_fpaths[i])
+            write_history_metadata(solution_fpaths[i], history)
+        guess = solution
+
+        if tolerance is not None and len(history) > 1:
+            previous = history[-2]['objective']
+            change = abs(solution.getObjective() - previous) / abs(previous)
+            print(f'Mesh refinement: relative change in objective: {change}')
+            if change < tolerance:
+                break
+    return solution, history
+
+
+def write_history_metadata(solution_fpath, history):
+    """Record the refinement history (see solve_mesh_refinement()) in the
+    metadata of a solution file."""
+    table = osim.TimeSeriesTable(solution_fpath)
+    for key in ['num_mesh_intervals', 'objective', 'num_iterations',
+                'solver_duration']:
+        table.addTableMetaDataString(
+            f'mesh_refinement_{key}',
+            ','.join(str(md[key]) for md in history))
+    osim.STOFileAdapter.write(table, solution_fpath)
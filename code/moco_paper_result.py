@@ -8,6 +8,7 @@ from abc import ABC, abstractmethod
 import opensim as osim
 
 import utilities
+from muscle_bank import MuscleBank
 
 class MocoPaperResult(ABC):
     def __init__(self):
@@ -101,7 +102,11 @@ class MocoPaperResult(ABC):
 
     def calc_negative_muscle_forces_base(self, model, solution):
         model.initSystem()
-        outputs = osim.analyze(model, solution, ['.*\|tendon_force'])
+        bank = MuscleBank(model)
+        if bank.can_analyze(model, solution):
+            outputs = bank.analyze(model, solution, ['tendon_force'])
+        else:
+            outputs = osim.analyze(model, solution, ['.*\|tendon_force'])
         def simtkmin(simtkvec):
             lowest = np.inf
             for i in range(simtkvec.size()):
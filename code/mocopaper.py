@@ -1,6 +1,8 @@
 import os
 import opensim as osim
 
+from pipeline import Pipeline
+
 from analytic import Analytic
 from linear_tangent_steering import LinearTangentSteering
 from suspended_mass import SuspendedMass
@@ -57,6 +59,11 @@ if __name__ == "__main__":
                                      epilog=examples)
     parser.add_argument('--no-generate', dest='generate', action='store_false',
                         help='Skip generating the results; only report.')
+    parser.add_argument('--serial', dest='serial', action='store_true',
+                        help='Generate and report the results one at a '
+                             'time in this process, rather than reporting '
+                             'each result while the next one is '
+                             'generated.')
     parser.add_argument('--convergence', dest='convergence',
                         action='store_true',
                         help='Run and plot convergence analysis instead of '
@@ -88,9 +95,41 @@ if __name__ == "__main__":
         for requested in args.results:
             if not requested in results.keys():
                 raise RuntimeError(f"Result {requested} not recognized.")
+    # Generate the results one after the other, and report each result (in
+    # a separate process, as Matplotlib's pyplot is not thread-safe) while
+    # the next result is generated; see pipeline.py.
+    pipeline = Pipeline(num_processes=2)
+    previous_generate = list()
+    previous_report = list()
     for result_name, result_object in results.items():
         if args.results is None or result_name in args.results:
-            if args.convergence:
+            if not args.convergence and not args.serial:
+                # Process the result's models (if it has any to share) once
+                # here, so that its generate and report processes inherit
+                # them.
+                if hasattr(result_object, 'process_models'):
+                    result_object.process_models(root_dir, args.args,
+                                                 generate=args.generate)
+                generate = list()
+                if args.generate:
+                    def generate_results(result_name=result_name,
+                                         result_object=result_object):
+                        print(f'Generating {result_name} results.')
+                        result_object.generate_results(root_dir, args.args)
+                    generate = [pipeline.add(f'{result_name}_generate',
+                                             generate_results,
+                                             after=previous_generate,
+                                             process=True)]
+                    previous_generate = generate
+
+                def report_results(result_name=result_name,
+                                   result_object=result_object):
+                    print(f'Reporting {result_name} results.')
+                    result_object.report_results(root_dir, args.args)
+                previous_report = [pipeline.add(
+                    f'{result_name}_report', report_results,
+                    after=generate + previous_report, process=True)]
+            elif args.convergence:
                 if args.generate:
                     print(f'Generating {result_name} convergence results.')
                     result_object.generate_convergence_results(root_dir,
@@ -101,6 +140,7 @@ if __name__ == "__main__":
                     result_object.generate_results(root_dir, args.args)
                 print(f'Reporting {result_name} results.')
                 result_object.report_results(root_dir, args.args)
+    pipeline.run()
     if args.convergence:
         if not args.generate and not (args.results is None):
             raise Exception("If passing --convergence, cannot pass both "
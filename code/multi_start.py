@@ -0,0 +1,252 @@
+"""Solve a MocoStudy from several starting points in parallel and keep the
+best solution; predictive problems (e.g., squat-to-stand with an optimized
+spring stiffness) often have local minima.
+
+Each start is a perturbation of the study's initial guess, with the
+parameters sampled from given ranges. The starts run in worker processes
+(the bindings hold the interpreter lock during MocoStudy.solve()), which are
+forked after the study is created, so the model is processed only once.
+Each start is solved in rounds of `round_iterations` IPOPT iterations, each
+round starting from the previous round's iterate. After each round, a start
+whose objective trails the best objective that any start reached after the
+same round (or the best converged objective) by more than `prune_margin`
+(relative) is stopped, so that starts heading for a poor optimum do not cost
+a full solve. IPOPT's multipliers and barrier parameter are re-initialized
+in each round, which costs a few iterations per round; use rounds of at
+least a few dozen iterations.
+
+The objectives of unconverged iterates are only an estimate of where a start
+is heading, so no start is pruned before `min_rounds` rounds. Which starts
+are pruned depends on the order in which the starts finish their rounds, so
+pruning is disabled in the deterministic mode (see deterministic.py).
+"""
+import os
+import math
+import shutil
+import tempfile
+import multiprocessing
+
+import numpy as np
+
+import opensim as osim
+
+import deterministic
+from utilities import moco_parallel
+
+# Set in each worker process by _initialize_worker().
+_worker = dict()
+
+
+def perturb(guess, noise, rng):
+    """Add normally-distributed noise to the states, controls and
+    multipliers of the guess (in place), scaled by `noise` times the largest
+    magnitude of each variable's values."""
+    def perturb_all(names, get, set):
+        for name in names:
+            values = get(name).to_numpy()
+            scale = noise * max(np.max(np.abs(values)), 1e-2)
+            set(name, osim.Vector(
+                values + scale * rng.standard_normal(len(values))))
+    perturb_all(guess.getStateNames(), guess.getState, guess.setState)
+    perturb_all(guess.getControlNames(), guess.getControl, guess.setControl)
+    perturb_all(guess.getMultiplierNames(), guess.getMultiplier,
+                guess.setMultiplier)
+    return guess
+
+
+def _initialize_worker(study, threads_per_start, best_at_round,
+                       best_converged, lock):
+    # Set on the solver in _solve_start(), since Moco ignores
+    # OPENSIM_MOCO_PARALLEL if the solver's 'parallel' setting is set.
+    _worker.update(study=study, threads_per_start=threads_per_start,
+                   best_at_round=best_at_round,
+                   best_converged=best_converged, lock=lock)
+
+
+def _trails(objective, best, margin):
+    return math.isfinite(best) and objective > best + margin * abs(best)
+
+
+def _solve_start(args):
+    (index, guess_fpath, solution_fpath, round_iterations, max_rounds,
+     min_rounds, prune_margin) = args
+    study = _worker['study']
+    best_at_round = _worker['best_at_round']
+    best_converged = _worker['best_converged']
+    lock = _worker['lock']
+    study.set_write_solution('false')
+    solver = osim.MocoCasADiSolver.safeDownCast(study.updSolver())
+    # A single thread is 0 (serial); 1 would use all hardware threads.
+    solver.set_parallel(moco_parallel(_worker['threads_per_start']))
+    solver.set_optim_max_iterations(round_iterations)
+    result = {'start': index, 'status': 'pruned', 'success': False,
+              'num_iterations': 0, 'solver_duration': 0.0,
+              'objectives': list()}
+    guess = osim.MocoTrajectory(guess_fpath)
+    for iround in range(max_rounds):
+        solver.setGuess(guess)
+        solution = study.solve()
+        solution.unseal()
+        objective = solution.getObjective()
+        result['objectives'].append(objective)
+        result['num_iterations'] += solution.getNumIterations()
+        result['solver_duration'] += solution.getSolverDuration()
+        guess = solution
+        with lock:
+            if solution.success():
+                best_converged.value = min(best_converged.value, objective)
+            best_at_round[iround] = min(best_at_round[iround], objective)
+            best = min(best_at_round[iround], best_converged.value)
+        if solution.success():
+            result.update(status='converged', success=True)
+            break
+        if iround + 1 >= min_rounds and _trails(objective, best,
+                                                prune_margin):
+            print(f'MultiStart: pruning start {index} after round '
+                  f'{iround + 1} (objective {objective:g}, best {best:g}).')
+            break
+    else:
+        result['status'] = solution.getStatus()
+    result['objective'] = result['objectives'][-1]
+    for name in solution.getParameterNames():
+        result.setdefault('parameters', dict())[name] = \
+            solution.getParameter(name)
+    solution.write(solution_fpath)
+    result['solution_file'] = solution_fpath
+    return result
+
+
+class MultiStart(object):
+    """Solve the study returned by `create_study()` (with a
+    MocoCasADiSolver) from `num_starts` starting points, `num_processes` at
+    a time, each solve using `threads_per_start` threads. The first start
+    uses the study's guess (or the solver's default guess) unchanged; the
+    others perturb it by `noise` (see perturb()). `parameters` ({name: (lower,
+    upper)}) gives the ranges from which each start's parameter values are
+    sampled uniformly. Starts that have not converged after `max_iterations`
+    are kept as candidates only if no start converged. The guesses and
+    solutions of the starts are written to `work_dir`; if it is None, a
+    temporary directory is used and removed when solve() returns.
+    """
+    def __init__(self, create_study, num_starts=8, num_processes=None,
+                 threads_per_start=None, parameters=None, noise=0.1, seed=0,
+                 round_iterations=50, max_iterations=1000, min_rounds=2,
+                 prune_margin=0.2, work_dir=None):
+        self.create_study = create_study
+        self.num_starts = num_starts
+        if num_processes is None:
+            num_processes = min(num_starts, os.cpu_count())
+        self.num_processes = num_processes
+        if threads_per_start is None:
+            threads_per_start = max(1, os.cpu_count() // num_processes)
+        self.threads_per_start = threads_per_start
+        self.parameters = parameters or dict()
+        self.noise = noise
+        self.seed = seed
+        self.round_iterations = round_iterations
+        self.max_iterations = max_iterations
+        self.min_rounds = min_rounds
+        self.prune_margin = prune_margin
+        self.work_dir = work_dir
+        self.results = list()
+
+    def create_guesses(self, study):
+        # create_study() has called resetProblem() on the solver, as
+        # SquatToStand does before setting its guess.
+        solver = osim.MocoCasADiSolver.safeDownCast(study.updSolver())
+        base = solver.getGuess()
+        rng = np.random.default_rng(self.seed)
+        guesses = list()
+        for index in range(self.num_starts):
+            guess = osim.MocoTrajectory(base)
+            if index > 0:
+                perturb(guess, self.noise, rng)
+                for name, (lower, upper) in self.parameters.items():
+                    guess.setParameter(name, rng.uniform(lower, upper))
+            guesses.append(guess)
+        return guesses
+
+    def solve(self):
+        """Solve all starts and return the best solution (the converged
+        solution with the lowest objective) as a MocoTrajectory. The result
+        of each start (status, objective after each round, iterations,
+        parameters, and the solution file if `work_dir` was given) is in
+        `results`, and get_spread() summarizes the converged objectives."""
+        if self.work_dir:
+            os.makedirs(self.work_dir, exist_ok=True)
+            return self._solve(self.work_dir)
+        work_dir = tempfile.mkdtemp(prefix='multi_start_')
+        try:
+            solution = self._solve(work_dir)
+        finally:
+            shutil.rmtree(work_dir, ignore_errors=True)
+        # The solution files no longer exist.
+        for result in self.results:
+            result['solution_file'] = None
+        return solution
+
+    def _solve(self, work_dir):
+        study = self.create_study()
+        starts = list()
+        max_rounds = max(1, math.ceil(self.max_iterations /
+                                      self.round_iterations))
+        prune_margin = (math.inf if deterministic.is_enabled()
+                        else self.prune_margin)
+        for index, guess in enumerate(self.create_guesses(study)):
+            guess_fpath = os.path.join(work_dir, f'guess_{index}.sto')
+            guess.write(guess_fpath)
+            starts.append((index, guess_fpath,
+                           os.path.join(work_dir, f'solution_{index}.sto'),
+                           self.round_iterations, max_rounds,
+                           self.min_rounds, prune_margin))
+
+        # Fork, so that the workers inherit the study without serializing
+        # it.
+        context = multiprocessing.get_context('fork')
+        best_at_round = context.Array('d', [math.inf] * max_rounds,
+                                      lock=False)
+        best_converged = context.Value('d', math.inf, lock=False)
+        lock = context.Lock()
+        with context.Pool(self.num_processes, initializer=_initialize_worker,
+                          initargs=(study, self.threads_per_start,
+                                    best_at_round, best_converged,
+                                    lock)) as pool:
+            self.results = list()
+            for result in pool.imap_unordered(_solve_start, starts):
+                print(f'MultiStart: start {result["start"]} '
+                      f'{result["status"]} with objective '
+                      f'{result["objective"]:g} after '
+                      f'{result["num_iterations"]} iterations.')
+                self.results.append(result)
+        self.results.sort(key=lambda result: result['start'])
+
+        candidates = [result for result in self.results if result['success']]
+        if not candidates:
+            candidates = [result for result in self.results
+                          if result['status'] != 'pruned']
+        if not candidates:
+            candidates = self.results
+        best = min(candidates, key=lambda result: result['objective'])
+        print(f'MultiStart: best is start {best["start"]} with objective '
+              f'{best["objective"]:g}.')
+        solution = osim.MocoTrajectory(best['solution_file'])
+        return solution
+
+    def get_spread(self):
+        """Statistics of the converged starts' objectives and parameters."""
+        converged = [result for result in self.results if result['success']]
+        objectives = np.array([result['objective'] for result in converged])
+        spread = {'num_starts': len(self.results),
+                  'num_converged': len(converged),
+                  'num_pruned': len([result for result in self.results
+                                     if result['status'] == 'pruned'])}
+        if len(converged):
+            spread.update(objective_min=float(objectives.min()),
+                          objective_median=float(np.median(objectives)),
+                          objective_max=float(objectives.max()),
+                          objective_std=float(objectives.std()))
+            for name in converged[0].get('parameters', dict()):
+                values = [result['parameters'][name] for result in converged]
+                spread[f'{name}_min'] = float(np.min(values))
+                spread[f'{name}_max'] = float(np.max(values))
+        return spread
@@ -0,0 +1,347 @@
+"""Evaluate the curves of all DeGrooteFregly2016 muscles in a model at once.
+
+A MuscleBank stores the parameters of every DeGrooteFregly2016Muscle in a
+model as numpy arrays (one entry per muscle), and evaluates each curve for all
+muscles and all time points in a single vectorized expression, instead of one
+muscle (and one Output) at a time through osim.analyze(). The parameters are
+read from the processed model, so model operators such as
+ModOpScaleActiveFiberForceCurveWidthDGF(), ModOpIgnorePassiveFiberForcesDGF(),
+ModOpFiberDampingDGF() and ModOpIgnoreTendonCompliance() are respected.
+
+Arrays of values have shape (num_times, num_muscles), with the muscles in the
+order of MuscleBank.paths. The curves are the same as those in
+DeGrooteFregly2016Muscle (De Groote et al., 2016, Annals of Biomedical
+Engineering).
+
+The results match osim.analyze() only if the fiber velocity can be computed
+exactly: for rigid tendons, or for compliant tendons with implicit tendon
+compliance dynamics (the tendon force derivative is in the trajectory). With
+explicit tendon compliance dynamics, the fiber velocity is estimated from the
+force-velocity curve without fiber damping and is clipped to [-1, 1], so
+scripts use the bank only where can_analyze() is True.
+compare_with_analyze() checks the bank against osim.analyze().
+"""
+import numpy as np
+import opensim as osim
+
+from utilities import toarray
+
+# Active force-length curve: the sum of three Gaussian-like curves.
+ACTIVE_FORCE_LENGTH = np.array([
+    [0.8150671134243542, 1.055033428970575, 0.162384573599574,
+     0.063303448465465],
+    [0.433004984392647, 0.716775413397760, -0.029947116970696,
+     0.200356847296188],
+    [0.1, 1.0, 0.5 * np.sqrt(0.5), 0.0]])
+# Force-velocity curve.
+FORCE_VELOCITY = np.array([-0.3211346127989808, -8.149, -0.374,
+                           0.8825327733249912])
+# Tendon force-length curve.
+TENDON_FORCE_LENGTH = np.array([0.200, 1.0, 0.200])
+PASSIVE_EXPONENT = 4.0
+MIN_NORM_FIBER_LENGTH = 0.2
+
+
+class MuscleBank(object):
+    """The parameters of all DeGrooteFregly2016 muscles in a model, stored as
+    arrays. Muscles of other types are skipped (see `paths`)."""
+    def __init__(self, model):
+        model.finalizeConnections()
+        self.paths = list()
+        parameters = {key: list() for key in [
+            'max_isometric_force', 'optimal_fiber_length',
+            'tendon_slack_length', 'pennation_angle_at_optimal',
+            'max_contraction_velocity', 'active_force_width_scale',
+            'fiber_damping', 'passive_fiber_strain_at_one_norm_force',
+            'tendon_strain_at_one_norm_force', 'ignore_passive_fiber_force',
+            'ignore_tendon_compliance']}
+        muscles = model.getMuscles()
+        for imusc in range(muscles.getSize()):
+            muscle = osim.DeGrooteFregly2016Muscle.safeDownCast(
+                muscles.get(imusc))
+            if not muscle:
+                continue
+            self.paths.append(muscle.getAbsolutePathString())
+            parameters['max_isometric_force'].append(
+                muscle.getMaxIsometricForce())
+            parameters['optimal_fiber_length'].append(
+                muscle.getOptimalFiberLength())
+            parameters['tendon_slack_length'].append(
+                muscle.getTendonSlackLength())
+            parameters['pennation_angle_at_optimal'].append(
+                muscle.getPennationAngleAtOptimalFiberLength())
+            parameters['max_contraction_velocity'].append(
+                muscle.getMaxContractionVelocity())
+            parameters['active_force_width_scale'].append(
+                muscle.get_active_force_width_scale())
+            parameters['fiber_damping'].append(muscle.get_fiber_damping())
+            parameters['passive_fiber_strain_at_one_norm_force'].append(
+                muscle.get_passive_fiber_strain_at_one_norm_force())
+            parameters['tendon_strain_at_one_norm_force'].append(
+                muscle.get_tendon_strain_at_one_norm_force())
+            parameters['ignore_passive_fiber_force'].append(
+                muscle.get_ignore_passive_fiber_force())
+            parameters['ignore_tendon_compliance'].append(
+                muscle.get_ignore_tendon_compliance())
+        for key, value in parameters.items():
+            dtype = bool if key.startswith('ignore') else float
+            setattr(self, key, np.array(value, dtype=dtype))
+
+        # Quantities that do not depend on the state.
+        self.fiber_width = (self.optimal_fiber_length *
+                            np.sin(self.pennation_angle_at_optimal))
+        c1, c2, c3 = TENDON_FORCE_LENGTH
+        self.tendon_stiffness = (np.log((1.0 + c3) / c1) /
+                                 (1.0 + self.tendon_strain_at_one_norm_force -
+                                  c2))
+        self.passive_offset = np.exp(
+            PASSIVE_EXPONENT * (MIN_NORM_FIBER_LENGTH - 1.0) /
+            self.passive_fiber_strain_at_one_norm_force)
+        self.passive_denominator = (np.exp(PASSIVE_EXPONENT) -
+                                    self.passive_offset)
+
+    @property
+    def num_muscles(self):
+        return len(self.paths)
+
+    def calc_active_force_length_multiplier(self, norm_fiber_length):
+        # The curve is widened about norm_fiber_length = 1.
+        x = 1.0 + (norm_fiber_length - 1.0) / self.active_force_width_scale
+        multiplier = np.zeros(np.shape(x))
+        for b1, b2, b3, b4 in ACTIVE_FORCE_LENGTH:
+            multiplier += b1 * np.exp(-0.5 * (x - b2)**2 / (b3 + b4 * x)**2)
+        return multiplier
+
+    def calc_passive_force_length_multiplier(self, norm_fiber_length):
+        multiplier = (np.exp(PASSIVE_EXPONENT * (norm_fiber_length - 1.0) /
+                             self.passive_fiber_strain_at_one_norm_force) -
+                      self.passive_offset) / self.passive_denominator
+        return np.where(self.ignore_passive_fiber_force, 0.0, multiplier)
+
+    def calc_force_velocity_multiplier(self, norm_fiber_velocity):
+        d1, d2, d3, d4 = FORCE_VELOCITY
+        y = d2 * norm_fiber_velocity + d3
+        return d1 * np.log(y + np.sqrt(y**2 + 1.0)) + d4
+
+    def calc_force_velocity_inverse(self, force_velocity_multiplier):
+        d1, d2, d3, d4 = FORCE_VELOCITY
+        return (np.sinh((force_velocity_multiplier - d4) / d1) - d3) / d2
+
+    def calc_tendon_force_multiplier(self, norm_tendon_length):
+        c1, c2, c3 = TENDON_FORCE_LENGTH
+        return (c1 * np.exp(self.tendon_stiffness * (norm_tendon_length - c2))
+                - c3)
+
+    def calc_tendon_force_length_inverse(self, norm_tendon_force):
+        c1, c2, c3 = TENDON_FORCE_LENGTH
+        return (np.log((norm_tendon_force + c3) / c1) / self.tendon_stiffness
+                + c2)
+
+    def calc_muscle_mechanics(self, muscle_tendon_length,
+                              muscle_tendon_velocity, activation,
+                              norm_tendon_force=None,
+                              norm_tendon_force_derivative=None):
+        """Compute the fiber and tendon quantities for all muscles. The
+        arguments have shape (num_times, num_muscles).
+
+        For muscles with a compliant tendon, the tendon length is obtained
+        from norm_tendon_force. The fiber velocity is obtained from
+        norm_tendon_force_derivative if given (implicit tendon compliance
+        dynamics); otherwise, it is obtained by solving the fiber-tendon
+        equilibrium for the force-velocity multiplier, which neglects fiber
+        damping and clips the velocity, so it is only an estimate (see
+        can_analyze()). The entries of norm_tendon_force for muscles with a
+        rigid tendon are ignored.
+
+        Returns
+        -------
+        dict of numpy.ndarray
+            'normalized_fiber_length', 'normalized_fiber_velocity',
+            'cos_pennation_angle', 'active_force_length_multiplier',
+            'force_velocity_multiplier', 'passive_force_multiplier',
+            'active_fiber_force', 'passive_fiber_force', 'fiber_force' and
+            'tendon_force'.
+        """
+        rigid = self.ignore_tendon_compliance
+        lMT = np.asarray(muscle_tendon_length, dtype=float)
+        vMT = np.asarray(muscle_tendon_velocity, dtype=float)
+        activation = np.asarray(activation, dtype=float)
+        if norm_tendon_force is None:
+            if not np.all(rigid):
+                raise Exception('norm_tendon_force is required for muscles '
+                                'with a compliant tendon.')
+            norm_tendon_force = np.zeros(lMT.shape)
+        # Evaluate the inverse curve only where it is used, since the rigid
+        # tendon entries may be arbitrary.
+        fT = np.where(rigid, 0.0, norm_tendon_force)
+        tendon_length = self.tendon_slack_length * np.where(
+            rigid, 1.0, self.calc_tendon_force_length_inverse(fT))
+
+        fiber_length_along_tendon = lMT - tendon_length
+        fiber_length = np.sqrt(fiber_length_along_tendon**2 +
+                               self.fiber_width**2)
+        norm_fiber_length = fiber_length / self.optimal_fiber_length
+        cos_pennation = fiber_length_along_tendon / fiber_length
+
+        fL = self.calc_active_force_length_multiplier(norm_fiber_length)
+        fPE = self.calc_passive_force_length_multiplier(norm_fiber_length)
+        max_fiber_velocity = (self.max_contraction_velocity *
+                              self.optimal_fiber_length)
+
+        # Rigid tendon: the fiber velocity follows from the muscle-tendon
+        # velocity.
+        norm_fiber_velocity_rigid = vMT * cos_pennation / max_fiber_velocity
+        if norm_tendon_force_derivative is not None:
+            c3 = TENDON_FORCE_LENGTH[2]
+            tendon_velocity = (self.tendon_slack_length *
+                               np.asarray(norm_tendon_force_derivative) /
+                               (self.tendon_stiffness * (fT + c3)))
+            norm_fiber_velocity_compliant = ((vMT - tendon_velocity) *
+                                             cos_pennation /
+                                             max_fiber_velocity)
+        else:
+            with np.errstate(divide='ignore', invalid='ignore'):
+                fV = ((fT / cos_pennation - fPE) /
+                      (np.maximum(activation, 1e-10) * fL))
+            norm_fiber_velocity_compliant = np.clip(
+                self.calc_force_velocity_inverse(fV), -1.0, 1.0)
+        norm_fiber_velocity = np.where(rigid, norm_fiber_velocity_rigid,
+                                       norm_fiber_velocity_compliant)
+
+        fV = self.calc_force_velocity_multiplier(norm_fiber_velocity)
+        active_fiber_force = (self.max_isometric_force * activation * fL * fV)
+        passive_fiber_force = self.max_isometric_force * (
+            fPE + self.fiber_damping * norm_fiber_velocity)
+        fiber_force = active_fiber_force + passive_fiber_force
+        tendon_force = np.where(rigid, fiber_force * cos_pennation,
+                                self.max_isometric_force * fT)
+        return {
+            'normalized_fiber_length': norm_fiber_length,
+            'normalized_fiber_velocity': norm_fiber_velocity,
+            'cos_pennation_angle': cos_pennation,
+            'active_force_length_multiplier': fL,
+            'force_velocity_multiplier': fV,
+            'passive_force_multiplier': fPE,
+            'active_fiber_force': active_fiber_force,
+            'passive_fiber_force': passive_fiber_force,
+            'fiber_force': fiber_force,
+            'tendon_force': tendon_force,
+        }
+
+    def calc_muscle_tendon_kinematics(self, model, trajectory):
+        """Compute the muscle-tendon lengths and lengthening speeds of all
+        muscles over a MocoTrajectory. This is the only part that requires
+        realizing the model; the paths are evaluated once per time point for
+        all muscles."""
+        model.initSystem()
+        muscles = [osim.Muscle.safeDownCast(model.getComponent(path))
+                   for path in self.paths]
+        states = trajectory.exportToStatesTrajectory(model)
+        num_times = states.getSize()
+        lengths = np.empty((num_times, self.num_muscles))
+        speeds = np.empty((num_times, self.num_muscles))
+        for itime in range(num_times):
+            state = states.get(itime)
+            model.realizeVelocity(state)
+            for imusc, muscle in enumerate(muscles):
+                lengths[itime, imusc] = muscle.getLength(state)
+                speeds[itime, imusc] = muscle.getLengtheningSpeed(state)
+        return lengths, speeds
+
+    def has_tendon_force_derivatives(self, trajectory):
+        """Whether the trajectory contains the normalized tendon force
+        derivative of every muscle with a compliant tendon (implicit tendon
+        compliance dynamics)."""
+        name = 'implicitderiv_normalized_tendon_force'
+        names = (set(trajectory.getDerivativeNames()) |
+                 set(trajectory.getControlNames()))
+        return all(f'{path}/{name}' in names
+                   for path, rigid in zip(self.paths,
+                                          self.ignore_tendon_compliance)
+                   if not rigid)
+
+    def can_analyze(self, model, trajectory):
+        """Whether analyze() gives the same results as osim.analyze() for
+        this model and trajectory: every muscle is a DeGrooteFregly2016Muscle,
+        and every tendon is rigid or its force derivative is in the
+        trajectory."""
+        return (self.num_muscles == model.getMuscles().getSize() and
+                (np.all(self.ignore_tendon_compliance) or
+                 self.has_tendon_force_derivatives(trajectory)))
+
+    def compare_with_analyze(self, model, trajectory, outputs,
+                             tolerance=1e-6):
+        """Compute the outputs with analyze() and with osim.analyze(), and
+        raise an exception if any value differs by more than tolerance
+        (relative to the largest magnitude of that output). Returns the
+        largest relative difference for each output."""
+        table = self.analyze(model, trajectory, outputs)
+        reference = osim.analyze(model, trajectory,
+                                 [f'.*\\|{output}' for output in outputs])
+        differences = dict()
+        for output in outputs:
+            labels = [f'{path}|{output}' for path in self.paths]
+            values = np.array([toarray(table.getDependentColumn(label))
+                               for label in labels])
+            expected = np.array([toarray(reference.getDependentColumn(label))
+                                 for label in labels])
+            scale = max(np.max(np.abs(expected)), 1e-10)
+            differences[output] = np.max(np.abs(values - expected)) / scale
+            if differences[output] > tolerance:
+                raise Exception(f'MuscleBank: {output} differs from '
+                                f'osim.analyze() by '
+                                f'{differences[output]:g} (relative), more '
+                                f'than the tolerance {tolerance:g}.')
+        return differences
+
+    def analyze(self, model, trajectory, outputs):
+        """Compute the given quantities (keys of the dict returned by
+        calc_muscle_mechanics()) over a MocoTrajectory, and return them in a
+        TimeSeriesTable with the same column labels as osim.analyze() (e.g.,
+        '/forceset/soleus_r|tendon_force'). The values match osim.analyze()
+        only if can_analyze() is True."""
+        lengths, speeds = self.calc_muscle_tendon_kinematics(model, trajectory)
+        state_names = set(trajectory.getStateNames())
+        control_names = set(trajectory.getControlNames())
+        derivative_names = set(trajectory.getDerivativeNames())
+        num_times = lengths.shape[0]
+
+        def column(names, get, suffix, default):
+            values = np.full((num_times, self.num_muscles), default)
+            for imusc, path in enumerate(self.paths):
+                name = f'{path}/{suffix}'
+                if name in names:
+                    values[:, imusc] = get(name)
+            return values
+
+        activation = column(state_names, trajectory.getStateMat,
+                            'activation', 0.0)
+        norm_tendon_force = None
+        norm_tendon_force_derivative = None
+        if not np.all(self.ignore_tendon_compliance):
+            norm_tendon_force = column(state_names, trajectory.getStateMat,
+                                       'normalized_tendon_force', 0.0)
+            # With implicit tendon compliance dynamics, the derivative is a
+            # variable of the problem.
+            name = 'implicitderiv_normalized_tendon_force'
+            if any(n.endswith(name) for n in derivative_names):
+                norm_tendon_force_derivative = column(
+                    derivative_names, trajectory.getDerivativeMat, name, 0.0)
+            elif any(n.endswith(name) for n in control_names):
+                norm_tendon_force_derivative = column(
+                    control_names, trajectory.getControlMat, name, 0.0)
+
+        mechanics = self.calc_muscle_mechanics(
+            lengths, speeds, activation, norm_tendon_force,
+            norm_tendon_force_derivative)
+
+        labels = [f'{path}|{output}' for output in outputs
+                  for path in self.paths]
+        data = np.hstack([mechanics[output] for output in outputs])
+        table = osim.TimeSeriesTable()
+        table.setColumnLabels(labels)
+        time = trajectory.getTimeMat()
+        for itime in range(num_times):
+            table.appendRow(float(time[itime]), osim.RowVector(
+                [float(value) for value in data[itime]]))
+        return table
@@ -0,0 +1,170 @@
+"""Run the stages of a workflow (e.g., solve, create the full gait cycle,
+compute the ground reaction forces, report) as a graph, starting each stage
+as soon as the stages it depends on have finished, so that post-processing
+and reporting of one result overlap with solving the next one.
+
+A stage is a function that receives the outputs of the stages it depends on
+(in the order they are listed) and returns its own output, which is passed
+to the later stages in memory. Stages run on background threads by default.
+The bindings hold the interpreter lock while MocoStudy.solve() (and other
+long calls into OpenSim) run, so threads would not overlap with a solve:
+stages created with `process=True` run in a forked process instead (as do
+MultiStart's starts), which inherits the outputs of earlier stages without
+serializing them. The output of a process stage is sent back to the
+pipeline, so it must be picklable (e.g., the path of a solution file).
+Anything else a process stage computes (e.g., a cache it fills) is lost
+when its process exits, so fill shared caches before running the pipeline
+(see MotionTrackingWalking.process_models()).
+
+Stages that must not run at the same time (e.g., solves that each use all
+of the cores) are ordered by listing one as a dependency of the next; a
+dependency need not pass an output that the stage uses (see `after`).
+
+Process stages are forked while thread stages may be running. Forking is
+safe for the Python objects of the other threads, but stages should not
+hold locks in native libraries across long calls (for example, a thread
+stage should not be writing to a file that a process stage also writes).
+"""
+import sys
+import time
+import traceback
+import multiprocessing
+import concurrent.futures
+
+import deterministic
+
+
+class StageError(Exception):
+    """A stage raised an exception; the message includes the stage's
+    traceback (for process stages, the traceback in the child process)."""
+    pass
+
+
+def _run_in_process(function, args):
+    # Fork, so that the child inherits the function and its arguments.
+    context = multiprocessing.get_context('fork')
+    receiver, sender = context.Pipe(duplex=False)
+
+    def target():
+        try:
+            output = ('output', function(*args))
+        except BaseException:
+            output = ('error', traceback.format_exc())
+        try:
+            sender.send(output)
+        except Exception:
+            sender.send(('error', traceback.format_exc()))
+        sender.close()
+
+    process = context.Process(target=target)
+    process.start()
+    sender.close()
+    try:
+        kind, value = receiver.recv()
+    except EOFError:
+        kind, value = 'error', (f'The process exited with code '
+                                f'{process.exitcode} before sending its '
+                                f'output.')
+    process.join()
+    if kind == 'error':
+        raise StageError(value)
+    return value
+
+
+class Pipeline(object):
+    """A graph of stages, run by run() or as_completed(). Thread stages run
+    `num_threads` at a time, and process stages `num_processes` at a time;
+    in the deterministic mode (see deterministic.py), one stage runs at a
+    time, in the order in which the stages were added."""
+    def __init__(self, num_threads=4, num_processes=1):
+        self.num_threads = num_threads
+        self.num_processes = num_processes
+        self.stages = dict()
+        self.order = list()
+        self.durations = dict()
+
+    def add(self, name, function, dependencies=(), after=(), process=False):
+        """Add a stage that calls function(*outputs of dependencies). The
+        stage also waits for the stages in `after`, without receiving their
+        outputs. Returns the name, for use in later dependencies."""
+        if name in self.stages:
+            raise Exception(f'Stage {name} already exists.')
+        for dependency in list(dependencies) + list(after):
+            if dependency not in self.stages:
+                raise Exception(f'Stage {name} depends on {dependency}, '
+                                f'which must be added first.')
+        self.stages[name] = {'function': function,
+                             'dependencies': list(dependencies),
+                             'after': list(after),
+                             'process': process}
+        self.order.append(name)
+        return name
+
+    def as_completed(self):
+        """Run the stages, yielding (name, output) for each stage as it
+        finishes. If a stage fails, the stages that have started are
+        allowed to finish, the others are not started, and StageError is
+        raised."""
+        serial = deterministic.is_enabled()
+        threads = concurrent.futures.ThreadPoolExecutor(
+            1 if serial else self.num_threads)
+        # Each process stage waits for its process on one of these threads.
+        processes = concurrent.futures.ThreadPoolExecutor(
+            1 if serial else self.num_processes)
+        outputs = dict()
+        running = dict()
+        pending = list(self.order)
+        started = dict()
+        error = None
+        try:
+            while pending or running:
+                if error is None:
+                    for name in list(pending):
+                        stage = self.stages[name]
+                        if not all(dependency in outputs for dependency in
+                                   stage['dependencies'] + stage['after']):
+                            if serial:
+                                break
+                            continue
+                        args = [outputs[dependency]
+                                for dependency in stage['dependencies']]
+                        if stage['process']:
+                            future = processes.submit(
+                                _run_in_process, stage['function'], args)
+                        else:
+                            future = threads.submit(stage['function'], *args)
+                        running[future] = name
+                        started[name] = time.time()
+                        pending.remove(name)
+                        if serial:
+                            break
+                if not running:
+                    break
+                done, _ = concurrent.futures.wait(
+                    running, return_when=concurrent.futures.FIRST_COMPLETED)
+                for future in done:
+                    name = running.pop(future)
+                    self.durations[name] = time.time() - started[name]
+                    try:
+                        outputs[name] = future.result()
+                    except StageError as e:
+                        error = error or StageError(f'Stage {name} failed:\n'
+                                                    f'{e}')
+                        continue
+                    except Exception:
+                        error = error or StageError(
+                            f'Stage {name} failed:\n{traceback.format_exc()}')
+                        continue
+                    print(f'Pipeline: {name} finished after '
+                          f'{self.durations[name]:.1f} s.')
+                    sys.stdout.flush()
+                    yield name, outputs[name]
+        finally:
+            threads.shutdown(wait=True)
+            processes.shutdown(wait=True)
+        if error is not None:
+            raise error
+
+    def run(self):
+        """Run all stages and return their outputs, {name: output}."""
+        return dict(self.as_completed())
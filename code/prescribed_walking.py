@@ -6,6 +6,7 @@ import matplotlib.gridspec as gridspec
 import opensim as osim
 
 from moco_paper_result import MocoPaperResult
+from static_optimization import solve_inverse
 
 import utilities
 
@@ -169,8 +170,12 @@ class MotionPrescribedWalking(MocoPaperResult):
     def solve_inverse(self, root_dir, modelProcessor, mesh_interval,
                       solution_filepath):
         inverse = self.create_inverse(root_dir, modelProcessor, mesh_interval)
-        solution = inverse.solve()
-        solution.getMocoSolution().write(solution_filepath)
+        # Static optimizations per mesh point if the problem separates by
+        # time point; MocoInverse otherwise, which is the case for this model
+        # (it has coupler constraints and activation dynamics; see
+        # static_optimization.py).
+        solution = solve_inverse(inverse)
+        solution.write(solution_filepath)
 
     def generate_results(self, root_dir, args):
         self.parse_args(args)
@@ -6,6 +6,7 @@ import os
 import opensim as osim
 
 import utilities
+import binary_trajectory
 from prescribed_walking import MotionPrescribedWalking
 from tracking_walking import MotionTrackingWalking
 from squat_to_stand import SquatToStand
@@ -20,15 +21,25 @@ def get_convergence_results(root_dir, result):
         if not os.path.exists(solution_fpath):
             print(f"Warning: solution {solution_fpath} does not exist.")
             continue
-        table = osim.TimeSeriesTable(solution_fpath)
+        # We only need the number of rows and the objective, which a binary
+        # trajectory (if one was converted; see binary_trajectory.py)
+        # provides without parsing the (large) solution.
+        trajectory = binary_trajectory.open_existing(solution_fpath)
+        if trajectory:
+            num_rows = trajectory.num_rows
+            objective = trajectory.metadata['objective']
+        else:
+            table = osim.TimeSeriesTable(solution_fpath)
+            num_rows = table.getNumRows()
+            objective = table.getTableMetaDataAsString('objective')
         num_mesh_intervals = md['num_mesh_intervals']
         # All problems use Hermite-Simpson transcription.
-        if table.getNumRows() != 2 * num_mesh_intervals + 1:
+        if num_rows != 2 * num_mesh_intervals + 1:
             print("Warning: inconsistent number of mesh intervals "
-                  f"({(table.getNumRows() - 1) / 2} vs {num_mesh_intervals}).")
-        num_mesh_intervals = (table.getNumRows() - 1) / 2
+                  f"({(num_rows - 1) / 2} vs {num_mesh_intervals}).")
+        num_mesh_intervals = (num_rows - 1) / 2
         x.append(num_mesh_intervals)
-        costs.append(float(table.getTableMetaDataAsString('objective')))
+        costs.append(float(objective))
     # Normalize costs.
     if costs:
         costs = np.array(costs) / costs[-1]
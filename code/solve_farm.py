@@ -0,0 +1,423 @@
+"""Solve MocoStudy problems on a pool of worker nodes that share a directory.
+
+A job is a MocoTrack or MocoStudy serialized to XML (.omoco), along with
+the directory in which its relative file paths (models, references, external
+loads) are resolved, the number of threads, and a memory budget. For a
+MocoTrack, the job can also name a function ('module:function', importable
+from the working directory) that customizes the MocoStudy returned by
+MocoTrack.initialize(), as exampleMocoTrack.cpp does in code. A MocoStudy
+job must read its tables from files: tables held in memory (e.g., the
+references that MocoTrack.initialize() creates) are not serialized. Jobs are
+identified by a hash of the XML, the customize function, the contents of the
+job's input files, and the Moco version, so submitting the same problem twice
+solves it only once, and a problem that has already been solved is not
+queued again.
+
+The farm directory (on a file system shared by all nodes) contains:
+    queue/<hash>.json      jobs waiting for a worker.
+    running/<hash>.json    jobs claimed by a worker, with the worker's
+                           heartbeat as the file's modification time.
+    jobs/<hash>.omoco      the serialized studies.
+    results/<hash>/        solution.sto and result.json (status, timings,
+                           host) for each finished job.
+Workers claim a job by renaming it from queue/ to running/, which succeeds
+for exactly one worker. A job whose worker stops sending heartbeats (e.g.,
+the node was preempted) is returned to the queue by the other workers.
+
+Each job runs in its own process, pinned to `num_threads` of the worker's
+CPUs, with its address space limited to the job's memory budget, so a job
+that exceeds its budget fails without taking down the worker or the other
+jobs. A worker starts a job only when enough of its CPUs and memory are
+free. The solver's 'parallel' setting is set to the job's number of threads
+(0, i.e. serial, for one thread), replacing any setting in the XML.
+
+Examples
+--------
+Submit a study from Python:
+    import solve_farm
+    key = solve_farm.submit('/shared/farm', track, 'tracking_walking',
+                            working_dir='/shared/mocopaper/code',
+                            customize='my_problems:customize_walking',
+                            num_threads=8, memory_budget=8e9)
+    solution_fpath = solve_farm.wait('/shared/farm', [key])[key]
+Submit a study file:
+    python3 solve_farm.py submit /shared/farm track.omoco --threads 8
+Start a worker on each node (using all of the node's CPUs and 64 GB):
+    python3 solve_farm.py worker /shared/farm --memory 64
+Show the queue:
+    python3 solve_farm.py status /shared/farm
+"""
+import os
+import sys
+import json
+import time
+import socket
+import hashlib
+import importlib
+import resource
+import tempfile
+import subprocess
+import xml.etree.ElementTree as ET
+
+import opensim as osim
+
+from utilities import moco_parallel
+
+HEARTBEAT_INTERVAL = 30
+# A running job whose heartbeat is older than this is returned to the queue.
+STALE_TIMEOUT = 10 * HEARTBEAT_INTERVAL
+
+
+def _paths(farm_dir, key):
+    return {
+        'queue': os.path.join(farm_dir, 'queue', f'{key}.json'),
+        'running': os.path.join(farm_dir, 'running', f'{key}.json'),
+        'study': os.path.join(farm_dir, 'jobs', f'{key}.omoco'),
+        'results': os.path.join(farm_dir, 'results', key),
+    }
+
+
+def _make_dirs(farm_dir):
+    for subdir in ['queue', 'running', 'jobs', 'results']:
+        os.makedirs(os.path.join(farm_dir, subdir), exist_ok=True)
+
+
+def _write_json(fpath, data):
+    # Write to a temporary file in the same directory, then rename, so that
+    # other nodes never read a partial file.
+    handle, temporary = tempfile.mkstemp(dir=os.path.dirname(fpath),
+                                         suffix='.tmp')
+    with os.fdopen(handle, 'w') as f:
+        json.dump(data, f, indent=1)
+    os.replace(temporary, fpath)
+
+
+def calc_key(study_xml, working_dir, inputs=(), customize=None):
+    """The hash that identifies a job."""
+    sha = hashlib.sha1()
+    sha.update(osim.GetMocoVersion().encode('utf-8'))
+    sha.update(study_xml.encode('utf-8'))
+    sha.update(str(customize).encode('utf-8'))
+    for relpath in sorted(inputs):
+        sha.update(relpath.encode('utf-8'))
+        with open(os.path.join(working_dir, relpath), 'rb') as f:
+            sha.update(hashlib.sha1(f.read()).digest())
+    return sha.hexdigest()
+
+
+def submit(farm_dir, study, name, working_dir, num_threads=4, memory_budget=0,
+           inputs=(), customize=None):
+    """Queue a MocoTrack or MocoStudy (or the path to an .omoco file) and
+    return the job's key. `working_dir` must be visible to all workers at the
+    same path. `customize` is a 'module:function' name for MocoTrack jobs.
+    `inputs` are the files (relative to working_dir) that the study reads;
+    their contents are part of the key, so editing them creates a new job.
+    `memory_budget` is in bytes (0 for no limit). If the same job is already
+    queued, running, or finished, nothing is queued."""
+    _make_dirs(farm_dir)
+    if isinstance(study, str):
+        with open(study) as f:
+            study_xml = f.read()
+    else:
+        handle, temporary = tempfile.mkstemp(suffix='.omoco')
+        os.close(handle)
+        study.printToXML(temporary)
+        with open(temporary) as f:
+            study_xml = f.read()
+        os.remove(temporary)
+    working_dir = os.path.abspath(working_dir)
+    key = calc_key(study_xml, working_dir, inputs, customize)
+    paths = _paths(farm_dir, key)
+
+    result_fpath = os.path.join(paths['results'], 'result.json')
+    if os.path.exists(result_fpath):
+        with open(result_fpath) as f:
+            if json.load(f)['success']:
+                print(f'solve_farm: {name} ({key}) is already solved.')
+                return key
+        # Solve failed jobs again.
+        os.remove(result_fpath)
+    if os.path.exists(paths['queue']) or os.path.exists(paths['running']):
+        print(f'solve_farm: {name} ({key}) is already queued.')
+        return key
+
+    with open(paths['study'], 'w') as f:
+        f.write(study_xml)
+    _write_json(paths['queue'], {
+        'key': key,
+        'name': name,
+        'working_dir': working_dir,
+        'customize': customize,
+        'num_threads': num_threads,
+        'memory_budget': int(memory_budget),
+        'submitted': time.time(),
+    })
+    print(f'solve_farm: queued {name} ({key}).')
+    return key
+
+
+def get_solution_path(farm_dir, key):
+    return os.path.join(_paths(farm_dir, key)['results'], 'solution.sto')
+
+
+def get_result(farm_dir, key):
+    """The job's result.json contents, or None if the job has not finished."""
+    fpath = os.path.join(_paths(farm_dir, key)['results'], 'result.json')
+    if not os.path.exists(fpath):
+        return None
+    with open(fpath) as f:
+        return json.load(f)
+
+
+def wait(farm_dir, keys, poll_interval=10):
+    """Wait for the jobs to finish, and return {key: solution path} (the path
+    is None for jobs that failed)."""
+    solutions = dict()
+    while len(solutions) < len(keys):
+        for key in keys:
+            if key in solutions:
+                continue
+            result = get_result(farm_dir, key)
+            if result is not None:
+                solutions[key] = (get_solution_path(farm_dir, key)
+                                  if result['success'] else None)
+        if len(solutions) < len(keys):
+            time.sleep(poll_interval)
+    return solutions
+
+
+def create_study(fpath, customize=None):
+    """Load the job's MocoStudy, initializing (and customizing) it if the file
+    contains a MocoTrack."""
+    tag = ET.parse(fpath).getroot()[0].tag
+    if tag == 'MocoStudy':
+        return osim.MocoStudy(fpath)
+    if tag != 'MocoTrack':
+        raise Exception(f'Expected a MocoTrack or MocoStudy, but got {tag}.')
+    study = osim.MocoTrack(fpath).initialize()
+    if customize:
+        module, function = customize.split(':')
+        sys.path.insert(0, os.getcwd())
+        getattr(importlib.import_module(module), function)(study)
+    return study
+
+
+def run_job(farm_dir, key, cpus):
+    """Solve one job in this process (called by the worker in a child
+    process)."""
+    paths = _paths(farm_dir, key)
+    with open(paths['running']) as f:
+        job = json.load(f)
+    if cpus and hasattr(os, 'sched_setaffinity'):
+        os.sched_setaffinity(0, cpus)
+    if job['memory_budget']:
+        resource.setrlimit(resource.RLIMIT_AS,
+                           (job['memory_budget'], job['memory_budget']))
+    # The number of threads is set on the solver below; it replaces any
+    # 'parallel' setting in the study's XML, which would otherwise take
+    # precedence over OPENSIM_MOCO_PARALLEL.
+    num_threads = len(cpus) if cpus else job['num_threads']
+    os.chdir(job['working_dir'])
+
+    os.makedirs(paths['results'], exist_ok=True)
+    solution_fpath = get_solution_path(farm_dir, key)
+    start = time.time()
+    result = {'key': key, 'name': job['name'], 'host': socket.gethostname(),
+              'cpus': list(cpus), 'num_threads': job['num_threads'],
+              'memory_budget': job['memory_budget']}
+    try:
+        study = create_study(paths['study'], job['customize'])
+        solver = osim.MocoCasADiSolver.safeDownCast(study.updSolver())
+        if solver:
+            solver.set_parallel(moco_parallel(num_threads))
+        solution = study.solve()
+        solution.unseal()
+        solution.write(solution_fpath)
+        result.update({
+            'success': solution.success(),
+            'status': solution.getStatus(),
+            'objective': solution.getObjective(),
+            'num_iterations': solution.getNumIterations(),
+            'solver_duration': solution.getSolverDuration(),
+        })
+    except Exception as e:
+        result.update({'success': False, 'status': str(e)})
+    result['wall_time'] = time.time() - start
+    result['max_rss'] = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    _write_json(os.path.join(paths['results'], 'result.json'), result)
+    return 0 if result['success'] else 1
+
+
+class Worker(object):
+    """Run jobs from the farm on this node's CPUs, within a memory budget
+    (bytes; 0 for no limit)."""
+    def __init__(self, farm_dir, memory=0, cpus=None):
+        self.farm_dir = farm_dir
+        self.memory = memory
+        if cpus is None:
+            cpus = (sorted(os.sched_getaffinity(0))
+                    if hasattr(os, 'sched_getaffinity')
+                    else list(range(os.cpu_count())))
+        self.free_cpus = list(cpus)
+        self.num_cpus = len(cpus)
+        self.free_memory = memory
+        # key -> (process, cpus, memory budget).
+        self.running = dict()
+        _make_dirs(farm_dir)
+
+    def _fits(self, job):
+        threads = min(job['num_threads'], self.num_cpus)
+        if threads > len(self.free_cpus):
+            return False
+        return not self.memory or job['memory_budget'] <= self.free_memory
+
+    def _start(self, job):
+        key = job['key']
+        paths = _paths(self.farm_dir, key)
+        try:
+            # Only one worker can rename the file.
+            os.rename(paths['queue'], paths['running'])
+        except OSError:
+            return
+        threads = min(job['num_threads'], self.num_cpus)
+        cpus = self.free_cpus[:threads]
+        self.free_cpus = self.free_cpus[threads:]
+        self.free_memory -= job['memory_budget']
+        print(f'solve_farm: starting {job["name"]} ({key}) on CPUs {cpus}.')
+        process = subprocess.Popen(
+            [sys.executable, os.path.abspath(__file__), 'run-job',
+             self.farm_dir, key, '--cpus', ','.join(str(c) for c in cpus)])
+        self.running[key] = (process, cpus, job['memory_budget'])
+
+    def _reap(self):
+        for key, (process, cpus, budget) in list(self.running.items()):
+            running_fpath = _paths(self.farm_dir, key)['running']
+            if process.poll() is None:
+                os.utime(running_fpath)
+                continue
+            print(f'solve_farm: finished {key} (exit code '
+                  f'{process.returncode}).')
+            if get_result(self.farm_dir, key) is None:
+                # The process was killed (e.g., it exceeded its memory
+                # budget) before writing its result.
+                os.makedirs(_paths(self.farm_dir, key)['results'],
+                            exist_ok=True)
+                _write_json(os.path.join(
+                    _paths(self.farm_dir, key)['results'], 'result.json'),
+                    {'key': key, 'success': False,
+                     'status': f'exit code {process.returncode}',
+                     'host': socket.gethostname()})
+            os.remove(running_fpath)
+            self.free_cpus = sorted(self.free_cpus + cpus)
+            self.free_memory += budget
+            del self.running[key]
+
+    def _requeue_stale(self):
+        running_dir = os.path.join(self.farm_dir, 'running')
+        for name in os.listdir(running_dir):
+            key = name[:-len('.json')]
+            fpath = os.path.join(running_dir, name)
+            if key in self.running or not name.endswith('.json'):
+                continue
+            try:
+                if time.time() - os.path.getmtime(fpath) > STALE_TIMEOUT:
+                    print(f'solve_farm: returning {key} to the queue.')
+                    os.rename(fpath, _paths(self.farm_dir, key)['queue'])
+            except OSError:
+                pass
+
+    def _queued_jobs(self):
+        queue_dir = os.path.join(self.farm_dir, 'queue')
+        jobs = list()
+        for name in os.listdir(queue_dir):
+            if not name.endswith('.json'):
+                continue
+            try:
+                with open(os.path.join(queue_dir, name)) as f:
+                    jobs.append(json.load(f))
+            except (OSError, ValueError):
+                # Claimed by another worker in the meantime.
+                pass
+        return sorted(jobs, key=lambda job: job['submitted'])
+
+    def run(self, exit_when_idle=False):
+        while True:
+            self._reap()
+            self._requeue_stale()
+            queued = self._queued_jobs()
+            for job in queued:
+                if self._fits(job):
+                    self._start(job)
+            if exit_when_idle and not queued and not self.running:
+                return
+            time.sleep(HEARTBEAT_INTERVAL if self.running else 5)
+
+
+def print_status(farm_dir):
+    _make_dirs(farm_dir)
+    for state in ['queue', 'running']:
+        for name in sorted(os.listdir(os.path.join(farm_dir, state))):
+            if not name.endswith('.json'):
+                continue
+            with open(os.path.join(farm_dir, state, name)) as f:
+                job = json.load(f)
+            print(f'{state:8} {job["key"]} {job["name"]} '
+                  f'({job["num_threads"]} threads)')
+    results_dir = os.path.join(farm_dir, 'results')
+    for key in sorted(os.listdir(results_dir)):
+        result = get_result(farm_dir, key)
+        if result is not None:
+            print(f'{"done":8} {key} {result.get("name", "")} '
+                  f'({result["status"]})')
+
+
+if __name__ == "__main__":
+    import argparse
+
+    parser = argparse.ArgumentParser(
+        description='Solve MocoStudy problems on a pool of worker nodes.',
+        epilog=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    subparsers = parser.add_subparsers(dest='command')
+    submit_parser = subparsers.add_parser('submit')
+    submit_parser.add_argument('farm_dir')
+    submit_parser.add_argument('study', help='An .omoco file (MocoTrack or '
+                                             'MocoStudy).')
+    submit_parser.add_argument('--customize', default=None,
+                               help="'module:function' that customizes a "
+                                    "MocoTrack's study.")
+    submit_parser.add_argument('--name', default=None)
+    submit_parser.add_argument('--working-dir', default='.',
+                               help='Directory in which the relative paths '
+                                    'in the study are resolved.')
+    submit_parser.add_argument('--threads', type=int, default=4)
+    submit_parser.add_argument('--memory', type=float, default=0,
+                               help='Memory budget (GB).')
+    submit_parser.add_argument('--inputs', nargs='*', default=[])
+    worker_parser = subparsers.add_parser('worker')
+    worker_parser.add_argument('farm_dir')
+    worker_parser.add_argument('--memory', type=float, default=0,
+                               help='Memory available to jobs (GB).')
+    worker_parser.add_argument('--exit-when-idle', action='store_true')
+    status_parser = subparsers.add_parser('status')
+    status_parser.add_argument('farm_dir')
+    run_parser = subparsers.add_parser('run-job')
+    run_parser.add_argument('farm_dir')
+    run_parser.add_argument('key')
+    run_parser.add_argument('--cpus', default='')
+    args = parser.parse_args()
+
+    if args.command == 'submit':
+        name = args.name or os.path.splitext(os.path.basename(args.study))[0]
+        submit(args.farm_dir, os.path.abspath(args.study), name,
+               args.working_dir, args.threads, args.memory * 1e9,
+               args.inputs, args.customize)
+    elif args.command == 'worker':
+        Worker(args.farm_dir, memory=args.memory * 1e9).run(
+            args.exit_when_idle)
+    elif args.command == 'status':
+        print_status(args.farm_dir)
+    elif args.command == 'run-job':
+        cpus = [int(c) for c in args.cpus.split(',') if c]
+        sys.exit(run_job(args.farm_dir, args.key, cpus))
+    else:
+        parser.print_help()
@@ -7,12 +7,19 @@ import pylab as pl
 import opensim as osim
 
 from moco_paper_result import MocoPaperResult
+from mesh_refinement import solve_mesh_refinement
+from multi_start import MultiStart
 
 import utilities
 
 
 class SquatToStand(MocoPaperResult):
     def __init__(self):
+        self.finite_difference_hessian = False
+        self.num_starts = 1
+        # The bounds of the spring stiffness parameter, from which the
+        # multi-start also samples the stiffness of each start.
+        self.stiffness_bounds = (0, 100)
         self.predict_solution_file = \
             '%s/results/squat_to_stand_predict_solution.sto'
         self.predict_assisted_solution_file = \
@@ -32,7 +39,10 @@ class SquatToStand(MocoPaperResult):
         solver.set_num_mesh_intervals(num_mesh_intervals)
         solver.set_optim_convergence_tolerance(1e-3)
         solver.set_optim_constraint_tolerance(1e-3)
-        solver.set_optim_finite_difference_scheme('forward')
+        if self.finite_difference_hessian:
+            utilities.use_finite_difference_hessian(solver)
+        else:
+            solver.set_optim_finite_difference_scheme('forward')
         # solver.set_output_interval(10)
 
         problem = moco.updProblem()
@@ -79,8 +89,7 @@ class SquatToStand(MocoPaperResult):
                                       "resources/squat_to_stand_4dof9musc_dgf.osim"))
         return model
 
-    def predict(self, root_dir, num_mesh_intervals=None, guess_file=None,
-                solution_fpath=None):
+    def create_predict_study(self, root_dir, num_mesh_intervals=None):
         model = self.muscle_driven_model(root_dir)
         moco = self.create_study(model, num_mesh_intervals=num_mesh_intervals)
         problem = moco.updProblem()
@@ -91,24 +100,30 @@ class SquatToStand(MocoPaperResult):
         solver = osim.MocoCasADiSolver.safeDownCast(moco.updSolver())
         solver.resetProblem(problem)
 
+        guess = solver.createGuess()
+
+        N = guess.getNumTimes()
+        for muscle in model.getMuscles():
+            dgf = osim.DeGrooteFregly2016Muscle.safeDownCast(muscle)
+            if not dgf.get_ignore_tendon_compliance():
+                guess.setState(
+                    '%s/normalized_tendon_force' % muscle.getAbsolutePathString(),
+                    osim.createVectorLinspace(N, 0.1, 0.1))
+            guess.setState(
+                '%s/activation' % muscle.getAbsolutePathString(),
+                osim.createVectorLinspace(N, 0.05, 0.05))
+            guess.setControl(muscle.getAbsolutePathString(),
+                osim.createVectorLinspace(N, 0.05, 0.05))
+        solver.setGuess(guess)
+        return moco
+
+    def predict(self, root_dir, num_mesh_intervals=None, guess_file=None,
+                solution_fpath=None):
+        moco = self.create_predict_study(root_dir,
+                                         num_mesh_intervals=num_mesh_intervals)
         if guess_file:
+            solver = osim.MocoCasADiSolver.safeDownCast(moco.updSolver())
             solver.setGuessFile(guess_file)
-        else:
-            guess = solver.createGuess()
-
-            N = guess.getNumTimes()
-            for muscle in model.getMuscles():
-                dgf = osim.DeGrooteFregly2016Muscle.safeDownCast(muscle)
-                if not dgf.get_ignore_tendon_compliance():
-                    guess.setState(
-                        '%s/normalized_tendon_force' % muscle.getAbsolutePathString(),
-                        osim.createVectorLinspace(N, 0.1, 0.1))
-                guess.setState(
-                    '%s/activation' % muscle.getAbsolutePathString(),
-                    osim.createVectorLinspace(N, 0.05, 0.05))
-                guess.setControl(muscle.getAbsolutePathString(),
-                    osim.createVectorLinspace(N, 0.05, 0.05))
-            solver.setGuess(guess)
 
         solution = moco.solve()
 
@@ -129,7 +144,7 @@ class SquatToStand(MocoPaperResult):
         model.addForce(device)
         return model
 
-    def predict_assisted(self, root_dir):
+    def create_predict_assisted_study(self, root_dir):
         model = self.assisted_model(root_dir)
 
         moco = self.create_study(model)
@@ -140,7 +155,8 @@ class SquatToStand(MocoPaperResult):
 
         problem.addParameter(
             osim.MocoParameter('stiffness', '/forceset/spring',
-                               'stiffness', osim.MocoBounds(0, 100)))
+                               'stiffness',
+                               osim.MocoBounds(*self.stiffness_bounds)))
 
         solver = osim.MocoCasADiSolver.safeDownCast(moco.updSolver())
         solver.resetProblem(problem)
@@ -162,13 +178,32 @@ class SquatToStand(MocoPaperResult):
         solver.setGuess(guess)
 
         solver.set_parameters_require_initsystem(False)
-        solution = moco.solve()
+        return moco
+
+    def predict_assisted(self, root_dir):
+        if self.num_starts > 1:
+            # The stiffness and the gait are prone to local minima.
+            multi_start = MultiStart(
+                lambda: self.create_predict_assisted_study(root_dir),
+                num_starts=self.num_starts,
+                parameters={'stiffness': self.stiffness_bounds})
+            solution = multi_start.solve()
+            print('Multi-start spread: {}'.format(multi_start.get_spread()))
+        else:
+            moco = self.create_predict_assisted_study(root_dir)
+            solution = moco.solve()
         # moco.visualize(solution)
         solution.write(self.predict_assisted_solution_file % root_dir)
 
     def parse_args(self, args):
         self.unassisted = False
         self.assisted = False
+        # 'fd-hessian' can be combined with the other arguments.
+        self.finite_difference_hessian = 'fd-hessian' in args
+        # 'multi-start' solves the assisted problem from several starts.
+        self.num_starts = 8 if 'multi-start' in args else 1
+        args = [arg for arg in args
+                if arg not in ['fd-hessian', 'multi-start']]
         if len(args) == 0:
             self.unassisted = True
             self.assisted = True
@@ -206,21 +241,19 @@ class SquatToStand(MocoPaperResult):
 
     def generate_convergence_results(self, root_dir, args):
         self.parse_args(args)
-        if args:
-            raise Exception("squat-to-stand: args not valid with "
-                            "--convergence.")
-        guess_file = None
-        for md in self.convergence_metadata():
-            solution_fpath = os.path.join(
-                root_dir, 'results', 'convergence', md['solution_file'])
-            num_mesh_intervals = md['num_mesh_intervals']
-            print(f'Convergence analysis: using {num_mesh_intervals} mesh '
-                  'intervals.')
-            self.predict(root_dir, num_mesh_intervals=num_mesh_intervals,
-                         guess_file=guess_file,
-                         solution_fpath=solution_fpath)
-            # Use current solution as guess for the next problem.
-            guess_file = solution_fpath
+        if [arg for arg in args if arg != 'fd-hessian']:
+            raise Exception("squat-to-stand: only 'fd-hessian' is valid "
+                            "with --convergence.")
+        # Solve on each mesh in turn, using the solution on each mesh as the
+        # guess for the next mesh.
+        metadata = self.convergence_metadata()
+        solve_mesh_refinement(
+            lambda num_mesh_intervals: self.create_predict_study(
+                root_dir, num_mesh_intervals=num_mesh_intervals),
+            [md['num_mesh_intervals'] for md in metadata],
+            solution_fpaths=[os.path.join(root_dir, 'results', 'convergence',
+                                          md['solution_file'])
+                             for md in metadata])
 
     def plot_joint_moment_breakdown(self, model, moco_traj,
                                     coord_paths, muscle_paths=None,
@@ -0,0 +1,386 @@
+"""Solve a MocoInverse problem as independent static optimizations, one per
+mesh point, when the problem separates by time point.
+
+With prescribed kinematics, rigid tendons, no activation dynamics (every
+state of the processed model is a coordinate value or speed) and no
+kinematic constraints (whose forces would be additional unknowns),
+MocoInverse's problem has no dynamics coupling its time points: at each
+mesh point, it
+minimizes the sum of squared controls (plus squared activations, with
+minimize_sum_squared_activations) subject to the generalized forces of the
+muscles and coordinate actuators matching inverse dynamics. Each of these
+small problems is solved with SLSQP, the time points are distributed over
+worker processes, and the muscles' active and passive forces are evaluated
+for all muscles and time points at once with a MuscleBank. The resulting
+trajectory has the same controls as MocoInverse's solution, and is written
+the same way.
+
+With allow_activation_dynamics=True, models whose muscles and actuators have
+activation dynamics are solved as if activation followed excitation; the
+activation states are set to the controls. This is not MocoInverse's
+solution, but is a fast initial guess (e.g., for the tracking problems).
+Problems that do not separate are solved with MocoInverse.
+
+The paper's models do not separate: they have coordinate coupler constraints
+(the patellofemoral joints) and activation dynamics, and tracking_walking.py
+also uses compliant tendons and ActivationCoordinateActuators. So
+prescribed_walking.py falls back to MocoInverse, and
+tracking_walking.run_inverse_problem() uses MocoInverse directly (its
+solution is also the tracking problems' guess, which must be MocoInverse's).
+To check the static optimizations against MocoInverse on a model that does
+separate (the 18-muscle model without its constraints and activation
+dynamics), run:
+    python3 static_optimization.py check <root_dir>
+"""
+import os
+import multiprocessing
+
+import numpy as np
+from scipy.optimize import minimize
+
+import opensim as osim
+
+from muscle_bank import MuscleBank
+
+# Set in each worker process (by forking) by StaticOptimization.solve().
+_worker = dict()
+
+
+def _solve_time_points(itimes):
+    """Solve the static optimizations of the time points with the given
+    indices; runs in a worker process."""
+    self = _worker['self']
+    model = self.model
+    state = osim.State(model.getWorkingState())
+    coordinates = self.coordinates
+    num_muscles = self.bank.num_muscles
+    num_times = len(itimes)
+    lengths = np.empty((num_times, num_muscles))
+    speeds = np.empty((num_times, num_muscles))
+    moment_arms = np.zeros((num_times, num_muscles, len(coordinates)))
+    net_forces = np.empty((num_times, len(coordinates)))
+    for i, itime in enumerate(itimes):
+        state.setTime(float(self.time[itime]))
+        for icoord in range(len(coordinates)):
+            state.updQ().set(icoord, float(self.q[itime, icoord]))
+            state.updU().set(icoord, float(self.u[itime, icoord]))
+        model.realizeVelocity(state)
+        for imusc, muscle in enumerate(self.muscles):
+            lengths[i, imusc] = muscle.getLength(state)
+            speeds[i, imusc] = muscle.getLengtheningSpeed(state)
+            # All coordinates, since a moment arm that is zero at one time
+            # point (e.g., of a wrapping path) need not be zero at another.
+            for icoord, coordinate in enumerate(coordinates):
+                moment_arms[i, imusc, icoord] = muscle.computeMomentArm(
+                    state, coordinate)
+        # Exclude the actuators, as TrajectoryDynamicsEvaluator does.
+        for actuator in self.actuators:
+            actuator.setAppliesForce(state, False)
+        udot = osim.Vector(len(coordinates), 0.0)
+        for icoord in range(len(coordinates)):
+            udot.set(icoord, float(self.udot[itime, icoord]))
+        forces = osim.InverseDynamicsSolver(model).solve(state, udot)
+        for icoord in range(len(coordinates)):
+            net_forces[i, icoord] = forces.get(icoord)
+        for actuator in self.actuators:
+            actuator.setAppliesForce(state, True)
+
+    # The tendon force is linear in activation with rigid tendons.
+    active = self.bank.calc_muscle_mechanics(lengths, speeds,
+                                             np.ones(lengths.shape))
+    passive = self.bank.calc_muscle_mechanics(lengths, speeds,
+                                              np.zeros(lengths.shape))
+    active_force = active['tendon_force'] - passive['tendon_force']
+
+    controls = np.empty((num_times, len(self.control_names)))
+    statuses = list()
+    guess = np.clip(0.1 * np.ones(len(self.control_names)), self.lower,
+                    self.upper)
+    for i in range(num_times):
+        # Generalized forces: moment_arms^T (a * active + passive) +
+        # optimal_force * e = inverse dynamics.
+        A = np.hstack([moment_arms[i].T * active_force[i],
+                       self.actuator_matrix])
+        b = net_forces[i] - moment_arms[i].T @ passive['tendon_force'][i]
+        result = minimize(
+            lambda x: np.sum(self.weights * x**2), guess,
+            jac=lambda x: 2.0 * self.weights * x, method='SLSQP',
+            bounds=list(zip(self.lower, self.upper)),
+            constraints={'type': 'eq', 'fun': lambda x: A @ x - b,
+                         'jac': lambda x: A},
+            options={'ftol': self.tolerance, 'maxiter': 500})
+        controls[i] = result.x
+        statuses.append(result.message if not result.success else '')
+        # Consecutive time points are close; warm start the next one.
+        guess = result.x
+    return itimes, controls, statuses
+
+
+class StaticOptimization(object):
+    """Solve a MocoInverse's problem as static optimizations (see the module
+    docstring), with `num_processes` worker processes. Each worker solves
+    chunks of about `chunk_size` consecutive time points, warm starting each
+    time point from the previous one."""
+    def __init__(self, inverse, num_processes=None,
+                 allow_activation_dynamics=False, tolerance=1e-8,
+                 chunk_size=8):
+        self.inverse = inverse
+        self.chunk_size = chunk_size
+        self.num_processes = num_processes or os.cpu_count()
+        self.allow_activation_dynamics = allow_activation_dynamics
+        self.tolerance = tolerance
+        self.model = inverse.get_model().process()
+        self.model.initSystem()
+        self.bank = MuscleBank(self.model)
+
+    def is_separable(self):
+        """Whether the problem separates by time point: the model has no
+        constraints, all muscles are DeGrooteFregly2016 muscles with rigid
+        tendons, the other actuators are coordinate actuators, and, unless
+        allow_activation_dynamics, every state is a coordinate value or
+        speed."""
+        if self.model.getConstraintSet().getSize() > 0:
+            return False
+        if not np.all(self.bank.ignore_tendon_compliance):
+            return False
+        num_muscles = 0
+        for actuator in self.model.getComponentsList():
+            if osim.Muscle.safeDownCast(actuator):
+                num_muscles += 1
+            # This includes ActivationCoordinateActuators.
+            elif (osim.Actuator.safeDownCast(actuator) and
+                  not osim.CoordinateActuator.safeDownCast(actuator)):
+                return False
+        if num_muscles != self.bank.num_muscles:
+            return False
+        if self.allow_activation_dynamics:
+            return True
+        coordinate_states = 2 * self.model.getCoordinateSet().getSize()
+        return self.model.getNumStateVariables() == coordinate_states
+
+    def _create_mesh(self):
+        t0 = self.inverse.get_initial_time()
+        tf = self.inverse.get_final_time()
+        num_mesh_intervals = max(1, int(round(
+            (tf - t0) / self.inverse.get_mesh_interval())))
+        return np.linspace(t0, tf, num_mesh_intervals + 1)
+
+    def _prepare(self):
+        model = self.model
+        self.time = self._create_mesh()
+        # The coordinates in the order of the generalized speeds.
+        self.coordinates = list(model.getCoordinatesInMultibodyTreeOrder())
+        if len(self.coordinates) != model.getWorkingState().getNU():
+            raise Exception('Expected one generalized speed per coordinate '
+                            '(no quaternions).')
+        table = self.inverse.get_kinematics().process(model)
+        labels = list(table.getColumnLabels())
+        names = [f'{coordinate.getAbsolutePathString()}/value'
+                 for coordinate in self.coordinates]
+        for name in names:
+            if name not in labels:
+                raise Exception(f'The kinematics lack {name}.')
+        # MocoInverse prescribes the kinematics with a PositionMotion, which
+        # interpolates them with quintic GCV splines (without smoothing);
+        # use the same splines so that the speeds and accelerations match,
+        # including near the ends of the time window.
+        splines = osim.GCVSplineSet(table, osim.StdVectorString(names), 5, 0)
+        shape = (len(self.time), len(self.coordinates))
+        self.q = np.empty(shape)
+        self.u = np.empty(shape)
+        self.udot = np.empty(shape)
+        first = osim.StdVectorInt([0])
+        second = osim.StdVectorInt([0, 0])
+        for icoord, name in enumerate(names):
+            spline = splines.get(name)
+            for itime, time in enumerate(self.time):
+                x = osim.Vector(1, float(time))
+                self.q[itime, icoord] = spline.calcValue(x)
+                self.u[itime, icoord] = spline.calcDerivative(first, x)
+                self.udot[itime, icoord] = spline.calcDerivative(second, x)
+
+        self.muscles = [osim.Muscle.safeDownCast(model.getComponent(path))
+                        for path in self.bank.paths]
+        self.actuators = [osim.Actuator.safeDownCast(component)
+                          for component in model.getComponentsList()
+                          if osim.Actuator.safeDownCast(component)]
+
+        # The controls: muscles, then coordinate actuators.
+        self.control_names = list(self.bank.paths)
+        lower = [muscle.getMinControl() for muscle in self.muscles]
+        upper = [muscle.getMaxControl() for muscle in self.muscles]
+        # With minimize_sum_squared_activations, MocoInverse also minimizes
+        # the squared activation states, which equal the controls here.
+        state_names = set(model.getStateVariableNames().get(index)
+                          for index in
+                          range(model.getStateVariableNames().getSize()))
+        minimize_activations = \
+            self.inverse.get_minimize_sum_squared_activations()
+        weights = [2.0 if minimize_activations and
+                   f'{path}/activation' in state_names else 1.0
+                   for path in self.bank.paths]
+        coordinate_index = {coordinate.getAbsolutePathString(): icoord
+                            for icoord, coordinate in
+                            enumerate(self.coordinates)}
+        columns = list()
+        for actuator in self.actuators:
+            if osim.Muscle.safeDownCast(actuator):
+                continue
+            coordinate_actuator = osim.CoordinateActuator.safeDownCast(
+                actuator)
+            self.control_names.append(actuator.getAbsolutePathString())
+            lower.append(actuator.getMinControl())
+            upper.append(actuator.getMaxControl())
+            weights.append(1.0)
+            column = np.zeros(len(self.coordinates))
+            column[coordinate_index[coordinate_actuator.getCoordinate()
+                                    .getAbsolutePathString()]] = \
+                coordinate_actuator.getOptimalForce()
+            columns.append(column)
+        self.actuator_matrix = np.array(columns).reshape(
+            -1, len(self.coordinates)).T
+        self.lower = np.array(lower)
+        self.upper = np.array(upper)
+        self.weights = np.array(weights)
+
+    def solve(self):
+        """Solve the problem, with MocoInverse if it does not separate.
+        Returns the solution (a MocoTrajectory)."""
+        if not self.is_separable():
+            print('StaticOptimization: the problem does not separate by time '
+                  'point; solving with MocoInverse.')
+            return self.inverse.solve().getMocoSolution()
+        self._prepare()
+        # Chunks of a fixed size, so that the warm starts (and so the
+        # solution) do not depend on the number of processes.
+        chunks = np.array_split(
+            np.arange(len(self.time)),
+            max(1, len(self.time) // self.chunk_size))
+        controls = np.empty((len(self.time), len(self.control_names)))
+        self.statuses = [''] * len(self.time)
+        # Fork, so that the workers inherit the model.
+        _worker['self'] = self
+        context = multiprocessing.get_context('fork')
+        with context.Pool(min(self.num_processes, len(chunks))) as pool:
+            for itimes, chunk_controls, statuses in pool.imap_unordered(
+                    _solve_time_points, [list(c) for c in chunks]):
+                controls[itimes] = chunk_controls
+                for itime, status in zip(itimes, statuses):
+                    self.statuses[itime] = status
+        failed = [itime for itime, status in enumerate(self.statuses)
+                  if status]
+        if failed:
+            print(f'StaticOptimization: {len(failed)} of {len(self.time)} '
+                  f'time points did not converge (first at '
+                  f't = {self.time[failed[0]]}: {self.statuses[failed[0]]}).')
+        return self._create_trajectory(controls)
+
+    def _create_trajectory(self, controls):
+        # With allow_activation_dynamics, activation follows excitation.
+        state_names = list()
+        state_columns = list()
+        all_state_names = self.model.getStateVariableNames()
+        for index in range(all_state_names.getSize()):
+            name = all_state_names.get(index)
+            if name.endswith('/activation'):
+                path = name[:-len('/activation')]
+                if path in self.control_names:
+                    state_names.append(name)
+                    state_columns.append(self.control_names.index(path))
+
+        def to_matrix(values):
+            matrix = osim.Matrix(values.shape[0], values.shape[1])
+            for i in range(values.shape[0]):
+                for j in range(values.shape[1]):
+                    matrix.set(i, j, float(values[i, j]))
+            return matrix
+
+        trajectory = osim.MocoTrajectory(
+            osim.Vector(self.time.tolist()),
+            osim.StdVectorString(state_names),
+            osim.StdVectorString(self.control_names),
+            osim.StdVectorString(), osim.StdVectorString(),
+            to_matrix(controls[:, state_columns]), to_matrix(controls),
+            osim.Matrix(len(self.time), 0), osim.RowVector(0, 0.0))
+        return trajectory
+
+    def compare_with_inverse(self, tolerance=1e-3):
+        """Solve the problem with both StaticOptimization and MocoInverse,
+        and raise an exception if any control differs by more than
+        tolerance. The problem must separate by time point. Returns the
+        largest difference."""
+        if not self.is_separable():
+            raise Exception('The problem does not separate by time point.')
+        trajectory = self.solve()
+        solution = self.inverse.solve().getMocoSolution()
+        solution.unseal()
+        inverse_time = solution.getTimeMat()
+        difference = 0.0
+        for name in self.control_names:
+            values = trajectory.getControlMat(name)
+            expected = np.interp(self.time, inverse_time,
+                                 solution.getControlMat(name))
+            difference = max(difference,
+                             np.max(np.abs(values - expected)))
+        print(f'StaticOptimization: the largest difference from '
+              f'MocoInverse\'s controls is {difference:g}.')
+        if difference > tolerance:
+            raise Exception(f'StaticOptimization: the controls differ from '
+                            f'MocoInverse\'s by {difference:g}, more than '
+                            f'the tolerance {tolerance:g}.')
+        return difference
+
+
+def create_separable_inverse(root_dir):
+    """A MocoInverse problem that separates by time point: walking with the
+    18-muscle model, without its coupler constraints (the coupled
+    coordinates are prescribed by the kinematics instead) and with rigid
+    tendons and no activation dynamics."""
+    model_dir = os.path.join(root_dir, 'resources', 'Rajagopal2016')
+    model = osim.Model(os.path.join(model_dir,
+                                    'subject_walk_armless_18musc.osim'))
+    model.updConstraintSet().clearAndDestroy()
+    processor = osim.ModelProcessor(model)
+    processor.append(osim.ModOpAddExternalLoads(
+        os.path.join(model_dir, 'grf_walk.xml')))
+    processor.append(osim.ModOpReplaceMusclesWithDeGrooteFregly2016())
+    processor.append(osim.ModOpIgnorePassiveFiberForcesDGF())
+    processor.append(osim.ModOpIgnoreTendonCompliance())
+    processor.append(osim.ModOpFiberDampingDGF(0))
+    processor.append(osim.ModOpAddReserves(1))
+    model = processor.process()
+    for muscle in model.updMuscles():
+        muscle.set_ignore_activation_dynamics(True)
+    model.finalizeConnections()
+
+    coordinates = osim.TableProcessor(
+        os.path.join(model_dir, 'coordinates.mot'))
+    coordinates.append(osim.TabOpLowPassFilter(6))
+    coordinates.append(osim.TabOpUseAbsoluteStateNames())
+    inverse = osim.MocoInverse()
+    inverse.setModel(osim.ModelProcessor(model))
+    inverse.setKinematics(coordinates)
+    inverse.set_kinematics_allow_extra_columns(True)
+    inverse.set_initial_time(0.81)
+    inverse.set_final_time(1.65)
+    inverse.set_mesh_interval(0.04)
+    inverse.set_convergence_tolerance(1e-6)
+    inverse.set_constraint_tolerance(1e-6)
+    return inverse
+
+
+def solve_inverse(inverse, **kwargs):
+    """Solve the MocoInverse with StaticOptimization if its problem separates
+    by time point, and with MocoInverse otherwise. Returns the solution (a
+    MocoTrajectory)."""
+    return StaticOptimization(inverse, **kwargs).solve()
+
+
+if __name__ == '__main__':
+    import sys
+    if len(sys.argv) == 3 and sys.argv[1] == 'check':
+        StaticOptimization(
+            create_separable_inverse(sys.argv[2])).compare_with_inverse()
+    else:
+        print(__doc__)
+        sys.exit(1)
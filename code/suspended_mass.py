@@ -102,9 +102,16 @@ class SuspendedMass(MocoPaperResult):
         problem.setControlInfoPattern("/forceset/.*", [0, 1])
         return study
 
-    def predict(self, run_time_stepping=False, exponent=2):
+    def predict(self, run_time_stepping=False, exponent=2,
+                num_mesh_intervals=None, parallel=None):
 
         study = self.create_study()
+        if num_mesh_intervals or parallel is not None:
+            solver = study.initCasADiSolver()
+            if num_mesh_intervals:
+                solver.set_num_mesh_intervals(num_mesh_intervals)
+            if parallel is not None:
+                solver.set_parallel(parallel)
         problem = study.updProblem()
         problem.setTimeBounds(0, [0.4, 0.8])
 
@@ -11,6 +11,12 @@ import cv2
 import opensim as osim
 
 from moco_paper_result import MocoPaperResult
+from warm_start import WarmStartLibrary
+from muscle_bank import MuscleBank
+from contact_bank import ContactBank
+from weight_sweep import WeightSweep
+from checkpoint import Checkpoint
+from pipeline import Pipeline
 
 import utilities
 from utilities import plot_joint_moment_breakdown
@@ -19,7 +25,8 @@ from utilities import toarray
 class MocoTrackConfig:
     def __init__(self, name, legend_entry, tracking_weight, effort_weight,
                  color, linestyle='-',
-                 mesh_interval=0.014, guess=None, flags=[]):
+                 mesh_interval=0.014, guess=None, flags=[],
+                 finite_difference_hessian=False):
         self.name = name
         self.legend_entry = legend_entry
         self.tracking_weight = tracking_weight
@@ -27,9 +34,15 @@ class MocoTrackConfig:
         self.color = color
         self.linestyle = linestyle
         self.mesh_interval = mesh_interval
-        # If guess is 'None', we use the solution from the inverse problem.
+        # If guess is 'None', we use the solution from the inverse problem
+        # (or, with the 'warm-start' argument, the most similar previous
+        # solution in the warm start library; see warm_start.py). If guess is
+        # 'default', we use the solver's default guess (with the tracked
+        # states applied).
         self.guess = guess
         self.flags = flags
+        # See utilities.use_finite_difference_hessian().
+        self.finite_difference_hessian = finite_difference_hessian
         self.tracking_solution_relpath_prefix = \
             'results/motion_tracking_walking_solution'
 
@@ -61,6 +74,29 @@ class MotionTrackingWalking(MocoPaperResult):
         self.passive_forces = False
         self.inverse_solution_relpath = \
             'results/motion_tracking_walking_inverse_solution.sto'
+        self.warm_start_index_relpath = \
+            'results/motion_tracking_walking_warm_starts.json'
+        # Whether calc_muscle_mechanics() has checked a MuscleBank against
+        # osim.analyze(), and create_ground_reactions() a ContactBank against
+        # osim.createExternalLoadsTableForGait().
+        self.muscle_bank_checked = False
+        self.contact_bank_checked = False
+        # The contact spheres of each foot, for contact tracking and for the
+        # ground reaction forces of the solutions.
+        self.contact_force_names_right_foot = [
+            'forceset/contactHeel_r',
+            'forceset/contactLateralRearfoot_r',
+            'forceset/contactLateralMidfoot_r',
+            'forceset/contactLateralToe_r',
+            'forceset/contactMedialToe_r',
+            'forceset/contactMedialMidfoot_r']
+        self.contact_force_names_left_foot = [
+            'forceset/contactHeel_l',
+            'forceset/contactLateralRearfoot_l',
+            'forceset/contactLateralMidfoot_l',
+            'forceset/contactLateralToe_l',
+            'forceset/contactMedialToe_l',
+            'forceset/contactMedialMidfoot_l']
         self.cmap = cm.get_cmap('nipy_spectral')
         self.config_track = MocoTrackConfig(
             name='track',
@@ -122,6 +158,9 @@ class MotionTrackingWalking(MocoPaperResult):
             # self.config_moongravity,
         ]
         self.config_map = {config.name: config for config in self.configs}
+        # Processed models, keyed by the arguments to
+        # create_model_processor(). See process_model().
+        self.processed_models = dict()
 
     def create_model_processor(self, root_dir, for_inverse=False, config=None):
 
@@ -303,6 +342,34 @@ class MotionTrackingWalking(MocoPaperResult):
 
         return modelProcessorTendonCompliance
 
+    def process_model(self, root_dir, for_inverse=False, config=None):
+        """Obtain a copy of the model from create_model_processor(), processing
+        the model only the first time it is requested with these arguments.
+        Replacing the 80 muscles and updating their parameters is slow, and the
+        same models are used repeatedly when generating and reporting
+        results."""
+        flags = tuple(config.flags) if config else tuple()
+        key = (root_dir, for_inverse, flags, self.passive_forces)
+        if key not in self.processed_models:
+            modelProcessor = self.create_model_processor(
+                root_dir, for_inverse=for_inverse, config=config)
+            self.processed_models[key] = modelProcessor.process()
+        return osim.Model(self.processed_models[key])
+
+    def process_models(self, root_dir, args, generate=True):
+        """Process the models that generate_results() (if `generate`) and
+        report_results() use (see process_model()). Call this before forking
+        processes that use the models (pipeline.py's process stages, or
+        mocopaper.py's processes for generating and reporting), so that they
+        inherit the processed models instead of each processing them
+        again."""
+        self.process_model(root_dir)
+        if generate and 'skip-inverse' not in args:
+            self.process_model(root_dir, for_inverse=True,
+                               config=self.configs[0])
+        for config in self.configs:
+            self.process_model(root_dir, config=config)
+
     def load_table(self, table_path):
         num_header_rows = 1
         with open(table_path) as f:
@@ -315,18 +382,28 @@ class MotionTrackingWalking(MocoPaperResult):
                              skip_header=num_header_rows)
 
     def calc_reserves(self, root_dir, config, solution):
-        modelProcessor = self.create_model_processor(root_dir, config=config)
-        model = modelProcessor.process()
+        model = self.process_model(root_dir, config=config)
         output = osim.analyze(model, solution, ['.*reserve.*actuation'])
         return output
 
     def calc_muscle_mechanics(self, root_dir, config, solution):
-        modelProcessor = self.create_model_processor(root_dir, config=config)
-        model = modelProcessor.process()
-        outputList = list()
+        model = self.process_model(root_dir, config=config)
+        outputs = ['normalized_fiber_length', 'normalized_fiber_velocity',
+                   'passive_fiber_force', 'tendon_force']
+
+        # Evaluate all DeGrooteFregly2016 muscles together, rather than one
+        # Output at a time with osim.analyze(), if that is exact for this
+        # solution (see MuscleBank.can_analyze()).
+        # The first such solution is also checked against osim.analyze().
+        bank = MuscleBank(model)
+        if bank.can_analyze(model, solution):
+            if not self.muscle_bank_checked:
+                bank.compare_with_analyze(model, solution, outputs)
+                self.muscle_bank_checked = True
+            return bank.analyze(model, solution, outputs)
 
-        for output in ['normalized_fiber_length', 'normalized_fiber_velocity', 
-                       'passive_fiber_force', 'tendon_force']:
+        outputList = list()
+        for output in outputs:
             for imusc in range(model.getMuscles().getSize()):
                 musc = model.updMuscles().get(imusc)
                 outputList.append(f'.*{musc.getName()}.*\|{output}')
@@ -337,8 +414,7 @@ class MotionTrackingWalking(MocoPaperResult):
 
     def calc_negative_muscle_forces(self, root_dir, config, solution):
         print(f'Negative force report for {config.name}:')
-        modelProcessor = self.create_model_processor(root_dir, config=config)
-        model = modelProcessor.process()
+        model = self.process_model(root_dir, config=config)
         model.initSystem()
         return self.calc_negative_muscle_forces_base(model, solution)
 
@@ -360,19 +436,56 @@ class MotionTrackingWalking(MocoPaperResult):
         inverse.set_mesh_interval(self.config_track.mesh_interval)
 
         solution = inverse.solve()
-        solution.getMocoSolution().write(
+        solution_fpath = os.path.join(root_dir, self.inverse_solution_relpath)
+        solution.getMocoSolution().write(solution_fpath)
+
+        if self.warm_start:
+            model = self.process_model(root_dir, for_inverse=True,
+                                       config=self.configs[0])
+            model.initSystem()
+            self.create_warm_start_library(root_dir).add(
+                solution_fpath, model, tags=['inverse'])
+
+    def create_warm_start_library(self, root_dir):
+        return WarmStartLibrary(
+            os.path.join(root_dir, self.warm_start_index_relpath))
+
+    def create_inverse_guess(self, root_dir, solver):
+        """A guess with the states and controls of the inverse problem
+        solution, without its reserve and residual actuators."""
+        # Create a guess compatible with this problem.
+        guess = solver.createGuess()
+        # Load the inverse problem solution and set its states and controls
+        # trajectories to the guess.
+        inverseSolution = osim.MocoTrajectory(
             os.path.join(root_dir, self.inverse_solution_relpath))
-
-    def run_tracking_problem(self, root_dir, config):
+        inverseStatesTable = inverseSolution.exportToStatesTable()
+        for stateLabel in inverseStatesTable.getColumnLabels():
+            if (('reserve' in stateLabel) and stateLabel.endswith('/activation') or
+                ('residual' in stateLabel) and stateLabel.endswith('/activation')):
+                inverseStatesTable.removeColumn(stateLabel)
+        guess.insertStatesTrajectory(inverseStatesTable, True)
+        # Controls guess.
+        inverseControlsTable = inverseSolution.exportToControlsTable()
+        for controlLabel in inverseControlsTable.getColumnLabels():
+            if ('reserve' in controlLabel or 
+                'residual' in controlLabel):
+                inverseControlsTable.removeColumn(controlLabel)
+        guess.insertControlsTrajectory(inverseControlsTable, True)
+        return guess
+
+    def create_tracking_study(self, root_dir, config):
+        """Create the tracking study for the config, with the solver
+        configured but without a guess. Returns the study and the processed
+        model."""
 
         flags = []
         if config:
             flags = config.flags
 
-        modelProcessor = self.create_model_processor(root_dir,
-                                                     for_inverse=False,
-                                                     config=config)
-        model = modelProcessor.process()
+        model = self.process_model(root_dir,
+                                   for_inverse=False,
+                                   config=config)
         model.initSystem()
 
         # Count the number of Force objects in the model. We'll use this to 
@@ -387,7 +500,7 @@ class MotionTrackingWalking(MocoPaperResult):
         # -----------------------------------
         track = osim.MocoTrack()
         track.setName('tracking_walking')
-        track.setModel(modelProcessor)
+        track.setModel(osim.ModelProcessor(model))
         
         if self.marker_tracking:
             track.setMarkersReferenceFromTRC(
@@ -605,18 +718,8 @@ class MotionTrackingWalking(MocoPaperResult):
 
         # Contact tracking
         # ----------------
-        forceNamesRightFoot = ['forceset/contactHeel_r',
-                               'forceset/contactLateralRearfoot_r',
-                               'forceset/contactLateralMidfoot_r',
-                               'forceset/contactLateralToe_r',
-                               'forceset/contactMedialToe_r',
-                               'forceset/contactMedialMidfoot_r']
-        forceNamesLeftFoot = ['forceset/contactHeel_l',
-                              'forceset/contactLateralRearfoot_l',
-                              'forceset/contactLateralMidfoot_l',
-                              'forceset/contactLateralToe_l',
-                              'forceset/contactMedialToe_l',
-                              'forceset/contactMedialMidfoot_l']
+        forceNamesRightFoot = self.contact_force_names_right_foot
+        forceNamesLeftFoot = self.contact_force_names_left_foot
         if self.contact_tracking:
             contactTracking = osim.MocoContactTrackingGoal('contact', 0.0001)
             contactTracking.setExternalLoadsFile(os.path.join(root_dir,
@@ -641,42 +744,83 @@ class MotionTrackingWalking(MocoPaperResult):
                 osim.MocoBounds(-200, 200))
         solver.set_minimize_implicit_auxiliary_derivatives(True)
         solver.set_implicit_auxiliary_derivatives_weight(1e-3 / 6.0)
+        if config.finite_difference_hessian:
+            utilities.use_finite_difference_hessian(solver)
+
+        return study, model
+
+    def create_tracking_weights(self, model, tracking_weight, effort_weight):
+        """The weights of the tracking and control effort goals from
+        create_tracking_study() for the given (unnormalized) weights."""
+        numForces = 0
+        for actu in model.getComponentsList():
+            if (actu.getConcreteClassName().endswith('Muscle') or
+                    actu.getConcreteClassName().endswith('Actuator')):
+                numForces += 1
+        if self.marker_tracking:
+            tracking = ('marker_tracking',
+                        tracking_weight / (2 * model.getNumMarkers()))
+        else:
+            tracking = ('state_tracking',
+                        tracking_weight / (2 * model.getNumCoordinates()))
+        return dict([tracking, ('control_effort', effort_weight / numForces)])
+
+    def run_tracking_problem(self, root_dir, config):
+        solution = self.solve_tracking_problem(root_dir, config)
+        full_traj = self.create_full_cycle_trajectory(root_dir, config,
+                                                      solution)
+        self.create_ground_reactions(root_dir, config, full_traj)
+
+    def solve_tracking_problem(self, root_dir, config, index=True,
+                               parallel=None):
+        """Solve the config's tracking problem and write the solution. With
+        the 'warm-start' argument, the solution is also added to the warm
+        start library, unless `index` is False (e.g., for benchmarks).
+        `parallel`, if given, is the solver's 'parallel' setting. Returns the
+        solution."""
+        study, model = self.create_tracking_study(root_dir, config)
+        solver = osim.MocoCasADiSolver.safeDownCast(study.updSolver())
+        if parallel is not None:
+            solver.set_parallel(parallel)
 
         # Set the guess
         # -------------
-        if config.guess:
+        if config.guess == 'default':
+            pass
+        elif config.guess:
             guess_file = self.config_map[config.guess].get_solution_path(
                 root_dir)
             print(f'Using guess file {guess_file}')
             solver.setGuessFile(guess_file)
-        else:
-            # Create a guess compatible with this problem.
-            guess = solver.createGuess()
-            # Load the inverse problem solution and set its states and controls
-            # trajectories to the guess.
-            inverseSolution = osim.MocoTrajectory(
-                os.path.join(root_dir, self.inverse_solution_relpath))
-            inverseStatesTable = inverseSolution.exportToStatesTable()
-            for stateLabel in inverseStatesTable.getColumnLabels():
-                if (('reserve' in stateLabel) and stateLabel.endswith('/activation') or
-                    ('residual' in stateLabel) and stateLabel.endswith('/activation')):
-                    inverseStatesTable.removeColumn(stateLabel)
-            guess.insertStatesTrajectory(inverseStatesTable, True)
-            # Controls guess.
-            inverseControlsTable = inverseSolution.exportToControlsTable()
-            for controlLabel in inverseControlsTable.getColumnLabels():
-                if ('reserve' in controlLabel or 
-                    'residual' in controlLabel):
-                    inverseControlsTable.removeColumn(controlLabel)
-            guess.insertControlsTrajectory(inverseControlsTable, True)
+        elif self.warm_start:
+            # Use the most similar previous solution (initially, the inverse
+            # problem solution) as the guess. Columns for actuators that this
+            # problem does not have (e.g., reserves) are ignored. The guess
+            # depends on the solutions indexed by earlier runs, so this is
+            # opt-in.
+            guess = self.create_warm_start_library(root_dir).create_guess(
+                solver, model)
             solver.setGuess(guess)
+        else:
+            solver.setGuess(self.create_inverse_guess(root_dir, solver))
 
         # Solve and print solution.
         # -------------------------
-        solution = study.solve()
+        if self.checkpoint:
+            # Resume from the last checkpoint if a previous run was killed.
+            solution = Checkpoint(config.get_solution_path(root_dir).replace(
+                '.sto', '_checkpoint.sto')).solve(study)
+        else:
+            solution = study.solve()
         solution.write(config.get_solution_path(root_dir))
-
-        # Create a full gait cycle trajectory from the periodic solution.
+        if self.warm_start and index:
+            self.create_warm_start_library(root_dir).add(
+                config.get_solution_path(root_dir), model, tags=[config.name])
+        return solution
+
+    def create_full_cycle_trajectory(self, root_dir, config, solution):
+        """Create (and write) a full gait cycle trajectory from the periodic
+        solution."""
         addPatterns = [".*pelvis_tx/value"]
         negatePatterns = [".*pelvis_list(?!/value).*",
                           ".*pelvis_rotation.*",
@@ -689,13 +833,46 @@ class MotionTrackingWalking(MocoPaperResult):
         fullTraj = osim.createPeriodicTrajectory(solution, addPatterns,
             negatePatterns, negateAndShiftPatterns)
         fullTraj.write(config.get_solution_path_fullcycle(root_dir))
-
-        # Compute ground reaction forces generated by contact sphere from the 
-        # full gait cycle trajectory.
-        externalLoads = osim.createExternalLoadsTableForGait(
-                model, fullTraj, forceNamesRightFoot, forceNamesLeftFoot)
+        return fullTraj
+
+    def create_ground_reactions(self, root_dir, config, full_traj):
+        """Compute (and write) the ground reaction forces generated by the
+        contact spheres over the full gait cycle trajectory, for all spheres
+        at once. The forces are checked against
+        osim.createExternalLoadsTableForGait() the first time; see
+        ContactBank.create_external_loads_table() for the other columns."""
+        model = self.process_model(root_dir, config=config)
+        bank = ContactBank(model, self.contact_force_names_right_foot +
+                           self.contact_force_names_left_foot)
+        if not self.contact_bank_checked:
+            bank.compare_with_gait(model, full_traj,
+                                   self.contact_force_names_right_foot,
+                                   self.contact_force_names_left_foot)
+            self.contact_bank_checked = True
+        externalLoads = bank.create_external_loads_table(
+                model, full_traj, self.contact_force_names_right_foot,
+                self.contact_force_names_left_foot)
         osim.STOFileAdapter.write(externalLoads,
                             config.get_solution_path_grfs(root_dir))
+        return externalLoads
+
+    def run_weight_sweep(self, root_dir, config, weights):
+        """Solve the config's tracking problem for each (tracking weight,
+        effort weight) pair, reusing one study and warm starting each point
+        from the previous point. The solution for point i is written with the
+        name '<config name>_sweep<i>'. Returns the sweep history (see
+        WeightSweep)."""
+        study, model = self.create_tracking_study(root_dir, config)
+        sweep = WeightSweep(study)
+        guess_file = config.get_solution_path(root_dir)
+        if os.path.exists(guess_file):
+            sweep.guess = osim.MocoTrajectory(guess_file)
+        for i, (tracking_weight, effort_weight) in enumerate(weights):
+            solution = sweep.solve(self.create_tracking_weights(
+                model, tracking_weight, effort_weight))
+            solution.write(config.get_solution_path(root_dir).replace(
+                f'_{config.name}.sto', f'_{config.name}_sweep{i}.sto'))
+        return sweep.history
 
     def parse_args(self, args):
         self.skip_inverse = False
@@ -703,6 +880,8 @@ class MotionTrackingWalking(MocoPaperResult):
         self.contact_tracking = False
         self.visualize = False
         self.plot_quick = False
+        self.checkpoint = False
+        self.warm_start = False
         if len(args) == 0: return
         print('Received arguments {}'.format(args))
         if 'skip-inverse' in args:
@@ -715,23 +894,54 @@ class MotionTrackingWalking(MocoPaperResult):
             self.visualize = True
         if 'plot-quick' in args:
             self.plot_quick = True
+        if 'checkpoint' in args:
+            self.checkpoint = True
+        if 'warm-start' in args:
+            self.warm_start = True
 
     def generate_results(self, root_dir, args):
         self.parse_args(args)
 
+        # Solve the problems one at a time, each in a forked process (each
+        # solve uses all of the cores), and create the full gait cycle and
+        # ground reaction forces of each solution on a background thread
+        # while the next problem solves; see pipeline.py. Process the models
+        # here first, so that the solve processes inherit them and the
+        # ground reaction stages, which run in this process, reuse them.
+        self.process_models(root_dir, args)
+        pipeline = Pipeline()
+        previous = list()
         # Run inverse problem to generate first initial guess.
         if not self.skip_inverse:
-            self.run_inverse_problem(root_dir)
+            previous = [pipeline.add(
+                'inverse', lambda: self.run_inverse_problem(root_dir),
+                process=True)]
 
-        # Run tracking problem.
+        # Run tracking problem. Each problem's guess may come from an earlier
+        # config's solution (or, with 'warm-start', the warm start library).
         for config in self.configs:
-            self.run_tracking_problem(root_dir, config)
+            def solve(config=config):
+                self.solve_tracking_problem(root_dir, config)
+                return config.get_solution_path(root_dir)
+            solve_stage = pipeline.add(f'{config.name}_solve', solve,
+                                       after=previous, process=True)
+            full_cycle_stage = pipeline.add(
+                f'{config.name}_fullcycle',
+                lambda path, config=config: self.create_full_cycle_trajectory(
+                    root_dir, config, osim.MocoTrajectory(path)),
+                [solve_stage])
+            pipeline.add(
+                f'{config.name}_grfs',
+                lambda full_traj, config=config: self.create_ground_reactions(
+                    root_dir, config, full_traj),
+                [full_cycle_stage])
+            previous = [solve_stage]
+        pipeline.run()
 
     def report_results(self, root_dir, args):
         self.parse_args(args)
 
-        modelProcessor = self.create_model_processor(root_dir)
-        model = modelProcessor.process()
+        model = self.process_model(root_dir)
         state = model.initSystem()
         mass = model.getTotalMass(state)
         gravity = model.getGravity()
@@ -786,10 +996,9 @@ class MotionTrackingWalking(MocoPaperResult):
                 raise Exception("Muscle forces are too negative! " +
                                 f"{config.name}")
 
-            modelProcessor = self.create_model_processor(root_dir,
-                                                         for_inverse=False,
-                                                         config=config)
-            model = modelProcessor.process()
+            model = self.process_model(root_dir,
+                                       for_inverse=False,
+                                       config=config)
             if config.name == 'track':
                 max_iso_forces = dict()
                 muscles = model.getMuscles()
@@ -1100,9 +1309,7 @@ class MotionTrackingWalking(MocoPaperResult):
             osim.STOFileAdapter.write(muscle_mechanics, fpath)
 
             # Generate joint moment breakdown.
-            modelProcessor = self.create_model_processor(root_dir,
-                                                         config=config)
-            model = modelProcessor.process()
+            model = self.process_model(root_dir, config=config)
             print(f'Generating joint moment breakdown for {config.name}.')
             coords = [
                 '/jointset/hip_l/hip_flexion_l',
@@ -1291,10 +1498,9 @@ class MotionTrackingWalking(MocoPaperResult):
         full_path = config.get_solution_path_fullcycle(root_dir)
         full_traj = osim.MocoTrajectory(full_path)
 
-        modelProcessor = self.create_model_processor(root_dir,
-                                                     for_inverse=False,
-                                                     config=config)
-        model = modelProcessor.process()
+        model = self.process_model(root_dir,
+                                   for_inverse=False,
+                                   config=config)
 
         time = full_traj.getTimeMat()
         pgc = 100.0 * (time - time[0]) / (time[-1] - time[0])
@@ -215,6 +215,27 @@ def shift_data_to_cycle(
 
     return shifted_time, shifted_ordinate
 
+def moco_parallel(num_threads):
+    """MocoCasADiSolver's 'parallel' setting for a number of threads: 0 runs
+    serially, 1 uses all hardware threads, and N > 1 uses N threads. The
+    setting takes precedence over the OPENSIM_MOCO_PARALLEL environment
+    variable, which is read only if the setting is unset."""
+    return 0 if num_threads == 1 else num_threads
+
+def use_finite_difference_hessian(solver):
+    """Configure a MocoCasADiSolver to give IPOPT a sparse Hessian instead of
+    its limited-memory approximation. The Hessian is not exact: like the
+    Jacobian, it is computed by (central) finite differences of the OpenSim
+    dynamics, and its sparsity pattern is detected once per solve (from
+    random points) and reused in every iteration. IPOPT often needs fewer
+    iterations with it, but each iteration costs more and the
+    finite-difference error can prevent convergence at tight tolerances, so
+    the scripts use it only when asked to."""
+    solver.set_optim_hessian_approximation('exact')
+    solver.set_optim_sparsity_detection('random')
+    solver.set_optim_finite_difference_scheme('central')
+
+
 def calc_net_generalized_forces(model, motion):
     model.initSystem()
 
@@ -0,0 +1,134 @@
+import os
+import json
+import hashlib
+
+import opensim as osim
+
+
+def model_signature(model):
+    """A hash of the model's state variable names and actuator paths. Models
+    with the same signature produce problems with the same states and
+    controls, even if their parameters (e.g., max isometric forces) differ.
+    The model must have been initialized with initSystem()."""
+    names = model.getStateVariableNames()
+    states = sorted(names.get(i) for i in range(names.getSize()))
+    actuators = model.getActuators()
+    controls = sorted(actuators.get(i).getAbsolutePathString()
+                      for i in range(actuators.getSize()))
+    text = '\n'.join(states + ['controls'] + controls)
+    return hashlib.sha1(text.encode('utf-8')).hexdigest()
+
+
+class WarmStartLibrary(object):
+    """An index of previous solutions that are used as initial guesses for new
+    problems.
+
+    Each entry records the solution file, the signature of the model used to
+    create the solution, the solution's state and control names, and its time
+    window. For a new problem, the library picks the entry with the same model
+    signature (if any), then the one whose states and controls best cover the
+    problem's states and controls, then the one whose duration is closest to
+    the problem's. The chosen trajectory is mapped onto the guess's time window
+    (in normalized time), and columns that the problem does not have (e.g.,
+    reserve actuators from a MocoInverse problem) are dropped. The guess's
+    values are kept for any states and controls that the trajectory lacks.
+
+    The index is saved as JSON so that later runs can use earlier solutions.
+    """
+    def __init__(self, index_fpath, min_coverage=0.5):
+        self.index_fpath = index_fpath
+        self.min_coverage = min_coverage
+        self.entries = list()
+        if os.path.exists(index_fpath):
+            with open(index_fpath) as f:
+                self.entries = json.load(f)
+
+    def save(self):
+        with open(self.index_fpath, 'w') as f:
+            json.dump(self.entries, f, indent=1)
+
+    def add(self, solution_fpath, model, tags=None):
+        """Add (or replace) the entry for the solution file. The model is the
+        one used to solve the problem."""
+        solution_fpath = os.path.abspath(solution_fpath)
+        trajectory = osim.MocoTrajectory(solution_fpath)
+        time = trajectory.getTimeMat()
+        entry = {
+            'solution_file': solution_fpath,
+            'model_signature': model_signature(model),
+            'state_names': list(trajectory.getStateNames()),
+            'control_names': list(trajectory.getControlNames()),
+            'initial_time': time[0],
+            'final_time': time[-1],
+            'num_times': len(time),
+            'tags': tags if tags else list(),
+        }
+        self.entries = [e for e in self.entries
+                        if e['solution_file'] != solution_fpath]
+        self.entries.append(entry)
+        self.save()
+
+    def find(self, guess, model):
+        """Find the entry that best matches the problem for which `guess` was
+        created (e.g., with MocoCasADiSolver.createGuess()). Returns None if no
+        entry covers at least `min_coverage` of the guess's states and
+        controls."""
+        signature = model_signature(model)
+        names = set(guess.getStateNames()) | set(guess.getControlNames())
+        duration = guess.getFinalTime() - guess.getInitialTime()
+        best = None
+        best_score = None
+        for entry in self.entries:
+            if not os.path.exists(entry['solution_file']):
+                continue
+            entry_names = (set(entry['state_names']) |
+                           set(entry['control_names']))
+            coverage = len(names & entry_names) / max(len(names), 1)
+            if coverage < self.min_coverage:
+                continue
+            entry_duration = entry['final_time'] - entry['initial_time']
+            score = (entry['model_signature'] == signature, coverage,
+                     -abs(entry_duration - duration))
+            if best_score is None or score > best_score:
+                best = entry
+                best_score = score
+        return best
+
+    def create_guess(self, solver, model):
+        """Create a guess for the solver's problem from the best entry. If there
+        is no suitable entry, this returns the solver's default guess."""
+        guess = solver.createGuess()
+        entry = self.find(guess, model)
+        if entry is None:
+            print('WarmStartLibrary: no suitable solution; using the '
+                  'default guess.')
+            return guess
+        print(f'WarmStartLibrary: using {entry["solution_file"]} as the '
+              'guess.')
+        trajectory = osim.MocoTrajectory(entry['solution_file'])
+        states = trajectory.exportToStatesTable()
+        controls = trajectory.exportToControlsTable()
+        guess_states = set(guess.getStateNames())
+        guess_controls = set(guess.getControlNames())
+        for table, keep in [(states, guess_states),
+                            (controls, guess_controls)]:
+            for label in list(table.getColumnLabels()):
+                if label not in keep:
+                    table.removeColumn(label)
+            self._map_time(table, entry['initial_time'], entry['final_time'],
+                           guess.getInitialTime(), guess.getFinalTime())
+        if states.getNumColumns():
+            guess.insertStatesTrajectory(states, True)
+        if controls.getNumColumns():
+            guess.insertControlsTrajectory(controls, True)
+        return guess
+
+    @staticmethod
+    def _map_time(table, initial_time, final_time, new_initial_time,
+                  new_final_time):
+        scale = (new_final_time - new_initial_time) / (final_time -
+                                                       initial_time)
+        times = list(table.getIndependentColumn())
+        for i, time in enumerate(times):
+            table.setIndependentValueAtIndex(
+                i, new_initial_time + scale * (time - initial_time))
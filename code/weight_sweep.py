@@ -0,0 +1,66 @@
+import opensim as osim
+
+
+class WeightSweep(object):
+    """Re-solve an initialized MocoStudy for different goal weights.
+
+    The model, references, goals and solver settings of the study are kept
+    between solves; only the weights change. Each solve uses the previous
+    solution as its initial guess, so that the points of a sweep (e.g., a
+    Pareto front between tracking and effort) cost about as much as a few
+    warm-started solves instead of one cold start per point. Order the points
+    so that consecutive points are close to each other.
+
+    The solver must be a MocoCasADiSolver. The solver copies the problem when
+    it is initialized, so the changed weights are applied with
+    MocoSolver::resetProblem() before each solve.
+    """
+    def __init__(self, study, guess=None):
+        self.study = study
+        self.solver = osim.MocoCasADiSolver.safeDownCast(study.updSolver())
+        self.guess = guess
+        self.history = list()
+
+    def set_goal_weight(self, goal_name, weight):
+        self.study.updProblem().updGoal(goal_name).setWeight(weight)
+
+    def set_control_weight(self, goal_name, control_path, weight):
+        """Set the weight for a control in a MocoControlGoal (e.g.,
+        'control_effort' from MocoTrack)."""
+        goal = osim.MocoControlGoal.safeDownCast(
+            self.study.updProblem().updGoal(goal_name))
+        goal.setWeightForControl(control_path, weight)
+
+    def set_state_weight(self, goal_name, state_name, weight):
+        """Set the weight for a state in a MocoStateTrackingGoal (e.g.,
+        'state_tracking' from MocoTrack)."""
+        goal = osim.MocoStateTrackingGoal.safeDownCast(
+            self.study.updProblem().updGoal(goal_name))
+        goal.setWeightForState(state_name, weight)
+
+    def solve(self, goal_weights=None):
+        """Solve with the given goal weights ({goal name: weight}), in addition
+        to any weights set with the set_*_weight() methods, starting from the
+        previous solution. Returns the MocoSolution (unsealed)."""
+        if goal_weights:
+            for name, weight in goal_weights.items():
+                self.set_goal_weight(name, weight)
+        self.solver.resetProblem(self.study.getProblem())
+        if self.guess is not None:
+            self.solver.setGuess(self.guess)
+        solution = self.study.solve()
+        solution.unseal()
+        self.history.append({
+            'goal_weights': dict(goal_weights) if goal_weights else dict(),
+            'objective': solution.getObjective(),
+            'num_iterations': solution.getNumIterations(),
+            'solver_duration': solution.getSolverDuration(),
+            'success': solution.success(),
+        })
+        print(f'WeightSweep: solved {goal_weights} in '
+              f'{solution.getNumIterations()} iterations.')
+        # Keep the last successful solution as the guess; a failed solution
+        # is usually a poor starting point for the next point.
+        if solution.success() or self.guess is None:
+            self.guess = solution
+        return solution
@@ -0,0 +1,274 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: BinaryTrajectory.cpp                                         *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "BinaryTrajectory.h"
+
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <sstream>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using namespace OpenSim;
+
+namespace {
+
+const char magic[8] = {'M', 'O', 'C', 'O', 'B', 'T', 'R', 'J'};
+const std::uint32_t version = 1;
+const std::size_t alignment = 64;
+
+struct FixedHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+    std::uint64_t numRows;
+    std::uint64_t numColumns;
+    std::uint64_t headerSize;
+    std::uint64_t dataOffset;
+};
+static_assert(sizeof(FixedHeader) == 48, "Unexpected header padding.");
+
+void writeFile(const std::string& path, const std::vector<double>& time,
+        const std::vector<std::string>& labels,
+        const std::map<std::string, std::string>& metadata,
+        // Returns the value at (row, column).
+        const std::function<double(int, int)>& getValue) {
+    std::stringstream text;
+    for (const auto& label : labels) {
+        OPENSIM_THROW_IF(label.find('\n') != std::string::npos, Exception,
+                "Column labels must not contain newlines.");
+        text << label << '\n';
+    }
+    for (const auto& entry : metadata) {
+        text << entry.first << '=' << entry.second << '\n';
+    }
+    const std::string headerText = text.str();
+
+    FixedHeader header;
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.reserved = 0;
+    header.numRows = time.size();
+    header.numColumns = labels.size();
+    header.headerSize = headerText.size();
+    const std::size_t end = sizeof(FixedHeader) + headerText.size();
+    header.dataOffset = (end + alignment - 1) / alignment * alignment;
+
+    std::ofstream stream(path, std::ios::binary);
+    OPENSIM_THROW_IF(!stream, Exception, "Could not write '" + path + "'.");
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    stream.write(headerText.data(), headerText.size());
+    const std::vector<char> padding(header.dataOffset - end, 0);
+    stream.write(padding.data(), padding.size());
+
+    stream.write(reinterpret_cast<const char*>(time.data()),
+            time.size() * sizeof(double));
+    std::vector<double> column(time.size());
+    for (int icol = 0; icol < (int)labels.size(); ++icol) {
+        for (int irow = 0; irow < (int)time.size(); ++irow) {
+            column[irow] = getValue(irow, icol);
+        }
+        stream.write(reinterpret_cast<const char*>(column.data()),
+                column.size() * sizeof(double));
+    }
+    OPENSIM_THROW_IF(!stream, Exception, "Failed to write '" + path + "'.");
+}
+
+} // anonymous namespace
+
+BinaryTrajectory::BinaryTrajectory(const std::string& path) : m_path(path) {
+#ifdef _WIN32
+    std::ifstream stream(path, std::ios::binary);
+    OPENSIM_THROW_IF(!stream, Exception, "Could not open '" + path + "'.");
+    m_buffer.assign(std::istreambuf_iterator<char>(stream),
+            std::istreambuf_iterator<char>());
+    m_mapped = m_buffer.data();
+    m_mappedSize = m_buffer.size();
+#else
+    const int fd = open(path.c_str(), O_RDONLY);
+    OPENSIM_THROW_IF(fd < 0, Exception, "Could not open '" + path + "'.");
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < (off_t)sizeof(FixedHeader)) {
+        close(fd);
+        OPENSIM_THROW(Exception, "'" + path + "' is not a binary trajectory.");
+    }
+    m_mappedSize = (std::size_t)status.st_size;
+    void* mapped = mmap(nullptr, m_mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    OPENSIM_THROW_IF(mapped == MAP_FAILED, Exception,
+            "Could not memory-map '" + path + "'.");
+    m_mapped = static_cast<const char*>(mapped);
+#endif
+
+    FixedHeader header;
+    std::memcpy(&header, m_mapped, sizeof(header));
+    const bool valid =
+            std::memcmp(header.magic, magic, sizeof(magic)) == 0 &&
+            header.version == version &&
+            header.dataOffset >= sizeof(header) + header.headerSize &&
+            m_mappedSize >= header.dataOffset + sizeof(double) *
+                    header.numRows * (header.numColumns + 1);
+    if (!valid) {
+#ifndef _WIN32
+        munmap(const_cast<char*>(m_mapped), m_mappedSize);
+#endif
+        OPENSIM_THROW(Exception,
+                "'" + path + "' is not a valid binary trajectory.");
+    }
+
+    m_numRows = header.numRows;
+    std::istringstream text(
+            std::string(m_mapped + sizeof(header), header.headerSize));
+    std::string line;
+    while (m_labels.size() < header.numColumns && std::getline(text, line)) {
+        m_labelIndices[line] = (int)m_labels.size();
+        m_labels.push_back(line);
+    }
+    while (std::getline(text, line)) {
+        const auto equals = line.find('=');
+        if (equals == std::string::npos) continue;
+        m_metadata[line.substr(0, equals)] = line.substr(equals + 1);
+    }
+    m_data = reinterpret_cast<const double*>(m_mapped + header.dataOffset);
+}
+
+BinaryTrajectory::~BinaryTrajectory() {
+#ifndef _WIN32
+    if (m_mapped) munmap(const_cast<char*>(m_mapped), m_mappedSize);
+#endif
+    m_mapped = nullptr;
+}
+
+const std::string& BinaryTrajectory::getMetaData(
+        const std::string& key) const {
+    const auto it = m_metadata.find(key);
+    OPENSIM_THROW_IF(it == m_metadata.end(), Exception,
+            "No metadata '" + key + "' in '" + m_path + "'.");
+    return it->second;
+}
+
+const double* BinaryTrajectory::getColumnData(const std::string& label) const {
+    const auto it = m_labelIndices.find(label);
+    OPENSIM_THROW_IF(it == m_labelIndices.end(), Exception,
+            "No column '" + label + "' in '" + m_path + "'.");
+    return m_data + (it->second + 1) * m_numRows;
+}
+
+SimTK::Vector BinaryTrajectory::getTime() const {
+    return SimTK::Vector((int)m_numRows, 1, getTimeData());
+}
+
+SimTK::Vector BinaryTrajectory::getColumn(const std::string& label) const {
+    return SimTK::Vector((int)m_numRows, 1, getColumnData(label));
+}
+
+TimeSeriesTable BinaryTrajectory::exportToTable(
+        const std::vector<std::string>& labels) const {
+    const auto& columns = labels.empty() ? m_labels : labels;
+    SimTK::Matrix matrix((int)m_numRows, (int)columns.size());
+    for (int icol = 0; icol < (int)columns.size(); ++icol) {
+        const double* column = getColumnData(columns[icol]);
+        for (int irow = 0; irow < (int)m_numRows; ++irow) {
+            matrix(irow, icol) = column[irow];
+        }
+    }
+    TimeSeriesTable table(std::vector<double>(m_data, m_data + m_numRows),
+            matrix, columns);
+    for (const auto& entry : m_metadata) {
+        table.addTableMetaData(entry.first, entry.second);
+    }
+    return table;
+}
+
+MocoTrajectory BinaryTrajectory::exportToMocoTrajectory() const {
+    int offset = 0;
+    // The columns are ordered as in MocoTrajectory::write().
+    const auto getNames = [&](const std::string& key) {
+        const auto it = m_metadata.find(key);
+        const int count = it == m_metadata.end() ? 0 : std::stoi(it->second);
+        OPENSIM_THROW_IF(offset + count > (int)m_labels.size(), Exception,
+                "Inconsistent '" + key + "' metadata in '" + m_path + "'.");
+        std::vector<std::string> names(m_labels.begin() + offset,
+                m_labels.begin() + offset + count);
+        offset += count;
+        return names;
+    };
+    OPENSIM_THROW_IF(!m_metadata.count("num_states"), Exception,
+            "'" + m_path + "' was not written from a MocoTrajectory.");
+    const auto stateNames = getNames("num_states");
+    const auto controlNames = getNames("num_controls");
+    const auto multiplierNames = getNames("num_multipliers");
+    const auto derivativeNames = getNames("num_derivatives");
+    const auto slackNames = getNames("num_slacks");
+    const auto parameterNames = getNames("num_parameters");
+
+    const auto createMatrix = [&](const std::vector<std::string>& names) {
+        SimTK::Matrix matrix((int)m_numRows, (int)names.size());
+        for (int icol = 0; icol < (int)names.size(); ++icol) {
+            const double* column = getColumnData(names[icol]);
+            for (int irow = 0; irow < (int)m_numRows; ++irow) {
+                matrix(irow, icol) = column[irow];
+            }
+        }
+        return matrix;
+    };
+    SimTK::RowVector parameters((int)parameterNames.size());
+    for (int ip = 0; ip < (int)parameterNames.size(); ++ip) {
+        parameters[ip] = getColumnData(parameterNames[ip])[0];
+    }
+    MocoTrajectory trajectory(getTime(), stateNames, controlNames,
+            multiplierNames, derivativeNames, parameterNames,
+            createMatrix(stateNames), createMatrix(controlNames),
+            createMatrix(multiplierNames), createMatrix(derivativeNames),
+            parameters);
+    for (const auto& slackName : slackNames) {
+        trajectory.appendSlack(slackName, getColumn(slackName));
+    }
+    return trajectory;
+}
+
+void BinaryTrajectory::write(
+        const std::string& path, const TimeSeriesTable& table) {
+    std::map<std::string, std::string> metadata;
+    for (const auto& key : table.getTableMetaDataKeys()) {
+        metadata[key] = table.getTableMetaDataAsString(key);
+    }
+    const auto& matrix = table.getMatrix();
+    writeFile(path, table.getIndependentColumn(), table.getColumnLabels(),
+            metadata,
+            [&](int irow, int icol) { return matrix(irow, icol); });
+}
+
+void BinaryTrajectory::write(
+        const std::string& path, const MocoTrajectory& trajectory) {
+    write(path, trajectory.convertToTable());
+}
+
+std::string BinaryTrajectory::convertFromSTO(
+        const std::string& stoPath, std::string binaryPath) {
+    if (binaryPath.empty()) {
+        binaryPath = stoPath.substr(0, stoPath.find_last_of('.')) + ".trj";
+    }
+    write(binaryPath, TimeSeriesTable(stoPath));
+    return binaryPath;
+}
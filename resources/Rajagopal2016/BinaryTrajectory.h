@@ -0,0 +1,112 @@
+#ifndef MOCOPAPER_BINARYTRAJECTORY_H
+#define MOCOPAPER_BINARYTRAJECTORY_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: BinaryTrajectory.h                                           *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <Moco/osimMoco.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace OpenSim {
+
+/// A columnar binary file format for trajectories (`.trj`), as an
+/// alternative to .sto files for large solutions that are read many times.
+/// The file is memory-mapped when read, so opening a file does not parse or
+/// copy the data, and reading a single column only touches the pages holding
+/// that column.
+///
+/// Layout (all integers and floats are little-endian):
+///   - 8 bytes: the magic string "MOCOBTRJ".
+///   - uint32: format version (1); uint32: reserved (0).
+///   - uint64: number of rows; uint64: number of columns, excluding time.
+///   - uint64: size of the header text in bytes; uint64: offset of the data
+///     from the start of the file, a multiple of 64.
+///   - Header text: one column label per line, followed by one
+///     `key=value` line per table metadata entry (as in .sto headers).
+///   - Data: the time column, followed by each column in label order, each
+///     stored as a contiguous array of float64.
+///
+/// The format is also read by code/binary_trajectory.py.
+class BinaryTrajectory {
+public:
+    /// Memory-map the file at the given path. The file must not be modified
+    /// while this object exists.
+    explicit BinaryTrajectory(const std::string& path);
+    ~BinaryTrajectory();
+    BinaryTrajectory(const BinaryTrajectory&) = delete;
+    BinaryTrajectory& operator=(const BinaryTrajectory&) = delete;
+
+    int getNumRows() const { return (int)m_numRows; }
+    int getNumColumns() const { return (int)m_labels.size(); }
+    const std::vector<std::string>& getColumnLabels() const {
+        return m_labels;
+    }
+    bool hasColumn(const std::string& label) const {
+        return m_labelIndices.count(label) > 0;
+    }
+    const std::map<std::string, std::string>& getMetaData() const {
+        return m_metadata;
+    }
+    /// Throws if the key does not exist.
+    const std::string& getMetaData(const std::string& key) const;
+
+    /// Pointers into the mapped file; valid for the lifetime of this object.
+    const double* getTimeData() const { return m_data; }
+    const double* getColumnData(const std::string& label) const;
+
+    /// Read-only views of the mapped data; these do not copy the data.
+    SimTK::Vector getTime() const;
+    SimTK::Vector getColumn(const std::string& label) const;
+
+    /// Create a table with the given columns (or all columns, if empty). The
+    /// table owns its data, so only the requested columns are copied.
+    TimeSeriesTable exportToTable(
+            const std::vector<std::string>& labels = {}) const;
+
+    /// Create a MocoTrajectory from a file written from a MocoTrajectory
+    /// (the file must contain the num_states, num_controls, etc. metadata
+    /// that MocoTrajectory::write() also uses).
+    MocoTrajectory exportToMocoTrajectory() const;
+
+    /// Write the table, including its metadata (which must be strings).
+    static void write(const std::string& path, const TimeSeriesTable& table);
+    static void write(
+            const std::string& path, const MocoTrajectory& trajectory);
+
+    /// Convert an .sto or .mot file to the binary format. If `binaryPath` is
+    /// empty, the extension of `stoPath` is replaced with `.trj`.
+    static std::string convertFromSTO(
+            const std::string& stoPath, std::string binaryPath = "");
+
+private:
+    std::string m_path;
+    const char* m_mapped = nullptr;
+    std::size_t m_mappedSize = 0;
+    std::vector<char> m_buffer; // Used on platforms without mmap.
+    std::uint64_t m_numRows = 0;
+    std::vector<std::string> m_labels;
+    std::unordered_map<std::string, int> m_labelIndices;
+    std::map<std::string, std::string> m_metadata;
+    const double* m_data = nullptr;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_BINARYTRAJECTORY_H
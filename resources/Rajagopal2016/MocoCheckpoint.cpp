@@ -0,0 +1,231 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoCheckpoint.cpp                                           *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "MocoCheckpoint.h"
+
+#include "BinaryTrajectory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <dirent.h>
+#endif
+
+using namespace OpenSim;
+
+namespace {
+
+const std::string intermediatePrefix = "MocoCasADiSolver_";
+const std::string intermediateInfix = "_trajectory";
+const std::string intermediateSuffix = ".sto";
+
+bool fileExists(const std::string& path) {
+    struct stat status;
+    return stat(path.c_str(), &status) == 0;
+}
+
+void writeCheckpoint(const MocoTrajectory& trajectory, int iteration,
+        const std::string& path) {
+    TimeSeriesTable table = trajectory.convertToTable();
+    table.addTableMetaData("checkpoint_iteration", std::to_string(iteration));
+    // Write to a temporary file first so that the previous checkpoint stays
+    // intact if the process is killed during the write.
+    const std::string temporary = path + ".tmp";
+    BinaryTrajectory::write(temporary, table);
+#ifdef _WIN32
+    std::remove(path.c_str());
+#endif
+    OPENSIM_THROW_IF(std::rename(temporary.c_str(), path.c_str()) != 0,
+            Exception, "Could not write checkpoint '" + path + "'.");
+}
+
+} // anonymous namespace
+
+std::vector<MocoIntermediateFile> OpenSim::findMocoIntermediateFiles(
+        std::time_t since) {
+    std::vector<std::string> names;
+#ifdef _WIN32
+    _finddata_t data;
+    const intptr_t handle = _findfirst(
+            (intermediatePrefix + "*" + intermediateSuffix).c_str(), &data);
+    if (handle != -1) {
+        do {
+            names.push_back(data.name);
+        } while (_findnext(handle, &data) == 0);
+        _findclose(handle);
+    }
+#else
+    if (DIR* dir = opendir(".")) {
+        while (const dirent* entry = readdir(dir)) {
+            names.push_back(entry->d_name);
+        }
+        closedir(dir);
+    }
+#endif
+    std::vector<MocoIntermediateFile> files;
+    for (const auto& name : names) {
+        if (name.compare(0, intermediatePrefix.size(), intermediatePrefix) ||
+                name.size() < intermediateSuffix.size() ||
+                name.compare(name.size() - intermediateSuffix.size(),
+                        intermediateSuffix.size(), intermediateSuffix)) {
+            continue;
+        }
+        const auto infix = name.rfind(intermediateInfix);
+        if (infix == std::string::npos) continue;
+        const auto begin = infix + intermediateInfix.size();
+        const std::string digits = name.substr(
+                begin, name.size() - intermediateSuffix.size() - begin);
+        if (digits.empty() ||
+                digits.find_first_not_of("0123456789") != std::string::npos) {
+            continue;
+        }
+        struct stat status;
+        if (stat(name.c_str(), &status) != 0 || status.st_mtime < since) {
+            continue;
+        }
+        files.push_back({name, std::stoi(digits)});
+    }
+    std::sort(files.begin(), files.end(),
+            [](const MocoIntermediateFile& a, const MocoIntermediateFile& b) {
+                return a.iteration < b.iteration;
+            });
+    return files;
+}
+
+MocoCheckpoint::MocoCheckpoint(std::string path, int interval)
+        : m_path(std::move(path)) {
+    setInterval(interval);
+}
+
+void MocoCheckpoint::setInterval(int interval) {
+    OPENSIM_THROW_IF(interval <= 0, Exception,
+            "Expected a positive checkpoint interval.");
+    m_interval = interval;
+}
+
+bool MocoCheckpoint::exists() const { return fileExists(m_path); }
+
+int MocoCheckpoint::getIteration() const {
+    return std::stoi(
+            BinaryTrajectory(m_path).getMetaData("checkpoint_iteration"));
+}
+
+MocoTrajectory MocoCheckpoint::read() const {
+    return BinaryTrajectory(m_path).exportToMocoTrajectory();
+}
+
+MocoSolution MocoCheckpoint::solve(const MocoStudy& original) const {
+    MocoStudy study = original;
+    auto& solver = study.updSolver<MocoCasADiSolver>();
+    solver.set_output_interval(m_interval);
+
+    // Iterations of a resumed solve are numbered from the checkpoint.
+    int iterationOffset = 0;
+    bool wroteOptionFile = false;
+    if (exists()) {
+        iterationOffset = getIteration();
+        std::cout << "MocoCheckpoint: resuming from iteration "
+                  << iterationOffset << " ('" << m_path << "')." << std::endl;
+        solver.setGuess(read());
+        if (m_resumeMu > 0 && !fileExists("ipopt.opt")) {
+            std::ofstream("ipopt.opt") << "mu_init " << m_resumeMu << "\n";
+            wroteOptionFile = true;
+        }
+    }
+
+    // Include files written in the same second as the start of the solve.
+    const std::time_t since = std::time(nullptr) - 1;
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool done = false;
+    std::thread watcher([&] {
+        auto lastWrite = std::chrono::steady_clock::now() -
+                         std::chrono::duration<double>(m_period);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!finished.wait_for(
+                lock, std::chrono::seconds(1), [&] { return done; })) {
+            const auto now = std::chrono::steady_clock::now();
+            if (std::chrono::duration<double>(now - lastWrite).count() <
+                    m_period) {
+                continue;
+            }
+            lock.unlock();
+            try {
+                // The newest file may still be being written, so convert the
+                // one before it.
+                const auto files = findMocoIntermediateFiles(since);
+                if (files.size() >= 2) {
+                    const auto& file = files[files.size() - 2];
+                    const MocoTrajectory iterate(file.path);
+                    const int iteration = iterationOffset + file.iteration;
+                    writeCheckpoint(iterate, iteration, m_path);
+                    if (m_iterateCallback) {
+                        m_iterateCallback(iterate, iteration);
+                    }
+                    for (int i = 0; i < (int)files.size() - 1; ++i) {
+                        std::remove(files[i].path.c_str());
+                    }
+                    lastWrite = now;
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "MocoCheckpoint: " << e.what() << std::endl;
+            }
+            lock.lock();
+        }
+    });
+    // Stop the watcher and remove the option file even if the solve throws.
+    struct Cleanup {
+        std::function<void()> f;
+        ~Cleanup() { f(); }
+    } cleanup{[&] {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        finished.notify_one();
+        watcher.join();
+        if (wroteOptionFile) std::remove("ipopt.opt");
+    }};
+
+    MocoSolution solution =
+            m_solveFunction ? m_solveFunction(study) : study.solve();
+    cleanup.f();
+    cleanup.f = [] {};
+
+    const auto files = findMocoIntermediateFiles(since);
+    if (solution.success()) {
+        std::remove(m_path.c_str());
+    } else if (!files.empty()) {
+        // Keep the last iterate so that the solve can be continued (e.g.,
+        // after reaching the maximum number of iterations).
+        writeCheckpoint(MocoTrajectory(files.back().path),
+                iterationOffset + files.back().iteration, m_path);
+    }
+    for (const auto& file : files) std::remove(file.path.c_str());
+    return solution;
+}
@@ -0,0 +1,118 @@
+#ifndef MOCOPAPER_MOCOCHECKPOINT_H
+#define MOCOPAPER_MOCOCHECKPOINT_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoCheckpoint.h                                             *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <Moco/osimMoco.h>
+
+#include <ctime>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace OpenSim {
+
+/// An iterate that MocoCasADiSolver wrote (every `output_interval`
+/// iterations) to MocoCasADiSolver_<date>_trajectory<iteration>.sto.
+struct MocoIntermediateFile {
+    std::string path;
+    int iteration;
+};
+
+/// The iterates that MocoCasADiSolver wrote to the working directory at or
+/// after `since`, ordered by iteration.
+std::vector<MocoIntermediateFile> findMocoIntermediateFiles(
+        std::time_t since);
+
+/// Checkpoint a long MocoCasADiSolver solve so that it can be resumed after
+/// the process is killed (e.g., on a preempted node).
+///
+/// MocoCasADiSolver writes the current iterate to
+/// MocoCasADiSolver_<date>_trajectory<iteration>.sto in the working directory
+/// every `output_interval` iterations. While solve() runs, a background
+/// thread converts the newest of these files into a single binary checkpoint
+/// (see BinaryTrajectory), at most once per period, with the iteration in its
+/// metadata (checkpoint_iteration). The checkpoint is replaced atomically (by
+/// renaming), so a kill during a write leaves the previous checkpoint intact,
+/// and the intermediate .sto files are deleted once converted. The solver
+/// thread is not held up by the conversion.
+///
+/// If the checkpoint exists when solve() is called, the solve resumes from
+/// it: the checkpoint is the initial guess, and IPOPT's initial barrier
+/// parameter is lowered (see setResumeBarrierParameter()), since the iterate
+/// is already close to the central path. The checkpoint is deleted after a
+/// successful solve.
+///
+/// IPOPT's multipliers are not part of the iterates that MocoCasADiSolver
+/// writes, so they are not checkpointed; IPOPT re-initializes them from the
+/// guess.
+///
+/// @note The intermediate files are identified by name and modification
+/// time, so concurrent solves in the same working directory must not use
+/// checkpoints.
+class MocoCheckpoint {
+public:
+    /// @param path The checkpoint file (e.g.,
+    /// "muscle_driven_state_tracking_checkpoint.trj").
+    /// @param interval Checkpoint every this many IPOPT iterations.
+    explicit MocoCheckpoint(std::string path, int interval = 50);
+
+    void setInterval(int interval);
+    /// Write the checkpoint at most once per this many seconds (wall time).
+    /// If zero (the default), every intermediate iterate is converted.
+    void setPeriod(double seconds) { m_period = seconds; }
+    /// IPOPT's mu_init when resuming (IPOPT's default is 0.1). Zero keeps
+    /// IPOPT's default. The option is passed through an ipopt.opt file in the
+    /// working directory for the duration of the solve; an existing ipopt.opt
+    /// is left untouched and the barrier parameter is then not changed.
+    void setResumeBarrierParameter(double mu) { m_resumeMu = mu; }
+
+    /// Solve with this function instead of MocoStudy::solve() (e.g.,
+    /// MocoSolveProfile::solve()).
+    void setSolveFunction(
+            std::function<MocoSolution(const MocoStudy&)> solveFunction) {
+        m_solveFunction = std::move(solveFunction);
+    }
+
+    /// Also call this function (on the checkpoint's background thread) with
+    /// each iterate that is checkpointed and its iteration (e.g.,
+    /// MocoFrameSink::push()). The function should return quickly.
+    void setIterateCallback(std::function<void(const MocoTrajectory&, int)>
+                    iterateCallback) {
+        m_iterateCallback = std::move(iterateCallback);
+    }
+
+    bool exists() const;
+    /// The iteration at which the existing checkpoint was written.
+    int getIteration() const;
+    MocoTrajectory read() const;
+
+    /// Solve the study (with a MocoCasADiSolver), resuming from the
+    /// checkpoint if it exists.
+    MocoSolution solve(const MocoStudy& study) const;
+
+private:
+    std::string m_path;
+    int m_interval;
+    double m_period = 0;
+    double m_resumeMu = 1e-3;
+    std::function<MocoSolution(const MocoStudy&)> m_solveFunction;
+    std::function<void(const MocoTrajectory&, int)> m_iterateCallback;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_MOCOCHECKPOINT_H
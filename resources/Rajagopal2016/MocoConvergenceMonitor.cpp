@@ -0,0 +1,327 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoConvergenceMonitor.cpp                                   *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "MocoConvergenceMonitor.h"
+
+#include "MocoCheckpoint.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+
+#include <sys/stat.h>
+
+using namespace OpenSim;
+
+namespace {
+
+// IPOPT's default max_iter.
+const int defaultMaxIterations = 3000;
+
+bool fileExists(const std::string& path) {
+    struct stat status;
+    return stat(path.c_str(), &status) == 0;
+}
+
+// The columns of `values` whose names match the pattern.
+void appendMatching(const std::regex& pattern,
+        const std::vector<std::string>& names, const SimTK::Matrix& values,
+        std::vector<SimTK::Vector>& columns) {
+    for (int i = 0; i < (int)names.size(); ++i) {
+        if (std::regex_match(names[i], pattern)) {
+            columns.push_back(values.col(i));
+        }
+    }
+}
+
+// The largest absolute change of any value, or infinity if the dimensions
+// differ.
+double calcChange(const SimTK::Matrix& a, const SimTK::Matrix& b) {
+    if (a.nrow() != b.nrow() || a.ncol() != b.ncol()) return SimTK::Infinity;
+    double change = 0;
+    for (int j = 0; j < a.ncol(); ++j) {
+        for (int i = 0; i < a.nrow(); ++i) {
+            change = std::max(change, std::abs(a(i, j) - b(i, j)));
+        }
+    }
+    return change;
+}
+
+} // anonymous namespace
+
+MocoConvergenceMonitor::MocoConvergenceMonitor(int numIterations)
+        : m_numIterations(numIterations) {
+    OPENSIM_THROW_IF(numIterations <= 0, Exception,
+            "Expected a positive number of iterations.");
+}
+
+void MocoConvergenceMonitor::setInterval(int interval) {
+    OPENSIM_THROW_IF(interval <= 0, Exception,
+            "Expected a positive monitoring interval.");
+    m_interval = interval;
+}
+
+void MocoConvergenceMonitor::setRoundIterations(int roundIterations) {
+    OPENSIM_THROW_IF(roundIterations <= 0, Exception,
+            "Expected a positive number of iterations per round.");
+    m_roundIterations = roundIterations;
+}
+
+void MocoConvergenceMonitor::addCriterion(const std::string& name,
+        std::function<SimTK::Matrix(const MocoTrajectory&)> calcValues,
+        double tolerance) {
+    OPENSIM_THROW_IF(tolerance < 0, Exception,
+            "Expected a non-negative tolerance for criterion '" + name +
+                    "'.");
+    Criterion criterion;
+    criterion.calcValues = std::move(calcValues);
+    m_criteria.push_back(std::move(criterion));
+    MocoConvergenceCriterionStatus status;
+    status.name = name;
+    status.tolerance = tolerance;
+    m_report.criteria.push_back(status);
+}
+
+void MocoConvergenceMonitor::addVariableCriterion(const std::string& name,
+        const std::string& pattern, double tolerance) {
+    const std::regex regex(pattern);
+    addCriterion(name,
+            [regex, name, pattern](const MocoTrajectory& iterate) {
+                std::vector<SimTK::Vector> columns;
+                appendMatching(regex, iterate.getStateNames(),
+                        iterate.getStatesTrajectory(), columns);
+                appendMatching(regex, iterate.getControlNames(),
+                        iterate.getControlsTrajectory(), columns);
+                OPENSIM_THROW_IF(columns.empty(), Exception,
+                        "No states or controls match '" + pattern +
+                                "' (criterion '" + name + "').");
+                SimTK::Matrix values(columns.front().size(),
+                        (int)columns.size());
+                for (int j = 0; j < (int)columns.size(); ++j) {
+                    values.updCol(j) = columns[j];
+                }
+                return values;
+            },
+            tolerance);
+}
+
+void MocoConvergenceMonitor::addOutputCriterion(const std::string& name,
+        std::shared_ptr<TrajectoryDynamicsEvaluator> evaluator,
+        std::vector<std::string> outputPaths, double tolerance) {
+    addCriterion(name,
+            [evaluator, outputPaths](const MocoTrajectory& iterate) {
+                return SimTK::Matrix(
+                        evaluator->analyze(iterate, outputPaths).getMatrix());
+            },
+            tolerance);
+}
+
+void MocoConvergenceMonitor::addGeneralizedForceCriterion(
+        const std::string& name,
+        std::shared_ptr<TrajectoryDynamicsEvaluator> evaluator,
+        double tolerance) {
+    addCriterion(name,
+            [evaluator](const MocoTrajectory& iterate) {
+                return SimTK::Matrix(
+                        evaluator->calcGeneralizedForces(iterate).getMatrix());
+            },
+            tolerance);
+}
+
+bool MocoConvergenceMonitor::update(
+        const MocoTrajectory& iterate, int iteration) {
+    bool settled = true;
+    for (int i = 0; i < (int)m_criteria.size(); ++i) {
+        auto& criterion = m_criteria[i];
+        auto& status = m_report.criteria[i];
+        SimTK::Matrix values = criterion.calcValues(iterate);
+        if (criterion.previousIteration >= 0) {
+            status.change = calcChange(values, criterion.previous);
+            if (status.change <= status.tolerance) {
+                if (criterion.withinSince < 0) {
+                    criterion.withinSince = criterion.previousIteration;
+                }
+                if (status.settled_iteration < 0 &&
+                        iteration - criterion.withinSince >=
+                                m_numIterations) {
+                    status.settled_iteration = iteration;
+                }
+            } else {
+                criterion.withinSince = -1;
+                status.settled_iteration = -1;
+            }
+        }
+        criterion.previous = std::move(values);
+        criterion.previousIteration = iteration;
+        settled = settled && status.settled_iteration >= 0;
+    }
+    return settled;
+}
+
+MocoSolution MocoConvergenceMonitor::solve(const MocoStudy& original) {
+    OPENSIM_THROW_IF(m_criteria.empty(), Exception,
+            "Expected at least one convergence criterion.");
+    for (int i = 0; i < (int)m_criteria.size(); ++i) {
+        m_criteria[i].previousIteration = -1;
+        m_criteria[i].withinSince = -1;
+        m_report.criteria[i].change = SimTK::NaN;
+        m_report.criteria[i].settled_iteration = -1;
+    }
+    m_report.reason.clear();
+    m_report.trigger.clear();
+    m_report.num_iterations = 0;
+    m_report.solver_duration = 0;
+
+    MocoStudy study = original;
+    auto& solver = study.updSolver<MocoCasADiSolver>();
+    solver.set_output_interval(m_interval);
+    const int maxIterations = solver.get_optim_max_iterations() > 0
+                                      ? solver.get_optim_max_iterations()
+                                      : defaultMaxIterations;
+
+    MocoSolution solution;
+    while (true) {
+        const int roundIterations = std::min(
+                m_roundIterations, maxIterations - m_report.num_iterations);
+        solver.set_optim_max_iterations(roundIterations);
+        const bool resume = m_report.num_iterations > 0;
+        bool wroteOptionFile = false;
+        if (resume) {
+            solver.setGuess(solution);
+            if (m_resumeMu > 0 && !fileExists("ipopt.opt")) {
+                std::ofstream("ipopt.opt") << "mu_init " << m_resumeMu
+                                           << "\n";
+                wroteOptionFile = true;
+            }
+        }
+        // Include files written in the same second as the start of the
+        // round.
+        const std::time_t since = std::time(nullptr) - 1;
+        try {
+            solution = m_solveFunction ? m_solveFunction(study)
+                                       : study.solve();
+        } catch (...) {
+            if (wroteOptionFile) std::remove("ipopt.opt");
+            for (const auto& file : findMocoIntermediateFiles(since)) {
+                std::remove(file.path.c_str());
+            }
+            throw;
+        }
+        if (wroteOptionFile) std::remove("ipopt.opt");
+        solution.unseal();
+
+        // The round's iterates, then its solution; the first iterate of a
+        // resumed round is the previous round's solution.
+        bool settled = false;
+        for (const auto& file : findMocoIntermediateFiles(since)) {
+            if (!(resume && file.iteration == 0) &&
+                    file.iteration < solution.getNumIterations()) {
+                settled = update(MocoTrajectory(file.path),
+                        m_report.num_iterations + file.iteration);
+            }
+            std::remove(file.path.c_str());
+        }
+        m_report.num_iterations += solution.getNumIterations();
+        m_report.solver_duration += solution.getSolverDuration();
+        settled = update(solution, m_report.num_iterations);
+
+        if (solution.success()) {
+            m_report.reason = "converged";
+        } else if (settled) {
+            m_report.reason = "settled";
+            int last = -1;
+            for (const auto& status : m_report.criteria) {
+                if (status.settled_iteration > last) {
+                    last = status.settled_iteration;
+                    m_report.trigger = status.name;
+                }
+            }
+        } else if (solution.getStatus() != "Maximum_Iterations_Exceeded" ||
+                   m_report.num_iterations >= maxIterations ||
+                   solution.getNumIterations() == 0) {
+            m_report.reason = solution.getStatus();
+        }
+        std::cout << "MocoConvergenceMonitor: iteration "
+                  << m_report.num_iterations << ":";
+        for (const auto& status : m_report.criteria) {
+            std::cout << " " << status.name << " " << status.change
+                      << (status.settled_iteration >= 0 ? " (settled)" : "");
+        }
+        std::cout << "." << std::endl;
+        if (!m_report.reason.empty()) break;
+    }
+    std::cout << "MocoConvergenceMonitor: stopped after "
+              << m_report.num_iterations << " iterations: "
+              << m_report.reason
+              << (m_report.trigger.empty() ? ""
+                                           : " (last: " + m_report.trigger +
+                                                     ")")
+              << "." << std::endl;
+    return solution;
+}
+
+void MocoConvergenceMonitor::writeSolution(
+        const MocoSolution& solution, const std::string& path) const {
+    solution.write(path);
+    // Read the file back so that we keep the metadata that write() adds.
+    TimeSeriesTable table(path);
+    addMetaData(table);
+    STOFileAdapter::write(table, path);
+}
+
+void MocoConvergenceMonitor::addMetaData(TimeSeriesTable& table) const {
+    const auto join = [&](const std::function<std::string(
+                                  const MocoConvergenceCriterionStatus&)>&
+                                  get) {
+        std::stringstream ss;
+        for (int i = 0; i < (int)m_report.criteria.size(); ++i) {
+            if (i) ss << ",";
+            ss << get(m_report.criteria[i]);
+        }
+        return ss.str();
+    };
+    table.addTableMetaData<std::string>(
+            "convergence_monitor_reason", m_report.reason);
+    table.addTableMetaData<std::string>(
+            "convergence_monitor_trigger", m_report.trigger);
+    table.addTableMetaData<std::string>("convergence_monitor_num_iterations",
+            std::to_string(m_report.num_iterations));
+    std::stringstream duration;
+    duration.precision(17);
+    duration << m_report.solver_duration;
+    table.addTableMetaData<std::string>(
+            "convergence_monitor_solver_duration", duration.str());
+    table.addTableMetaData<std::string>("convergence_monitor_criteria",
+            join([](const MocoConvergenceCriterionStatus& s) {
+                return s.name;
+            }));
+    table.addTableMetaData<std::string>("convergence_monitor_change",
+            join([](const MocoConvergenceCriterionStatus& s) {
+                std::stringstream ss;
+                ss.precision(17);
+                ss << s.change;
+                return ss.str();
+            }));
+    table.addTableMetaData<std::string>(
+            "convergence_monitor_settled_iteration",
+            join([](const MocoConvergenceCriterionStatus& s) {
+                return std::to_string(s.settled_iteration);
+            }));
+}
@@ -0,0 +1,183 @@
+#ifndef MOCOPAPER_MOCOCONVERGENCEMONITOR_H
+#define MOCOPAPER_MOCOCONVERGENCEMONITOR_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoConvergenceMonitor.h                                     *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "TrajectoryDynamicsEvaluator.h"
+
+#include <Moco/osimMoco.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace OpenSim {
+
+/// The state of one criterion of a MocoConvergenceMonitor.
+struct MocoConvergenceCriterionStatus {
+    std::string name;
+    double tolerance = 0;
+    /// The largest absolute change of any value between the last two
+    /// monitored iterates.
+    double change = SimTK::NaN;
+    /// The iteration at which the criterion settled (its change stayed
+    /// within the tolerance for the required number of iterations), or -1
+    /// if it has not settled.
+    int settled_iteration = -1;
+};
+
+/// How a MocoConvergenceMonitor's solve ended.
+struct MocoConvergenceReport {
+    /// "settled" if every criterion settled, "converged" if IPOPT converged
+    /// first, or IPOPT's status otherwise (e.g.,
+    /// "Maximum_Iterations_Exceeded").
+    std::string reason;
+    /// If the criteria settled, the criterion that settled last (the one
+    /// that ended the solve).
+    std::string trigger;
+    /// IPOPT iterations over all rounds.
+    int num_iterations = 0;
+    /// Solver duration over all rounds (seconds).
+    double solver_duration = 0;
+    std::vector<MocoConvergenceCriterionStatus> criteria;
+};
+
+/// Stop a MocoCasADiSolver solve once the quantities of interest (e.g.,
+/// activations, joint moments or ground reaction forces) stop changing,
+/// rather than when IPOPT meets its convergence tolerance. For screening
+/// studies, the last few hundred iterations of a solve often barely change
+/// the kinematics and activations.
+///
+/// Each criterion computes a matrix of values (time point by quantity) from
+/// an iterate, and its change between two monitored iterates is the largest
+/// absolute change of any value. A criterion settles once its change has
+/// stayed within its tolerance for `numIterations` iterations, and the solve
+/// stops once every criterion has settled (or IPOPT converges first).
+///
+/// IPOPT cannot be stopped from outside while it runs, so the solve is split
+/// into rounds of `roundIterations` iterations, each starting from the
+/// previous round's iterate with a lowered initial barrier parameter (as
+/// when resuming from a MocoCheckpoint). The iterates are read from the
+/// files that MocoCasADiSolver writes every `interval` iterations (see
+/// MocoCheckpoint.h) after each round, and the solve stops at the end of the
+/// round in which the criteria settled. IPOPT re-initializes its
+/// multipliers in each round, which costs a few iterations per round; use
+/// rounds of at least a few dozen iterations.
+///
+/// The returned solution is the last round's, so its number of iterations
+/// and solver duration are the last round's; the totals are in the report.
+/// A solve that stopped because the criteria settled is not converged
+/// (MocoSolution::success() is false), so its objective is not comparable
+/// with that of a converged solve.
+///
+/// @note The monitor consumes (and deletes) MocoCasADiSolver's intermediate
+/// files, so it cannot be combined with a MocoCheckpoint, and concurrent
+/// solves in the same working directory must not use monitors.
+///
+/// @note Only exampleMocoTrackAdvanced (--screening) uses the monitor. The
+/// Python scripts in code/ still solve until IPOPT meets
+/// set_optim_convergence_tolerance() (e.g., 1e-3).
+class MocoConvergenceMonitor {
+public:
+    /// @param numIterations A criterion settles once its change has stayed
+    /// within its tolerance for this many iterations.
+    explicit MocoConvergenceMonitor(int numIterations = 50);
+
+    /// Compare iterates this many iterations apart (MocoCasADiSolver's
+    /// `output_interval`). Writing each iterate costs a little time per
+    /// iteration.
+    void setInterval(int interval);
+    /// IPOPT iterations per round.
+    void setRoundIterations(int roundIterations);
+    /// IPOPT's mu_init in rounds after the first; see
+    /// MocoCheckpoint::setResumeBarrierParameter().
+    void setResumeBarrierParameter(double mu) { m_resumeMu = mu; }
+
+    /// A criterion on any quantity: calcValues(iterate) returns a matrix of
+    /// values whose largest absolute change must stay within the tolerance.
+    /// For example, ground reaction forces can be computed from the contact
+    /// forces with TrajectoryDynamicsEvaluator::evaluate().
+    void addCriterion(const std::string& name,
+            std::function<SimTK::Matrix(const MocoTrajectory&)> calcValues,
+            double tolerance);
+    /// A criterion on the states and controls whose names match the regular
+    /// expression (e.g., "/forceset/.*/activation" for the activations).
+    void addVariableCriterion(const std::string& name,
+            const std::string& pattern, double tolerance);
+    /// A criterion on the Outputs whose paths match the regular expressions;
+    /// see TrajectoryDynamicsEvaluator::analyze().
+    void addOutputCriterion(const std::string& name,
+            std::shared_ptr<TrajectoryDynamicsEvaluator> evaluator,
+            std::vector<std::string> outputPaths, double tolerance);
+    /// A criterion on the net joint moments and forces; see
+    /// TrajectoryDynamicsEvaluator::calcGeneralizedForces().
+    void addGeneralizedForceCriterion(const std::string& name,
+            std::shared_ptr<TrajectoryDynamicsEvaluator> evaluator,
+            double tolerance);
+
+    /// Solve each round with this function instead of MocoStudy::solve()
+    /// (e.g., MocoSolveProfile::solve()).
+    void setSolveFunction(
+            std::function<MocoSolution(const MocoStudy&)> solveFunction) {
+        m_solveFunction = std::move(solveFunction);
+    }
+
+    /// Solve the study (with a MocoCasADiSolver), in rounds, until the
+    /// criteria settle, IPOPT converges, or the solver's maximum number of
+    /// iterations is reached. Returns the last round's solution (unsealed),
+    /// and records how the solve ended in getReport().
+    MocoSolution solve(const MocoStudy& study);
+    const MocoConvergenceReport& getReport() const { return m_report; }
+
+    /// Write the solution, adding the report to its metadata
+    /// (convergence_monitor_reason, convergence_monitor_trigger,
+    /// convergence_monitor_num_iterations,
+    /// convergence_monitor_solver_duration, and comma-separated lists
+    /// convergence_monitor_criteria, convergence_monitor_change and
+    /// convergence_monitor_settled_iteration).
+    void writeSolution(const MocoSolution& solution,
+            const std::string& path) const;
+    /// Add the report to the metadata of a table (e.g., a solution file
+    /// written by MocoMeshRefinement::writeSolution()), as writeSolution()
+    /// does.
+    void addMetaData(TimeSeriesTable& table) const;
+
+private:
+    struct Criterion {
+        std::function<SimTK::Matrix(const MocoTrajectory&)> calcValues;
+        SimTK::Matrix previous;
+        int previousIteration = -1;
+        /// The iteration from which the change has stayed within the
+        /// tolerance, or -1.
+        int withinSince = -1;
+    };
+    /// Update each criterion with an iterate; returns true if every
+    /// criterion has settled.
+    bool update(const MocoTrajectory& iterate, int iteration);
+
+    int m_numIterations;
+    int m_interval = 1;
+    int m_roundIterations = 100;
+    double m_resumeMu = 1e-3;
+    std::function<MocoSolution(const MocoStudy&)> m_solveFunction;
+    std::vector<Criterion> m_criteria;
+    MocoConvergenceReport m_report;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_MOCOCONVERGENCEMONITOR_H
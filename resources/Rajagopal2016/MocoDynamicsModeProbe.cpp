@@ -0,0 +1,196 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoDynamicsModeProbe.cpp                                    *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "MocoDynamicsModeProbe.h"
+
+#include "MocoSolveProfile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+using namespace OpenSim;
+
+namespace {
+
+std::string describe(const MocoDynamicsModeProbeResult& result) {
+    std::stringstream ss;
+    ss << result.mode << ": ";
+    if (std::isnan(result.predicted_duration)) {
+        ss << "did not converge in " << result.num_iterations
+           << " iterations";
+    } else {
+        ss << "predicted " << result.predicted_duration << " s ("
+           << result.time_per_iteration << " s per iteration on the probe, "
+           << result.predicted_num_iterations << " iterations)";
+    }
+    if (!std::isnan(result.mean_step_size)) {
+        ss << ", mean step size " << result.mean_step_size << ", "
+           << 100 * result.regularized_fraction << "% regularized";
+    }
+    return ss.str();
+}
+
+} // anonymous namespace
+
+MocoDynamicsModeProbe::MocoDynamicsModeProbe(
+        std::function<MocoStudy(double)> createStudy,
+        double probeMeshInterval)
+        : m_createStudy(std::move(createStudy)),
+          m_probeMeshInterval(probeMeshInterval) {
+    OPENSIM_THROW_IF(!m_createStudy, Exception,
+            "Expected a function that creates the study.");
+    OPENSIM_THROW_IF(m_probeMeshInterval <= 0, Exception,
+            "Expected a positive probe mesh interval.");
+    m_configureImplicit = [](MocoCasADiSolver& solver) {
+        solver.set_minimize_implicit_multibody_accelerations(true);
+        solver.set_implicit_multibody_accelerations_weight(0.001);
+        solver.set_minimize_implicit_auxiliary_derivatives(true);
+        solver.set_implicit_auxiliary_derivatives_weight(0.001);
+    };
+}
+
+void MocoDynamicsModeProbe::apply(
+        MocoCasADiSolver& solver, const std::string& mode) const {
+    OPENSIM_THROW_IF(mode != "explicit" && mode != "implicit", Exception,
+            "Expected 'explicit' or 'implicit', but got '" + mode + "'.");
+    solver.set_multibody_dynamics_mode(mode);
+    if (mode == "implicit" && m_configureImplicit) m_configureImplicit(solver);
+}
+
+MocoDynamicsModeProbeResult MocoDynamicsModeProbe::probe(MocoStudy study,
+        const std::string& mode, double meshInterval) const {
+    std::cout << "MocoDynamicsModeProbe: probing " << mode
+              << " multibody dynamics." << std::endl;
+    auto& solver = study.updSolver<MocoCasADiSolver>();
+    apply(solver, mode);
+    if (m_maxIterations > 0) solver.set_optim_max_iterations(m_maxIterations);
+
+    MocoSolveProfile profile;
+    profile.setCaptureSolverOutput(m_captureOutput);
+    MocoSolution solution = profile.solve(study);
+    solution.unseal();
+
+    MocoDynamicsModeProbeResult result;
+    result.mode = mode;
+    result.success = solution.success();
+    result.num_iterations = solution.getNumIterations();
+    result.solver_duration = solution.getSolverDuration();
+    result.time_per_iteration =
+            result.solver_duration / std::max(1, result.num_iterations);
+
+    // IPOPT's first row is the initial point, before any step.
+    const auto infPr = profile.getIterationColumn(0, "inf_pr");
+    const auto infDu = profile.getIterationColumn(0, "inf_du");
+    const auto alphaPr = profile.getIterationColumn(0, "alpha_pr");
+    const auto lgRg = profile.getIterationColumn(0, "lg_rg");
+    const int numSteps = (int)infPr.size() - 1;
+    if (numSteps > 0) {
+        double sumStepSize = 0;
+        int numRegularized = 0;
+        for (int i = 1; i <= numSteps; ++i) {
+            sumStepSize += alphaPr[i];
+            if (!std::isnan(lgRg[i])) ++numRegularized;
+        }
+        result.mean_step_size = sumStepSize / numSteps;
+        result.regularized_fraction = double(numRegularized) / numSteps;
+    }
+
+    if (result.success) {
+        result.predicted_num_iterations = result.num_iterations;
+    } else if (m_maxIterations > 0 && numSteps > 0) {
+        // The infeasibilities relative to their tolerances (IPOPT's
+        // defaults if the solver leaves them unset); converged below 1.
+        const double constraintTol = solver.get_optim_constraint_tolerance();
+        const double convergenceTol =
+                solver.get_optim_convergence_tolerance();
+        const auto error = [&](int i) {
+            return std::max(infPr[i] / (constraintTol > 0 ? constraintTol
+                                                          : 1e-4),
+                    infDu[i] / (convergenceTol > 0 ? convergenceTol : 1e-8));
+        };
+        const double rate =
+                (std::log10(error(0)) - std::log10(error(numSteps))) /
+                numSteps;
+        if (error(numSteps) <= 1) {
+            result.predicted_num_iterations = numSteps;
+        } else if (rate > 0) {
+            result.predicted_num_iterations =
+                    numSteps + std::log10(error(numSteps)) / rate;
+        }
+    }
+    // The cost per iteration grows with the number of mesh intervals.
+    result.predicted_duration = result.time_per_iteration *
+                                (m_probeMeshInterval / meshInterval) *
+                                result.predicted_num_iterations;
+    return result;
+}
+
+std::string MocoDynamicsModeProbe::select(double meshInterval) {
+    OPENSIM_THROW_IF(m_maxIterations > 0 && !m_captureOutput, Exception,
+            "Stopping the probes early requires capturing the solver "
+            "output.");
+    m_results.clear();
+    const MocoStudy study = m_createStudy(m_probeMeshInterval);
+
+    std::string key;
+    if (m_topologyCache) {
+        key = MocoTopologyCache::calcKey(study);
+        const std::string mode =
+                m_topologyCache->getSetting(key, "multibody_dynamics_mode");
+        if (!mode.empty()) {
+            m_reason = "chosen earlier for topology " + key + " (" +
+                       m_topologyCache->getSetting(
+                               key, "multibody_dynamics_mode_reason") +
+                       ")";
+            std::cout << "MocoDynamicsModeProbe: using " << mode
+                      << " multibody dynamics, " << m_reason << "."
+                      << std::endl;
+            return mode;
+        }
+    }
+
+    for (const std::string mode : {"explicit", "implicit"}) {
+        m_results.push_back(probe(study, mode, meshInterval));
+    }
+    const auto& explicitResult = m_results[0];
+    const auto& implicitResult = m_results[1];
+    std::string mode = "explicit";
+    std::string why;
+    if (std::isnan(explicitResult.predicted_duration) &&
+            std::isnan(implicitResult.predicted_duration)) {
+        why = "neither probe converged; using Moco's default";
+    } else if (std::isnan(implicitResult.predicted_duration) ||
+               explicitResult.predicted_duration <=
+                       implicitResult.predicted_duration) {
+        why = "explicit is predicted to be faster";
+    } else {
+        mode = "implicit";
+        why = "implicit is predicted to be faster";
+    }
+    m_reason = why + "; " + describe(explicitResult) + "; " +
+               describe(implicitResult);
+    std::cout << "MocoDynamicsModeProbe: using " << mode
+              << " multibody dynamics: " << m_reason << "." << std::endl;
+
+    if (m_topologyCache) {
+        m_topologyCache->setSetting(key, "multibody_dynamics_mode", mode);
+        m_topologyCache->setSetting(
+                key, "multibody_dynamics_mode_reason", m_reason);
+    }
+    return mode;
+}
@@ -0,0 +1,129 @@
+#ifndef MOCOPAPER_MOCODYNAMICSMODEPROBE_H
+#define MOCOPAPER_MOCODYNAMICSMODEPROBE_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoDynamicsModeProbe.h                                      *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "MocoTopologyCache.h"
+
+#include <Moco/osimMoco.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace OpenSim {
+
+/// The result of solving the probe problem with one multibody dynamics mode.
+struct MocoDynamicsModeProbeResult {
+    std::string mode;
+    bool success = false;
+    int num_iterations = 0;
+    double solver_duration = 0;
+    double time_per_iteration = SimTK::NaN;
+    /// The number of iterations predicted for convergence; this is
+    /// num_iterations if the probe converged, and is extrapolated from the
+    /// decrease in IPOPT's infeasibilities if the probe was stopped early.
+    double predicted_num_iterations = SimTK::NaN;
+    /// The predicted solver duration on the target mesh.
+    double predicted_duration = SimTK::NaN;
+    /// Measures of conditioning from IPOPT's iteration rows (NaN if the
+    /// solver output was not captured): the mean primal step size
+    /// (alpha_pr), which is small when the line search struggles, and the
+    /// fraction of iterations in which IPOPT regularized the Hessian (lg_rg).
+    double mean_step_size = SimTK::NaN;
+    double regularized_fraction = SimTK::NaN;
+};
+
+/// Choose between explicit and implicit multibody dynamics for a problem by
+/// solving it with both modes on a coarse probe mesh.
+///
+/// The cost on the target mesh is predicted as the probe's time per
+/// iteration, scaled by the ratio of the numbers of mesh intervals, times
+/// the probe's number of iterations. Implicit dynamics adds the generalized
+/// accelerations as controls and avoids inverting the mass matrix, so its
+/// iterations are usually cheaper but more numerous; which mode wins depends
+/// on the model and the problem, which is why it is measured rather than
+/// guessed. A mode whose probe fails loses to one whose probe succeeds.
+///
+/// With setMaxIterations(), each probe is stopped after a few iterations,
+/// and the number of iterations to convergence is extrapolated from the
+/// rate at which IPOPT's infeasibilities decrease, which requires the solver
+/// output (see MocoSolveProfile).
+///
+/// With a topology cache, the choice is stored as the setting
+/// "multibody_dynamics_mode" for the problem's topology and later selections
+/// for the same topology return it without probing.
+class MocoDynamicsModeProbe {
+public:
+    /// createStudy(meshInterval) returns a MocoStudy, with a
+    /// MocoCasADiSolver, that uses the given mesh interval; it sets neither
+    /// mode (see MocoMeshRefinement).
+    MocoDynamicsModeProbe(std::function<MocoStudy(double)> createStudy,
+            double probeMeshInterval);
+
+    /// Stop each probe after this many iterations. If zero (the default),
+    /// the probes are solved to convergence.
+    void setMaxIterations(int maxIterations) {
+        m_maxIterations = maxIterations;
+    }
+    /// Capture the solver output of the probes to measure conditioning (the
+    /// default). Disable this if other threads write to standard output at
+    /// the same time; setMaxIterations() then cannot be used.
+    void setCaptureSolverOutput(bool capture) { m_captureOutput = capture; }
+    /// Called for the implicit probe, and by apply() for implicit mode.
+    /// By default, the implicit accelerations and auxiliary derivatives are
+    /// minimized with a weight of 0.001, as in code/squat_to_stand.py.
+    void setConfigureImplicit(
+            std::function<void(MocoCasADiSolver&)> configureImplicit) {
+        m_configureImplicit = std::move(configureImplicit);
+    }
+    void setTopologyCache(std::shared_ptr<MocoTopologyCache> cache) {
+        m_topologyCache = std::move(cache);
+    }
+
+    /// Probe both modes and return the one ("explicit" or "implicit") with
+    /// the smaller predicted duration on a mesh with the given interval.
+    std::string select(double meshInterval);
+
+    /// Set the mode on the solver, along with the implicit configuration.
+    void apply(MocoCasADiSolver& solver, const std::string& mode) const;
+
+    /// The probe results of the last select() (empty if the choice came
+    /// from the topology cache).
+    const std::vector<MocoDynamicsModeProbeResult>& getResults() const {
+        return m_results;
+    }
+    /// Why the last select() chose its mode.
+    const std::string& getReason() const { return m_reason; }
+
+private:
+    MocoDynamicsModeProbeResult probe(MocoStudy study,
+            const std::string& mode, double meshInterval) const;
+
+    std::function<MocoStudy(double)> m_createStudy;
+    double m_probeMeshInterval;
+    int m_maxIterations = 0;
+    bool m_captureOutput = true;
+    std::function<void(MocoCasADiSolver&)> m_configureImplicit;
+    std::shared_ptr<MocoTopologyCache> m_topologyCache;
+    std::vector<MocoDynamicsModeProbeResult> m_results;
+    std::string m_reason;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_MOCODYNAMICSMODEPROBE_H
@@ -0,0 +1,43 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoFiniteDifferenceHessian.h                                *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+#ifndef MOCOPAPER_MOCOFINITEDIFFERENCEHESSIAN_H
+#define MOCOPAPER_MOCOFINITEDIFFERENCEHESSIAN_H
+
+#include <Moco/osimMoco.h>
+
+namespace OpenSim {
+
+/// Configure the solver to give IPOPT a sparse Hessian of the Lagrangian
+/// instead of its limited-memory (quasi-Newton) approximation. OpenSim models
+/// are not differentiated automatically, so this Hessian is not exact: like
+/// the Jacobian, it is computed by finite differences of the dynamics, here
+/// central differences (more accurate than forward differences for second
+/// derivatives, at twice the cost). The sparsity patterns of the Jacobian and
+/// Hessian are detected once, at the start of the solve, from random points,
+/// and are reused in every iteration; a pattern missed at those points is
+/// treated as zero. IPOPT often needs fewer iterations with this Hessian, but
+/// each iteration costs more and the finite-difference error can prevent
+/// convergence at tight tolerances, so it is off by default and worth
+/// enabling only after comparing against the default on the problem at hand.
+inline void setFiniteDifferenceHessian(MocoCasADiSolver& solver) {
+    solver.set_optim_hessian_approximation("exact");
+    solver.set_optim_sparsity_detection("random");
+    solver.set_optim_finite_difference_scheme("central");
+}
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_MOCOFINITEDIFFERENCEHESSIAN_H
@@ -0,0 +1,270 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoFrameSink.cpp                                            *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "MocoFrameSink.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+#ifndef _WIN32
+    #include <netdb.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+#endif
+
+using namespace OpenSim;
+
+namespace {
+
+template <typename T>
+void append(std::string& bytes, const T& value) {
+    bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+#ifndef _WIN32
+bool sendAll(int socket, const std::string& bytes) {
+    #ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+    #else
+    const int flags = 0;
+    #endif
+    std::size_t sent = 0;
+    while (sent < bytes.size()) {
+        const auto n = ::send(
+                socket, bytes.data() + sent, bytes.size() - sent, flags);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+#endif
+
+} // anonymous namespace
+
+MocoFrameSink::MocoFrameSink(const Model& model, const std::string& path)
+        : m_model(model.clone()) {
+    m_state = m_model->initSystem();
+    for (const auto& body : m_model->getComponentList<Body>()) {
+        m_bodies.push_back(&body);
+    }
+    if (!path.empty()) {
+        m_file.open(path, std::ios::binary);
+        OPENSIM_THROW_IF(!m_file, Exception, "Could not write '" + path + "'.");
+        const std::string header = encodeHeader();
+        m_file.write(header.data(), header.size());
+        m_file.flush();
+    }
+    m_thread = std::thread([this] { run(); });
+}
+
+MocoFrameSink::~MocoFrameSink() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_pushed.notify_one();
+    m_thread.join();
+#ifndef _WIN32
+    if (m_socket >= 0) close(m_socket);
+#endif
+}
+
+void MocoFrameSink::setPeriod(double seconds) {
+    OPENSIM_THROW_IF(seconds < 0, Exception, "Expected a nonnegative period.");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_period = seconds;
+}
+
+void MocoFrameSink::setSocket(const std::string& host, int port) {
+#ifdef _WIN32
+    OPENSIM_THROW(Exception, "Sockets are not supported on Windows.");
+#endif
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_host = host;
+    m_port = port;
+}
+
+void MocoFrameSink::push(const MocoTrajectory& trajectory, int iteration) {
+    std::unique_ptr<MocoTrajectory> copy(new MocoTrajectory(trajectory));
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending = std::move(copy);
+        m_pendingIteration = iteration;
+    }
+    m_pushed.notify_one();
+}
+
+int MocoFrameSink::getNumRecorded() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_numRecorded;
+}
+
+void MocoFrameSink::run() {
+    using Clock = std::chrono::steady_clock;
+    auto lastRecord = Clock::now() - std::chrono::hours(1);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_pushed.wait(lock, [&] { return m_pending || m_done; });
+        if (!m_pending) break;
+        // Pushes during the wait replace the pending trajectory. The last
+        // trajectory is recorded without waiting.
+        m_pushed.wait_until(lock,
+                lastRecord + std::chrono::duration_cast<Clock::duration>(
+                                     std::chrono::duration<double>(m_period)),
+                [&] { return m_done; });
+        const std::unique_ptr<MocoTrajectory> trajectory =
+                std::move(m_pending);
+        const int iteration = m_pendingIteration;
+        lock.unlock();
+        try {
+            const std::string record = encodeRecord(*trajectory, iteration);
+            if (m_file.is_open()) {
+                m_file.write(record.data(), record.size());
+                m_file.flush();
+            }
+            send(record);
+        } catch (const std::exception& e) {
+            std::cerr << "MocoFrameSink: " << e.what() << std::endl;
+        }
+        lastRecord = Clock::now();
+        lock.lock();
+        ++m_numRecorded;
+    }
+}
+
+std::string MocoFrameSink::encodeHeader() const {
+    std::string text;
+    for (const auto* body : m_bodies) {
+        text += body->getAbsolutePathString() + "\n";
+    }
+    std::string bytes = "MOCOFRMS";
+    append<std::uint32_t>(bytes, 1);
+    append<std::uint32_t>(bytes, (std::uint32_t)m_bodies.size());
+    append<std::uint64_t>(bytes, text.size());
+    return bytes + text;
+}
+
+std::string MocoFrameSink::encodeRecord(
+        const MocoTrajectory& trajectory, int iteration) {
+    const std::vector<std::string> stateNames = trajectory.getStateNames();
+    std::vector<std::pair<const Coordinate*, int>> columns;
+    for (const auto& coordinate : m_model->getComponentList<Coordinate>()) {
+        const auto it = std::find(stateNames.begin(), stateNames.end(),
+                coordinate.getAbsolutePathString() + "/value");
+        if (it != stateNames.end()) {
+            columns.emplace_back(&coordinate, int(it - stateNames.begin()));
+        }
+    }
+
+    const SimTK::Vector time = trajectory.getTime();
+    const SimTK::Matrix& states = trajectory.getStatesTrajectory();
+    std::string bytes;
+    append<std::int32_t>(bytes, iteration);
+    append<std::uint32_t>(bytes, (std::uint32_t)time.size());
+    for (int itime = 0; itime < time.size(); ++itime) {
+        append<double>(bytes, time[itime]);
+    }
+    for (int itime = 0; itime < time.size(); ++itime) {
+        m_state.setTime(time[itime]);
+        for (const auto& column : columns) {
+            if (column.first->getLocked(m_state)) continue;
+            column.first->setValue(
+                    m_state, states(itime, column.second), false);
+        }
+        m_model->realizePosition(m_state);
+        for (const auto* body : m_bodies) {
+            const SimTK::Transform& transform =
+                    body->getTransformInGround(m_state);
+            const SimTK::Quaternion quaternion =
+                    transform.R().convertRotationToQuaternion();
+            for (int i = 0; i < 3; ++i) {
+                append<float>(bytes, (float)transform.p()[i]);
+            }
+            for (int i = 0; i < 4; ++i) {
+                append<float>(bytes, (float)quaternion[i]);
+            }
+        }
+    }
+    return bytes;
+}
+
+void MocoFrameSink::dropSocket(const std::string& reason) {
+#ifndef _WIN32
+    std::string host;
+    int port;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        host = m_host;
+        port = m_port;
+        m_host.clear();
+    }
+    std::cerr << "MocoFrameSink: " << reason << " " << host << ":" << port
+              << "; no longer sending frames to it." << std::endl;
+    if (m_socket >= 0) close(m_socket);
+    m_socket = -1;
+#endif
+}
+
+void MocoFrameSink::send(const std::string& bytes) {
+#ifndef _WIN32
+    std::string host;
+    int port;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        host = m_host;
+        port = m_port;
+    }
+    if (host.empty()) return;
+    if (m_socket < 0) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                    &addresses) == 0) {
+            for (addrinfo* a = addresses; a && m_socket < 0; a = a->ai_next) {
+                const int s =
+                        socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if (s < 0) continue;
+    #ifdef SO_NOSIGPIPE
+                const int on = 1;
+                setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    #endif
+                if (connect(s, a->ai_addr, a->ai_addrlen) == 0) {
+                    m_socket = s;
+                } else {
+                    close(s);
+                }
+            }
+            freeaddrinfo(addresses);
+        }
+        if (m_socket < 0) {
+            dropSocket("could not connect to");
+            return;
+        }
+        // Each connection starts with the header.
+        if (!sendAll(m_socket, encodeHeader())) {
+            dropSocket("lost the connection to");
+            return;
+        }
+    }
+    if (!sendAll(m_socket, bytes)) dropSocket("lost the connection to");
+#else
+    (void)bytes;
+#endif
+}
@@ -0,0 +1,114 @@
+#ifndef MOCOPAPER_MOCOFRAMESINK_H
+#define MOCOPAPER_MOCOFRAMESINK_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoFrameSink.h                                              *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <Moco/osimMoco.h>
+
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace OpenSim {
+
+/// Record the motion of trajectories (e.g., intermediate IPOPT iterates and
+/// the final solution) as frames of body poses, without a visualizer.
+///
+/// push() hands a trajectory to a background thread and returns
+/// immediately. The thread computes the pose of every body at each time
+/// point (on its own copy of the model, realized only to Position) and
+/// appends the frames to a file and, optionally, sends them to a TCP socket.
+/// Trajectories are recorded at most once per period; a trajectory pushed
+/// while the thread is busy or waiting replaces the pending one, so the
+/// caller is never held up and only the newest iterate is recorded. The
+/// last pushed trajectory is always recorded before the sink is destroyed.
+///
+/// To stream the iterates of a solve, pass push() to
+/// MocoCheckpoint::setIterateCallback().
+///
+/// Format (little-endian), read by code/frame_file.py:
+///   - 8 bytes: the magic string "MOCOFRMS".
+///   - uint32: format version (1); uint32: number of bodies.
+///   - uint64: size of the header text in bytes; header text: the absolute
+///     path of each body, one per line.
+///   - Records, one per recorded trajectory:
+///       - int32: the iteration (-1 for a final trajectory); uint32: number
+///         of time points.
+///       - float64 times[number of time points].
+///       - float32 poses[number of time points][number of bodies][7]: the
+///         position of the body origin in ground, followed by the body's
+///         orientation in ground as a quaternion (w, x, y, z).
+/// The socket receives the same bytes as the file.
+class MocoFrameSink {
+public:
+    /// The model is copied; it must have been finalized (e.g., processed by
+    /// a ModelProcessor or had initSystem() called). If `path` is empty,
+    /// frames are only sent to the socket.
+    MocoFrameSink(const Model& model, const std::string& path);
+    ~MocoFrameSink();
+    MocoFrameSink(const MocoFrameSink&) = delete;
+    MocoFrameSink& operator=(const MocoFrameSink&) = delete;
+
+    /// Record at most one trajectory per this many seconds (default: 1).
+    void setPeriod(double seconds);
+    /// Also send the frames to a TCP server (e.g., a viewer on a login
+    /// node). The connection is opened by the background thread; if it
+    /// fails or breaks, the socket is dropped and the file is still written.
+    /// Not supported on Windows.
+    void setSocket(const std::string& host, int port);
+
+    /// Record the trajectory (asynchronously). `iteration` is -1 for a final
+    /// trajectory. The trajectory's coordinate values are matched to the
+    /// model's coordinates by name.
+    void push(const MocoTrajectory& trajectory, int iteration = -1);
+
+    /// The number of trajectories recorded so far.
+    int getNumRecorded() const;
+
+private:
+    void run();
+    std::string encodeHeader() const;
+    std::string encodeRecord(
+            const MocoTrajectory& trajectory, int iteration);
+    /// Send to the socket, connecting first if necessary.
+    void send(const std::string& bytes);
+    void dropSocket(const std::string& reason);
+
+    std::unique_ptr<Model> m_model;
+    SimTK::State m_state;
+    std::vector<const Body*> m_bodies;
+    std::ofstream m_file;
+    std::string m_host;
+    int m_port = 0;
+    int m_socket = -1;
+    double m_period = 1;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_pushed;
+    std::unique_ptr<MocoTrajectory> m_pending;
+    int m_pendingIteration = -1;
+    int m_numRecorded = 0;
+    bool m_done = false;
+    std::thread m_thread;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_MOCOFRAMESINK_H
@@ -0,0 +1,129 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoMeshRefinement.cpp                                       *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "MocoMeshRefinement.h"
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+using namespace OpenSim;
+
+MocoMeshRefinement::MocoMeshRefinement(
+        std::function<MocoStudy(double)> createStudy,
+        std::vector<double> meshIntervals, double tolerance)
+        : m_createStudy(std::move(createStudy)), m_tolerance(tolerance) {
+    OPENSIM_THROW_IF(!m_createStudy, Exception,
+            "Expected a function that creates the study.");
+    if (!meshIntervals.empty()) setMeshIntervals(std::move(meshIntervals));
+}
+
+void MocoMeshRefinement::setMeshIntervals(std::vector<double> meshIntervals) {
+    for (int i = 0; i < (int)meshIntervals.size(); ++i) {
+        OPENSIM_THROW_IF(meshIntervals[i] <= 0, Exception,
+                "Expected positive mesh intervals.");
+        OPENSIM_THROW_IF(i > 0 && meshIntervals[i] >= meshIntervals[i - 1],
+                Exception, "Expected mesh intervals from coarse to fine.");
+    }
+    m_meshIntervals = std::move(meshIntervals);
+}
+
+MocoSolution MocoMeshRefinement::solve() {
+    OPENSIM_THROW_IF(m_meshIntervals.empty(), Exception,
+            "Expected at least one mesh interval.");
+    m_history.clear();
+    MocoTrajectory guess = m_guess;
+    bool hasGuess = m_hasGuess;
+    MocoSolution solution;
+    for (const auto& meshInterval : m_meshIntervals) {
+        std::cout << "MocoMeshRefinement: solving with mesh interval "
+                  << meshInterval << "." << std::endl;
+        MocoStudy study = m_createStudy(meshInterval);
+        if (hasGuess) { study.updSolver<MocoCasADiSolver>().setGuess(guess); }
+        solution = m_solveFunction ? m_solveFunction(study) : study.solve();
+        solution.unseal();
+
+        MocoMeshRefinementStep step;
+        step.mesh_interval = meshInterval;
+        step.objective = solution.getObjective();
+        step.num_iterations = solution.getNumIterations();
+        step.solver_duration = solution.getSolverDuration();
+        step.success = solution.success();
+        step.status = solution.getStatus();
+        if (m_stepFunction) m_stepFunction(step);
+        m_history.push_back(step);
+
+        guess = solution;
+        hasGuess = true;
+
+        if (m_tolerance > 0 && m_history.size() > 1) {
+            const auto& previous = m_history[m_history.size() - 2];
+            if (!step.success || !previous.success) {
+                std::cout << "MocoMeshRefinement: not comparing objectives, "
+                             "as a solve did not converge."
+                          << std::endl;
+                continue;
+            }
+            const double change = std::abs(step.objective - previous.objective)
+                                  / std::abs(previous.objective);
+            std::cout << "MocoMeshRefinement: relative change in objective: "
+                      << change << "." << std::endl;
+            if (change < m_tolerance) break;
+        }
+    }
+    return solution;
+}
+
+void MocoMeshRefinement::writeSolution(
+        const MocoSolution& solution, const std::string& path) const {
+    solution.write(path);
+    // Read the file back so that we keep the metadata that write() adds.
+    TimeSeriesTable table(path);
+    const auto join = [&](const std::function<std::string(
+                                  const MocoMeshRefinementStep&)>& get) {
+        std::stringstream ss;
+        for (int i = 0; i < (int)m_history.size(); ++i) {
+            if (i) ss << ",";
+            ss << get(m_history[i]);
+        }
+        return ss.str();
+    };
+    const auto str = [](double value) {
+        std::stringstream ss;
+        ss.precision(17);
+        ss << value;
+        return ss.str();
+    };
+    table.addTableMetaData<std::string>("mesh_refinement_mesh_interval",
+            join([&](const MocoMeshRefinementStep& s) {
+                return str(s.mesh_interval);
+            }));
+    table.addTableMetaData<std::string>("mesh_refinement_objective",
+            join([&](const MocoMeshRefinementStep& s) {
+                return str(s.objective);
+            }));
+    table.addTableMetaData<std::string>("mesh_refinement_num_iterations",
+            join([](const MocoMeshRefinementStep& s) {
+                return std::to_string(s.num_iterations);
+            }));
+    table.addTableMetaData<std::string>("mesh_refinement_solver_duration",
+            join([&](const MocoMeshRefinementStep& s) {
+                return str(s.solver_duration);
+            }));
+    table.addTableMetaData<std::string>("mesh_refinement_status",
+            join([](const MocoMeshRefinementStep& s) { return s.status; }));
+    STOFileAdapter::write(table, path);
+}
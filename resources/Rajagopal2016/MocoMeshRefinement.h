@@ -0,0 +1,113 @@
+#ifndef MOCOPAPER_MOCOMESHREFINEMENT_H
+#define MOCOPAPER_MOCOMESHREFINEMENT_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoMeshRefinement.h                                         *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <Moco/osimMoco.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace OpenSim {
+
+/// The result of solving on one mesh of a MocoMeshRefinement.
+struct MocoMeshRefinementStep {
+    double mesh_interval = 0;
+    double objective = SimTK::NaN;
+    int num_iterations = 0;
+    double solver_duration = 0;
+    bool success = false;
+    /// The solver's status (e.g., "Solve_Succeeded"), or how a solve
+    /// function that stops early ended (e.g., "settled" for a
+    /// MocoConvergenceMonitor).
+    std::string status;
+};
+
+/// Solve a problem on a sequence of increasingly fine meshes. The solution on
+/// each mesh is the initial guess for the next mesh (MocoCasADiSolver
+/// interpolates the guess onto the new mesh), and refinement stops early once
+/// the relative change in the objective between consecutive meshes is below
+/// the tolerance. Only the objectives of converged solves are compared:
+/// refinement continues after a solve that did not succeed (e.g., one that
+/// a MocoConvergenceMonitor stopped early). Coarse meshes are cheap to
+/// solve, and a guess from a coarser mesh usually needs far fewer iterations
+/// on the finer mesh than the default guess does.
+///
+/// The same approach is used by code/mesh_refinement.py.
+class MocoMeshRefinement {
+public:
+    /// createStudy(meshInterval) returns a MocoStudy, with a
+    /// MocoCasADiSolver, that uses the given mesh interval (e.g., from
+    /// MocoTrack::initialize() after MocoTrack::set_mesh_interval()).
+    explicit MocoMeshRefinement(
+            std::function<MocoStudy(double)> createStudy,
+            std::vector<double> meshIntervals = {}, double tolerance = 0);
+
+    /// Mesh intervals, from coarse to fine.
+    void setMeshIntervals(std::vector<double> meshIntervals);
+    /// Stop refining once the relative change in the objective is below this
+    /// value. If zero, solve on every mesh.
+    void setTolerance(double tolerance) { m_tolerance = tolerance; }
+    /// Guess for the coarsest mesh; by default, the study's guess is used.
+    void setGuess(MocoTrajectory guess) {
+        m_guess = std::move(guess);
+        m_hasGuess = true;
+    }
+
+    /// Solve each study with this function instead of MocoStudy::solve()
+    /// (e.g., to profile the solves with MocoSolveProfile::solve()).
+    void setSolveFunction(
+            std::function<MocoSolution(const MocoStudy&)> solveFunction) {
+        m_solveFunction = std::move(solveFunction);
+    }
+    /// Called with the step recorded for each solve (from the solution)
+    /// before it is added to the history, so that a solve function that
+    /// solves in several rounds can record its totals; for example, set
+    /// num_iterations, solver_duration and status from a
+    /// MocoConvergenceMonitor's report.
+    void setStepFunction(
+            std::function<void(MocoMeshRefinementStep&)> stepFunction) {
+        m_stepFunction = std::move(stepFunction);
+    }
+
+    /// Returns the solution on the finest mesh solved (unsealed), and
+    /// records the history of the solves.
+    MocoSolution solve();
+    const std::vector<MocoMeshRefinementStep>& getHistory() const {
+        return m_history;
+    }
+
+    /// Write the solution, adding the history to its metadata as
+    /// comma-separated lists (mesh_refinement_mesh_interval,
+    /// mesh_refinement_objective, mesh_refinement_status, etc.).
+    void writeSolution(const MocoSolution& solution,
+            const std::string& path) const;
+
+private:
+    std::function<MocoStudy(double)> m_createStudy;
+    std::function<MocoSolution(const MocoStudy&)> m_solveFunction;
+    std::function<void(MocoMeshRefinementStep&)> m_stepFunction;
+    std::vector<double> m_meshIntervals;
+    double m_tolerance;
+    MocoTrajectory m_guess;
+    bool m_hasGuess = false;
+    std::vector<MocoMeshRefinementStep> m_history;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_MOCOMESHREFINEMENT_H
@@ -0,0 +1,395 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoSolveProfile.cpp                                         *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "MocoSolveProfile.h"
+
+#include "NumaTopology.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+    #include <unistd.h>
+#endif
+
+using namespace OpenSim;
+
+namespace {
+
+// CasADi prints times with units (e.g., "12.30ms").
+double toSeconds(const std::string& value, const std::string& unit) {
+    const double number = std::stod(value);
+    if (unit == "ns") return 1e-9 * number;
+    if (unit == "us") return 1e-6 * number;
+    if (unit == "ms") return 1e-3 * number;
+    return number;
+}
+
+double parseNumber(const std::string& text) {
+    if (text == "-") return SimTK::NaN;
+    return std::stod(text);
+}
+
+std::string toJSON(double value) {
+    if (SimTK::isNaN(value) || SimTK::isInf(value)) return "null";
+    std::stringstream ss;
+    ss.precision(17);
+    ss << value;
+    return ss.str();
+}
+
+std::string quote(const std::string& text) { return "\"" + text + "\""; }
+
+#ifndef _WIN32
+// Tee the process's standard output: while the capture is active, output
+// is still printed as it is written (so IPOPT's progress stays visible),
+// and is also kept for parsing.
+class OutputCapture {
+public:
+    OutputCapture() {
+        int fds[2];
+        OPENSIM_THROW_IF(pipe(fds) != 0, Exception,
+                "Could not create a pipe to capture the solver output.");
+        std::cout.flush();
+        std::fflush(stdout);
+        m_savedFd = dup(STDOUT_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        const int readFd = fds[0];
+        const int savedFd = m_savedFd;
+        m_reader = std::thread([this, readFd, savedFd] {
+            char buffer[4096];
+            ssize_t size;
+            while ((size = read(readFd, buffer, sizeof(buffer))) > 0) {
+                ssize_t written = 0;
+                while (written < size) {
+                    const ssize_t n = write(
+                            savedFd, buffer + written, size - written);
+                    if (n <= 0) break;
+                    written += n;
+                }
+                m_output.append(buffer, size);
+            }
+            close(readFd);
+        });
+    }
+    /// Restore standard output and return the captured output.
+    std::string release() {
+        if (m_savedFd < 0) return {};
+        std::cout.flush();
+        std::fflush(stdout);
+        // Closing the pipe's last write end ends the reader.
+        dup2(m_savedFd, STDOUT_FILENO);
+        m_reader.join();
+        close(m_savedFd);
+        m_savedFd = -1;
+        return std::move(m_output);
+    }
+    ~OutputCapture() { release(); }
+
+private:
+    int m_savedFd = -1;
+    std::thread m_reader;
+    std::string m_output;
+};
+#endif
+
+} // anonymous namespace
+
+EvaluationCounter::EvaluationCounter()
+        : m_count(std::make_shared<std::atomic<long long>>(0)) {}
+
+MocoSolveProfile::MocoSolveProfile() {
+    Object::registerType(EvaluationCounter());
+}
+
+void MocoSolveProfile::addPhaseTime(const std::string& name, double seconds) {
+    for (auto& phase : m_phases) {
+        if (phase.first == name) {
+            phase.second += seconds;
+            return;
+        }
+    }
+    m_phases.emplace_back(name, seconds);
+}
+
+void MocoSolveProfile::setPlacement(const std::vector<int>& cpus) {
+    m_cpus = cpus;
+    const NumaTopology topology;
+    m_cpuNodes.clear();
+    for (const int cpu : cpus) m_cpuNodes.push_back(topology.getNodeOfCpu(cpu));
+}
+
+void MocoSolveProfile::addThreadPool(
+        const std::string& name, const WorkStealingPool& pool) {
+    ThreadPoolStats stats;
+    stats.num_threads = pool.getNumThreads();
+    stats.num_numa_nodes = pool.getNumNodes();
+    stats.num_stolen = pool.getNumStolen();
+    stats.num_stolen_across_nodes = pool.getNumStolenAcrossNodes();
+    m_threadPools.emplace_back(name, stats);
+}
+
+double MocoSolveProfile::getPhaseTime(const std::string& name) const {
+    for (const auto& phase : m_phases) {
+        if (phase.first == name) return phase.second;
+    }
+    return 0;
+}
+
+void MocoSolveProfile::addEvaluationCounter(Model& model) {
+    auto* counter = new EvaluationCounter();
+    counter->setName("evaluation_counter");
+    m_counter.reset(counter->clone());
+    model.addForce(counter);
+    model.finalizeConnections();
+    m_numMuscles = model.getMuscles().getSize();
+}
+
+MocoSolution MocoSolveProfile::solve(const MocoStudy& study) {
+    Solve record;
+    const long long initialCount = m_counter ? m_counter->getCount() : 0;
+    const auto start = std::chrono::steady_clock::now();
+    MocoSolution solution;
+#ifndef _WIN32
+    if (m_captureOutput) {
+        std::string output;
+        {
+            OutputCapture capture;
+            solution = study.solve();
+            output = capture.release();
+        }
+        parseSolverOutput(output, record);
+        record.output_captured = true;
+    } else {
+        solution = study.solve();
+    }
+#else
+    solution = study.solve();
+#endif
+    record.wall_time = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    // Hermite-Simpson transcription has a midpoint in each mesh interval.
+    const auto* solver =
+            dynamic_cast<const MocoCasADiSolver*>(&study.getSolver());
+    const bool hasMidpoints = solver && solver->get_transcription_scheme() ==
+                                                "hermite-simpson";
+    record.num_mesh_intervals = hasMidpoints
+                                        ? (solution.getNumTimes() - 1) / 2
+                                        : solution.getNumTimes() - 1;
+    if (m_counter) {
+        record.num_multibody_evaluations =
+                m_counter->getCount() - initialCount;
+    }
+    m_solves.push_back(std::move(record));
+    return solution;
+}
+
+std::vector<double> MocoSolveProfile::getIterationColumn(
+        int isolve, const std::string& column) const {
+    OPENSIM_THROW_IF(isolve < 0 || isolve >= (int)m_solves.size(), Exception,
+            "Solve index out of range.");
+    const Solve& solve = m_solves[isolve];
+    const auto it = std::find(solve.iteration_columns.begin(),
+            solve.iteration_columns.end(), column);
+    OPENSIM_THROW_IF(!solve.iteration_columns.empty() &&
+                             it == solve.iteration_columns.end(),
+            Exception, "Unknown iteration column '" + column + "'.");
+    std::vector<double> values;
+    const auto icol = it - solve.iteration_columns.begin();
+    for (const auto& row : solve.iterations) values.push_back(row[icol]);
+    return values;
+}
+
+void MocoSolveProfile::parseSolverOutput(
+        const std::string& output, Solve& solve) {
+    // An IPOPT iteration row, e.g.:
+    //   12r 1.2e+01 3.4e-02 5.6e-01  -1.0 7.8e-01    -  9.0e-01 1.0e+00f  1
+    // The "r" marks restoration-phase iterations, and the character after
+    // alpha_pr is the type of step.
+    static const std::string num = R"(([-+]?[\d.]+(?:[eE][-+]?\d+)?|-))";
+    static const std::regex iterationRow("^\\s*(\\d+)(r?)\\s+" + num +
+            "\\s+" + num + "\\s+" + num + "\\s+" + num + "\\s+" + num +
+            "\\s+" + num + "\\s+" + num + "\\s+" + num + "[a-zA-Z]?\\s+" +
+            "(\\d+)\\s*$");
+    // A row of CasADi's timing table, e.g.:
+    //   nlp_f  |  12.30ms ( 45.67us)  12.31ms ( 45.70us)       269
+    static const std::string duration = R"(([\d.]+)\s*([a-z]*s))";
+    static const std::regex callbackRow("^\\s*(\\w+)\\s*\\|\\s*" +
+            duration + "\\s*\\(\\s*" + duration + "\\)\\s*" + duration +
+            "\\s*\\(\\s*" + duration +
+            "\\)\\s*(\\d+)\\s*$");
+    static const std::regex ipoptTime(
+            R"(Total CPU secs in (IPOPT \(w/o function evaluations\)|NLP function evaluations)\s*=\s*([\d.]+))");
+
+    solve.iteration_columns = {"iteration", "restoration", "objective",
+            "inf_pr", "inf_du", "lg_mu", "d_norm", "lg_rg", "alpha_du",
+            "alpha_pr", "ls"};
+    std::istringstream stream(output);
+    std::string line;
+    std::smatch match;
+    while (std::getline(stream, line)) {
+        if (std::regex_match(line, match, iterationRow)) {
+            std::vector<double> row;
+            row.push_back(std::stod(match[1]));
+            row.push_back(match[2].length() ? 1 : 0);
+            for (int i = 3; i <= 10; ++i) {
+                row.push_back(parseNumber(match[i]));
+            }
+            row.push_back(std::stod(match[11]));
+            solve.iterations.push_back(row);
+        } else if (std::regex_match(line, match, callbackRow)) {
+            CallbackStats& stats = solve.callbacks[match[1]];
+            stats.proc_time = toSeconds(match[2], match[3]);
+            stats.wall_time = toSeconds(match[6], match[7]);
+            stats.num_evaluations = std::stoll(match[10]);
+        } else if (std::regex_search(line, match, ipoptTime)) {
+            const double seconds = std::stod(match[2]);
+            if (match[1].str().find("IPOPT") == 0) {
+                solve.ipopt_cpu_time_without_evaluations = seconds;
+            } else {
+                solve.ipopt_cpu_time_in_evaluations = seconds;
+            }
+        }
+    }
+}
+
+void MocoSolveProfile::writeJSON(const std::string& path) const {
+    std::ofstream json(path);
+    OPENSIM_THROW_IF(!json, Exception, "Could not write '" + path + "'.");
+    json << "{\n  \"phases\": {";
+    for (int i = 0; i < (int)m_phases.size(); ++i) {
+        json << (i ? "," : "") << "\n    " << quote(m_phases[i].first)
+             << ": " << toJSON(m_phases[i].second);
+    }
+    json << "\n  },\n  \"num_muscles\": " << m_numMuscles;
+    json << ",\n  \"placement\": {\"cpus\": [";
+    for (int i = 0; i < (int)m_cpus.size(); ++i) {
+        json << (i ? ", " : "") << m_cpus[i];
+    }
+    json << "], \"numa_nodes\": [";
+    for (int i = 0; i < (int)m_cpuNodes.size(); ++i) {
+        json << (i ? ", " : "") << m_cpuNodes[i];
+    }
+    json << "]}";
+    json << ",\n  \"thread_pools\": {";
+    for (int i = 0; i < (int)m_threadPools.size(); ++i) {
+        const ThreadPoolStats& stats = m_threadPools[i].second;
+        json << (i ? "," : "") << "\n    " << quote(m_threadPools[i].first)
+             << ": {\"num_threads\": " << stats.num_threads
+             << ", \"num_numa_nodes\": " << stats.num_numa_nodes
+             << ", \"num_stolen\": " << stats.num_stolen
+             << ", \"num_stolen_across_nodes\": "
+             << stats.num_stolen_across_nodes << "}";
+    }
+    json << (m_threadPools.empty() ? "}" : "\n  }");
+    json << ",\n  \"solves\": [";
+    for (int isolve = 0; isolve < (int)m_solves.size(); ++isolve) {
+        const Solve& solve = m_solves[isolve];
+        json << (isolve ? "," : "") << "\n    {";
+        json << "\n      \"num_mesh_intervals\": " << solve.num_mesh_intervals;
+        json << ",\n      \"wall_time\": " << toJSON(solve.wall_time);
+        json << ",\n      \"output_captured\": "
+             << (solve.output_captured ? "true" : "false");
+
+        // The CasADi "total" row is the time within the NLP solver.
+        const auto total = solve.callbacks.find("total");
+        const double solverTime = total == solve.callbacks.end()
+                                          ? SimTK::NaN
+                                          : total->second.wall_time;
+        json << ",\n      \"construction_time\": "
+             << toJSON(solve.wall_time - solverTime);
+        json << ",\n      \"nlp_solver_time\": " << toJSON(solverTime);
+        json << ",\n      \"ipopt_cpu_time_without_evaluations\": "
+             << toJSON(solve.ipopt_cpu_time_without_evaluations);
+        json << ",\n      \"ipopt_cpu_time_in_evaluations\": "
+             << toJSON(solve.ipopt_cpu_time_in_evaluations);
+
+        // Wall time in the callbacks, grouped by kind.
+        const std::vector<std::pair<std::string, std::vector<std::string>>>
+                groups = {{"objective", {"nlp_f"}},
+                        {"constraints", {"nlp_g"}},
+                        {"jacobian", {"nlp_grad_f", "nlp_jac_g", "nlp_grad"}},
+                        {"hessian", {"nlp_hess_l"}}};
+        json << ",\n      \"callback_time\": {";
+        for (int ig = 0; ig < (int)groups.size(); ++ig) {
+            double seconds = 0;
+            for (const auto& name : groups[ig].second) {
+                const auto it = solve.callbacks.find(name);
+                if (it != solve.callbacks.end()) {
+                    seconds += it->second.wall_time;
+                }
+            }
+            json << (ig ? ", " : "") << quote(groups[ig].first) << ": "
+                 << toJSON(solve.callbacks.empty() ? SimTK::NaN : seconds);
+        }
+        json << "}";
+
+        json << ",\n      \"callbacks\": {";
+        bool first = true;
+        for (const auto& callback : solve.callbacks) {
+            json << (first ? "" : ",") << "\n        "
+                 << quote(callback.first) << ": {\"proc_time\": "
+                 << toJSON(callback.second.proc_time)
+                 << ", \"wall_time\": " << toJSON(callback.second.wall_time)
+                 << ", \"num_evaluations\": "
+                 << callback.second.num_evaluations << "}";
+            first = false;
+        }
+        json << "\n      }";
+
+        // The muscles are evaluated along with each multibody dynamics
+        // evaluation.
+        const long long numEvals = solve.num_multibody_evaluations;
+        const bool counted = numEvals >= 0;
+        json << ",\n      \"num_multibody_evaluations\": "
+             << (counted ? std::to_string(numEvals) : "null");
+        json << ",\n      \"num_muscle_evaluations\": "
+             << (counted ? std::to_string(numEvals * m_numMuscles) : "null");
+
+        json << ",\n      \"iteration_columns\": [";
+        for (int i = 0; i < (int)solve.iteration_columns.size(); ++i) {
+            json << (i ? ", " : "") << quote(solve.iteration_columns[i]);
+        }
+        json << "],\n      \"iterations\": [";
+        for (int irow = 0; irow < (int)solve.iterations.size(); ++irow) {
+            json << (irow ? "," : "") << "\n        [";
+            const auto& row = solve.iterations[irow];
+            for (int i = 0; i < (int)row.size(); ++i) {
+                json << (i ? ", " : "") << toJSON(row[i]);
+            }
+            json << "]";
+        }
+        json << "\n      ]\n    }";
+    }
+    json << "\n  ]\n}\n";
+}
+
+std::string MocoSolveProfile::createProfilePath(
+        const std::string& solutionPath) {
+    const auto dot = solutionPath.find_last_of('.');
+    const auto slash = solutionPath.find_last_of("/\\");
+    const bool hasExtension = dot != std::string::npos &&
+                              (slash == std::string::npos || dot > slash);
+    return (hasExtension ? solutionPath.substr(0, dot) : solutionPath) +
+           "_profile.json";
+}
@@ -0,0 +1,178 @@
+#ifndef MOCOPAPER_MOCOSOLVEPROFILE_H
+#define MOCOPAPER_MOCOSOLVEPROFILE_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoSolveProfile.h                                           *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "WorkStealingPool.h"
+
+#include <Moco/osimMoco.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace OpenSim {
+
+/// A Force that applies no force and counts how many times it is asked for
+/// its force, which happens once per evaluation of the multibody dynamics
+/// (including evaluations for finite differences). Copies of the counter (for
+/// example, the per-thread model copies made by MocoCasADiSolver) share the
+/// same count. Use MocoSolveProfile::addEvaluationCounter().
+class EvaluationCounter : public Force {
+    OpenSim_DECLARE_CONCRETE_OBJECT(EvaluationCounter, Force);
+
+public:
+    EvaluationCounter();
+    long long getCount() const { return *m_count; }
+    void computeForce(const SimTK::State&,
+            SimTK::Vector_<SimTK::SpatialVec>&,
+            SimTK::Vector&) const override {
+        ++*m_count;
+    }
+
+private:
+    std::shared_ptr<std::atomic<long long>> m_count;
+};
+
+/// A profile of the time spent in each phase of creating and solving a
+/// problem with MocoCasADiSolver, written as JSON next to the solution.
+///
+/// Phases outside of MocoStudy::solve() (model processing, reference loading,
+/// MocoTrack::initialize(), etc.) are timed with time(). For solve(), the
+/// profile parses the output of CasADi and IPOPT:
+///   - each IPOPT iteration row (objective, infeasibilities, step sizes,
+///     etc.);
+///   - IPOPT's CPU time with and without the NLP function evaluations;
+///   - CasADi's table of wall time and evaluation counts for the objective
+///     (nlp_f), constraint (nlp_g), gradient and Jacobian (nlp_grad_f,
+///     nlp_jac_g) and Hessian (nlp_hess_l) callbacks.
+/// The time spent in solve() before IPOPT starts (constructing the CasADi
+/// functions, detecting sparsity patterns, etc.) is the solve's wall time
+/// minus CasADi's total wall time for the solver.
+///
+/// To parse the solver output, solve() tees the process's standard output
+/// through a pipe while solving: the output is printed as it is written and
+/// also kept for parsing. Disable this with setCaptureSolverOutput(false) if
+/// other threads write to standard output at the same time (other solves, in
+/// particular); the profile then contains only the phase times and
+/// evaluation counts.
+class MocoSolveProfile {
+public:
+    MocoSolveProfile();
+
+    /// Call f() and add its wall time to the named phase.
+    template <typename F>
+    auto time(const std::string& name, F&& f) -> decltype(f()) {
+        const Timer timer(*this, name);
+        return f();
+    }
+    void addPhaseTime(const std::string& name, double seconds);
+    double getPhaseTime(const std::string& name) const;
+
+    /// Add an EvaluationCounter to the model (before the model is given to
+    /// the study) so that the profile can report the number of multibody and
+    /// muscle dynamics evaluations. The model is finalized.
+    void addEvaluationCounter(Model& model);
+
+    void setCaptureSolverOutput(bool capture) { m_captureOutput = capture; }
+
+    /// Record the CPUs that the solves were pinned to, and their NUMA nodes
+    /// (see MocoTrackBatch::setPinToNumaNodes()). A solve whose CPUs span
+    /// nodes accesses its model copies and workspace across nodes.
+    void setPlacement(const std::vector<int>& cpus);
+    /// Record the statistics of a thread pool (e.g., a
+    /// TrajectoryDynamicsEvaluator's), including the tasks run on another
+    /// NUMA node than the one their data was assigned to. Call this after the
+    /// pool's work is done.
+    void addThreadPool(const std::string& name, const WorkStealingPool& pool);
+
+    /// Solve the study, adding the solve's timings, callback statistics and
+    /// iterations to the profile. A profile may record multiple solves (e.g.,
+    /// from MocoMeshRefinement).
+    MocoSolution solve(const MocoStudy& study);
+    int getNumSolves() const { return (int)m_solves.size(); }
+    /// The values of an IPOPT iteration column (e.g., "inf_pr" or
+    /// "alpha_pr") in the given solve; empty if the solver output was not
+    /// captured. Entries that IPOPT prints as "-" are NaN.
+    std::vector<double> getIterationColumn(
+            int isolve, const std::string& column) const;
+
+    /// Write the profile as JSON.
+    void writeJSON(const std::string& path) const;
+    /// The path of the profile for a solution file: <solution>_profile.json.
+    static std::string createProfilePath(const std::string& solutionPath);
+
+private:
+    class Timer {
+    public:
+        Timer(MocoSolveProfile& profile, std::string name)
+                : m_profile(profile), m_name(std::move(name)),
+                  m_start(std::chrono::steady_clock::now()) {}
+        ~Timer() {
+            m_profile.addPhaseTime(m_name,
+                    std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - m_start)
+                            .count());
+        }
+
+    private:
+        MocoSolveProfile& m_profile;
+        std::string m_name;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    struct CallbackStats {
+        double proc_time = 0;
+        double wall_time = 0;
+        long long num_evaluations = 0;
+    };
+    struct Solve {
+        int num_mesh_intervals = 0;
+        double wall_time = 0;
+        bool output_captured = false;
+        double ipopt_cpu_time_without_evaluations = SimTK::NaN;
+        double ipopt_cpu_time_in_evaluations = SimTK::NaN;
+        std::map<std::string, CallbackStats> callbacks;
+        std::vector<std::string> iteration_columns;
+        std::vector<std::vector<double>> iterations;
+        long long num_multibody_evaluations = -1;
+    };
+    static void parseSolverOutput(const std::string& output, Solve& solve);
+
+    struct ThreadPoolStats {
+        int num_threads = 0;
+        int num_numa_nodes = 0;
+        long long num_stolen = 0;
+        long long num_stolen_across_nodes = 0;
+    };
+
+    std::vector<std::pair<std::string, double>> m_phases;
+    std::vector<int> m_cpus;
+    std::vector<int> m_cpuNodes;
+    std::vector<std::pair<std::string, ThreadPoolStats>> m_threadPools;
+    std::vector<Solve> m_solves;
+    bool m_captureOutput = true;
+    std::unique_ptr<EvaluationCounter> m_counter;
+    int m_numMuscles = 0;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_MOCOSOLVEPROFILE_H
@@ -0,0 +1,175 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoTopologyCache.cpp                                        *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "MocoTopologyCache.h"
+
+#include "BinaryTrajectory.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+using namespace OpenSim;
+
+namespace {
+
+/// 64-bit FNV-1a, as in ModelProcessorCache.
+std::uint64_t hashBytes(const std::string& bytes, std::uint64_t hash) {
+    for (const unsigned char c : bytes) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::map<std::string, std::string> readSettings(const std::string& path) {
+    std::map<std::string, std::string> settings;
+    std::ifstream stream(path);
+    std::string line;
+    while (std::getline(stream, line)) {
+        const auto equals = line.find('=');
+        if (equals == std::string::npos) continue;
+        settings[line.substr(0, equals)] = line.substr(equals + 1);
+    }
+    return settings;
+}
+
+} // anonymous namespace
+
+MocoTopologyCache::MocoTopologyCache(std::string cacheDir)
+        : m_cacheDir(std::move(cacheDir)) {
+    OPENSIM_THROW_IF(m_cacheDir.empty(), Exception,
+            "Expected a cache directory.");
+    if (m_cacheDir.back() != '/') m_cacheDir += '/';
+    IO::makeDir(m_cacheDir);
+}
+
+std::string MocoTopologyCache::calcKey(const MocoStudy& study) {
+    const MocoProblem& problem = study.getProblem();
+    const MocoProblemRep rep = problem.createRep();
+    const Model& model = rep.getModelBase();
+
+    // Describe the structure, leaving out all property values other than
+    // names and connections.
+    std::stringstream ss;
+    for (const auto& component : model.getComponentList()) {
+        ss << component.getConcreteClassName() << " "
+           << component.getAbsolutePathString() << "\n";
+        for (const auto& name : component.getSocketNames()) {
+            const AbstractSocket& socket = component.getSocket(name);
+            for (int i = 0; i < (int)socket.getNumConnectees(); ++i) {
+                ss << " " << name << " " << socket.getConnecteePath(i)
+                   << "\n";
+            }
+        }
+    }
+    const auto stateNames = model.getStateVariableNames();
+    ss << "states\n";
+    for (int i = 0; i < stateNames.getSize(); ++i) {
+        ss << stateNames[i] << "\n";
+    }
+    ss << "controls\n";
+    for (const auto& name : createControlNamesFromModel(model)) {
+        ss << name << "\n";
+    }
+    const MocoPhase& phase = problem.getPhase(0);
+    for (int i = 0; i < phase.getProperty_goals().size(); ++i) {
+        ss << "goal " << phase.get_goals(i).getConcreteClassName() << " "
+           << phase.get_goals(i).getName() << "\n";
+    }
+    for (int i = 0; i < phase.getProperty_path_constraints().size(); ++i) {
+        ss << "path_constraint "
+           << phase.get_path_constraints(i).getConcreteClassName() << " "
+           << phase.get_path_constraints(i).getName() << "\n";
+    }
+    for (int i = 0; i < phase.getProperty_parameters().size(); ++i) {
+        ss << "parameter " << phase.get_parameters(i).getName() << "\n";
+    }
+
+    std::stringstream key;
+    key << std::hex << std::setw(16) << std::setfill('0')
+        << hashBytes(ss.str(), 14695981039346656037ull);
+    return key.str();
+}
+
+std::string MocoTopologyCache::getDirectory(const std::string& key) const {
+    const std::string directory = m_cacheDir + key + "/";
+    IO::makeDir(directory);
+    return directory;
+}
+
+bool MocoTopologyCache::hasSolution(const std::string& key) const {
+    return std::ifstream(m_cacheDir + key + "/solution.trj").good();
+}
+
+MocoTrajectory MocoTopologyCache::readSolution(const std::string& key) const {
+    OPENSIM_THROW_IF(!hasSolution(key), Exception,
+            "No solution is stored for topology " + key + ".");
+    return BinaryTrajectory(m_cacheDir + key + "/solution.trj")
+            .exportToMocoTrajectory();
+}
+
+void MocoTopologyCache::writeSolution(
+        const std::string& key, const MocoTrajectory& solution) const {
+    const std::string path = getDirectory(key) + "solution.trj";
+    const std::string tempPath = path + ".tmp";
+    BinaryTrajectory::write(tempPath, solution);
+    std::rename(tempPath.c_str(), path.c_str());
+}
+
+MocoTrajectory MocoTopologyCache::createGuess(const std::string& key,
+        double initialTime, double finalTime) const {
+    MocoTrajectory guess = readSolution(key);
+    const SimTK::Vector time = guess.getTime();
+    const double start = time[0];
+    const double duration = time[time.size() - 1] - start;
+    SimTK::Vector mapped(time.size());
+    for (int i = 0; i < time.size(); ++i) {
+        mapped[i] = initialTime +
+                    (time[i] - start) / duration * (finalTime - initialTime);
+    }
+    guess.setTime(mapped);
+    return guess;
+}
+
+std::string MocoTopologyCache::getSetting(const std::string& key,
+        const std::string& name, const std::string& defaultValue) const {
+    const auto settings = readSettings(m_cacheDir + key + "/settings.txt");
+    const auto it = settings.find(name);
+    return it == settings.end() ? defaultValue : it->second;
+}
+
+void MocoTopologyCache::setSetting(const std::string& key,
+        const std::string& name, const std::string& value) const {
+    OPENSIM_THROW_IF(name.find('=') != std::string::npos ||
+                             name.find('\n') != std::string::npos ||
+                             value.find('\n') != std::string::npos,
+            Exception, "Setting names and values must be single lines.");
+    const std::string path = getDirectory(key) + "settings.txt";
+    auto settings = readSettings(path);
+    settings[name] = value;
+    const std::string tempPath = path + ".tmp";
+    {
+        std::ofstream stream(tempPath);
+        for (const auto& setting : settings) {
+            stream << setting.first << "=" << setting.second << "\n";
+        }
+    }
+    std::rename(tempPath.c_str(), path.c_str());
+}
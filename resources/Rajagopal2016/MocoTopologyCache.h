@@ -0,0 +1,91 @@
+#ifndef MOCOPAPER_MOCOTOPOLOGYCACHE_H
+#define MOCOPAPER_MOCOTOPOLOGYCACHE_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoTopologyCache.h                                          *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <Moco/osimMoco.h>
+
+#include <string>
+
+namespace OpenSim {
+
+/// A disk cache of artifacts shared by problems with the same topology, such
+/// as the same MocoTrack problem solved for many subjects.
+///
+/// This caches initial guesses and settings, not results: a problem found in
+/// the cache is still solved, but from a different starting point, so it may
+/// converge in fewer iterations and to a (slightly) different local optimum
+/// than it would without the cache. Use it only where results need not be
+/// reproducible from run to run; it is off unless set (e.g.,
+/// MocoTrackBatch::setTopologyCache()).
+///
+/// The key (calcKey()) is a hash of the problem's structure without its
+/// parameter values: the class, path and socket connections of every
+/// component of the model, the model's state variable and control names, and
+/// the class and name of every goal, path constraint and parameter of the
+/// problem. Subjects whose models differ only in property values (e.g.,
+/// segment masses, muscle parameters, external loads data) share a key, but
+/// adding or replacing a component, goal or constraint produces a new key.
+/// Solver settings (mesh, transcription, multibody dynamics mode) are not
+/// part of the key.
+///
+/// Each key has a directory <cache_dir>/<key>/ that holds:
+///   - solution.trj: the latest successful solution for the topology (see
+///     BinaryTrajectory), used as the initial guess for the next subject.
+///     A solution from another subject of the same topology has the same
+///     states and controls and is usually far closer to the optimum than the
+///     default guess.
+///   - settings.txt: `name=value` lines with settings chosen for the
+///     topology (e.g., by a probe solve), so that later runs need not
+///     repeat the choice.
+///
+/// Files are replaced atomically (by renaming), so concurrent processes may
+/// share a cache directory.
+class MocoTopologyCache {
+public:
+    explicit MocoTopologyCache(std::string cacheDir);
+
+    /// The topology key of the study's problem. This creates the problem's
+    /// MocoProblemRep, which initializes the model.
+    static std::string calcKey(const MocoStudy& study);
+
+    /// The directory for the key's artifacts, created if necessary.
+    std::string getDirectory(const std::string& key) const;
+
+    bool hasSolution(const std::string& key) const;
+    MocoTrajectory readSolution(const std::string& key) const;
+    void writeSolution(
+            const std::string& key, const MocoTrajectory& solution) const;
+
+    /// The stored solution, with its time mapped linearly onto
+    /// [initialTime, finalTime], for use with MocoCasADiSolver::setGuess();
+    /// the solver interpolates the guess onto its mesh.
+    MocoTrajectory createGuess(const std::string& key, double initialTime,
+            double finalTime) const;
+
+    /// The setting's value, or `defaultValue` if the setting was not stored.
+    std::string getSetting(const std::string& key, const std::string& name,
+            const std::string& defaultValue = "") const;
+    void setSetting(const std::string& key, const std::string& name,
+            const std::string& value) const;
+
+private:
+    std::string m_cacheDir;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_MOCOTOPOLOGYCACHE_H
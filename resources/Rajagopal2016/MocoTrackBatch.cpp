@@ -0,0 +1,419 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoTrackBatch.cpp                                           *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "MocoTrackBatch.h"
+
+#include "MocoSolveProfile.h"
+#include "NumaTopology.h"
+#include "TRCMarkerReader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
+using namespace OpenSim;
+
+int MocoTrackJob::getNumMeshIntervals() const {
+    OPENSIM_THROW_IF(mesh_interval <= 0, Exception,
+            "Expected a positive mesh interval for job '" + name + "'.");
+    return (int)std::ceil((final_time - initial_time) / mesh_interval);
+}
+
+double OpenSim::estimateSolveMemory(int numStates, int numControls,
+        int numMeshIntervals, int numThreads, bool finiteDifferenceHessian) {
+    // Hermite-Simpson has variables at the mesh points and the midpoints.
+    const double numPoints = 2.0 * numMeshIntervals + 1;
+    const double numVariablesPerPoint = numStates + numControls;
+    // Each defect depends on the variables of the three points of its mesh
+    // interval; assume the blocks are dense.
+    const double jacobianNonzeros =
+            numPoints * numStates * 3 * numVariablesPerPoint;
+    // The Hessian couples the variables within each point.
+    const double hessianNonzeros =
+            finiteDifferenceHessian
+                    ? numPoints * numVariablesPerPoint * numVariablesPerPoint
+                    : 0;
+    // Fill-in of the sparse factorization, and bytes per stored nonzero
+    // (value and indices).
+    const double fill = 10;
+    const double bytesPerNonzero = 16;
+    const double factorization =
+            fill * bytesPerNonzero * (jacobianNonzeros + hessianNonzeros);
+    // IPOPT stores 6 pairs of vectors for the limited-memory approximation.
+    const double limitedMemory =
+            finiteDifferenceHessian
+                    ? 0
+                    : 2 * 6 * 8 * numPoints * numVariablesPerPoint;
+    // A copy of the model (and its SimTK::State) per thread, and the rest of
+    // the process.
+    const double perThread = 50e6;
+    const double base = 200e6;
+    return base + numThreads * perThread + factorization + limitedMemory;
+}
+
+MocoTrackBatch::MocoTrackBatch(int numThreads)
+        : m_numThreads(numThreads),
+          m_dataStore(std::make_shared<ReferenceDataStore>()),
+          m_referenceCache(m_dataStore->getStatesReferenceCache()) {
+    if (m_numThreads <= 0) {
+        m_numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+void MocoTrackBatch::addJob(MocoTrackJob job) {
+    OPENSIM_THROW_IF(job.name.empty(), Exception, "Expected a job name.");
+    for (const auto& existing : m_jobs) {
+        OPENSIM_THROW_IF(existing.name == job.name, Exception,
+                "A job named '" + job.name + "' already exists.");
+    }
+    OPENSIM_THROW_IF(!job.states_reference && job.markers_trc_file.empty(),
+            Exception,
+            "Job '" + job.name + "' has neither a states reference nor "
+            "a markers reference.");
+    // Check the mesh now rather than inside a worker thread.
+    job.getNumMeshIntervals();
+    double previous = SimTK::Infinity;
+    for (const auto& meshInterval : job.coarse_mesh_intervals) {
+        OPENSIM_THROW_IF(meshInterval >= previous ||
+                                 meshInterval <= job.mesh_interval,
+                Exception,
+                "Expected the coarse mesh intervals of job '" + job.name +
+                        "' to decrease and to exceed the mesh interval.");
+        previous = meshInterval;
+    }
+    m_jobs.push_back(std::move(job));
+}
+
+std::vector<int> MocoTrackBatch::calcThreadAllocation() const {
+    std::vector<double> costs;
+    for (const auto& job : m_jobs) {
+        costs.push_back(job.cost > 0 ? job.cost : job.getNumMeshIntervals());
+    }
+    const double totalCost = std::accumulate(costs.begin(), costs.end(), 0.0);
+    std::vector<int> allocation;
+    for (const auto& cost : costs) {
+        const int share = (int)std::floor(m_numThreads * cost / totalCost);
+        allocation.push_back(std::max(1, std::min(m_numThreads, share)));
+    }
+    return allocation;
+}
+
+std::vector<MocoTrackJob> MocoTrackBatch::createBudgetedJobs(
+        const std::vector<int>& allocation) const {
+    std::vector<MocoTrackJob> jobs = m_jobs;
+    if (m_memoryLimit <= 0) return jobs;
+    for (int ijob = 0; ijob < (int)jobs.size(); ++ijob) {
+        auto& job = jobs[ijob];
+        if (job.memory_budget > 0) continue;
+        // The problem dimensions come from the processed model; with a model
+        // cache, solveJob() does not process the model again.
+        Model model = m_modelCache ? m_modelCache->process(job.model)
+                                   : job.model.process();
+        if (!job.external_loads_file.empty()) {
+            m_dataStore->addExternalLoads(model, job.external_loads_file);
+        }
+        model.initSystem();
+        const auto estimate = [&](bool finiteDifferenceHessian) {
+            return estimateSolveMemory(model.getNumStateVariables(),
+                    model.getNumControls(), job.getNumMeshIntervals(),
+                    allocation[ijob], finiteDifferenceHessian);
+        };
+        job.memory_budget = estimate(job.finite_difference_hessian);
+        if (job.finite_difference_hessian &&
+                job.memory_budget > m_memoryLimit &&
+                estimate(false) <= m_memoryLimit) {
+            std::cout << "MocoTrackBatch: using the limited-memory Hessian "
+                         "approximation for job '"
+                      << job.name << "' to stay within the memory limit."
+                      << std::endl;
+            job.finite_difference_hessian = false;
+            job.memory_budget = estimate(false);
+        }
+        std::cout << "MocoTrackBatch: estimated memory for job '" << job.name
+                  << "': " << job.memory_budget / 1e9 << " GB." << std::endl;
+    }
+    return jobs;
+}
+
+namespace {
+/// Take numCpus CPUs from the free CPUs of each NUMA node, starting with the
+/// node with the most free CPUs and spilling to the next, so that a job
+/// spans as few nodes as possible. Returns no CPUs (the job runs unpinned)
+/// if fewer than numCpus are free.
+std::vector<int> takeCpus(
+        std::vector<std::vector<int>>& freeCpus, int numCpus) {
+    std::vector<int> nodes(freeCpus.size());
+    std::iota(nodes.begin(), nodes.end(), 0);
+    std::stable_sort(nodes.begin(), nodes.end(), [&](int a, int b) {
+        return freeCpus[a].size() > freeCpus[b].size();
+    });
+    int numFree = 0;
+    for (const auto& cpus : freeCpus) numFree += (int)cpus.size();
+    std::vector<int> cpus;
+    if (numFree < numCpus) return cpus;
+    for (const int node : nodes) {
+        auto& free = freeCpus[node];
+        while (!free.empty() && (int)cpus.size() < numCpus) {
+            cpus.push_back(free.back());
+            free.pop_back();
+        }
+    }
+    return cpus;
+}
+/// MocoCasADiSolver's `parallel` setting for a number of threads: 0 runs
+/// serially, 1 uses all hardware threads, and N > 1 uses N threads.
+int calcParallelSetting(int numThreads) {
+    return numThreads == 1 ? 0 : numThreads;
+}
+
+} // anonymous namespace
+
+std::vector<MocoTrackBatchResult> MocoTrackBatch::solve() const {
+    if (std::getenv("OPENSIM_MOCO_PARALLEL")) {
+        std::cout << "Warning: OPENSIM_MOCO_PARALLEL is set but is ignored "
+                     "by the jobs of MocoTrackBatch, which set "
+                     "MocoCasADiSolver's 'parallel' setting."
+                  << std::endl;
+    }
+
+    const std::vector<int> allocation = calcThreadAllocation();
+    const std::vector<MocoTrackJob> jobs = createBudgetedJobs(allocation);
+
+    // Start the most costly jobs first so that they do not end up as the
+    // last jobs running.
+    std::vector<int> order(m_jobs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return allocation[a] > allocation[b];
+    });
+
+    std::vector<MocoTrackBatchResult> results(jobs.size());
+    std::mutex mutex;
+    std::condition_variable threadsReleased;
+    int numFreeThreads = m_numThreads;
+    double usedMemory = 0;
+    int numRunningJobs = 0;
+    const NumaTopology topology;
+    std::vector<std::vector<int>> freeCpus;
+    if (m_pinToNumaNodes) {
+        for (int node = 0; node < topology.getNumNodes(); ++node) {
+            freeCpus.push_back(topology.getCpus(node));
+        }
+    }
+
+    // Whether a job fits within the free threads and memory. A job whose
+    // budget exceeds the memory limit waits until it can run alone.
+    const auto fits = [&](int ijob) {
+        return numFreeThreads >= allocation[ijob] &&
+               (m_memoryLimit <= 0 || numRunningJobs == 0 ||
+                       usedMemory + jobs[ijob].memory_budget <=
+                               m_memoryLimit);
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<int> waiting = order;
+    while (!waiting.empty()) {
+        int ijob = -1;
+        std::vector<int> cpus;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            // Start the most costly job that fits, so that a job waiting
+            // for threads does not hold up smaller jobs behind it.
+            std::vector<int>::iterator next;
+            threadsReleased.wait(lock, [&] {
+                next = std::find_if(waiting.begin(), waiting.end(), fits);
+                return next != waiting.end();
+            });
+            ijob = *next;
+            waiting.erase(next);
+            numFreeThreads -= allocation[ijob];
+            usedMemory += jobs[ijob].memory_budget;
+            ++numRunningJobs;
+            if (m_pinToNumaNodes) cpus = takeCpus(freeCpus, allocation[ijob]);
+            std::cout << "MocoTrackBatch: starting job '" << jobs[ijob].name
+                      << "' with " << allocation[ijob] << " thread(s)";
+            if (!cpus.empty()) {
+                std::cout << " on " << cpus.size() << " CPU(s) of NUMA node "
+                          << topology.getNodeOfCpu(cpus.front());
+            }
+            std::cout << "." << std::endl;
+        }
+        const int numThreads = allocation[ijob];
+        const double memory = jobs[ijob].memory_budget;
+        workers.emplace_back([&, ijob, numThreads, memory, cpus] {
+            // Threads created by this thread (MocoCasADiSolver's) inherit
+            // its CPUs.
+            if (!cpus.empty()) NumaTopology::pinCurrentThread(cpus);
+            results[ijob] = solveJob(jobs[ijob], numThreads, cpus);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (const int cpu : cpus) {
+                    freeCpus[topology.getNodeOfCpu(cpu)].push_back(cpu);
+                }
+                numFreeThreads += numThreads;
+                usedMemory -= memory;
+                --numRunningJobs;
+                std::cout << "MocoTrackBatch: finished job '"
+                          << results[ijob].name << "' in "
+                          << results[ijob].duration << " seconds ("
+                          << results[ijob].message << ")." << std::endl;
+            }
+            threadsReleased.notify_all();
+        });
+    }
+    for (auto& worker : workers) { worker.join(); }
+    return results;
+}
+
+MocoTrackBatchResult MocoTrackBatch::solveJob(const MocoTrackJob& job,
+        int numThreads, const std::vector<int>& cpus) const {
+    MocoTrackBatchResult result;
+    result.name = job.name;
+    result.num_threads = numThreads;
+    result.cpus = cpus;
+    const auto start = std::chrono::steady_clock::now();
+    try {
+        MocoSolveProfile profile;
+        // Other jobs write to standard output at the same time.
+        profile.setCaptureSolverOutput(m_jobs.size() == 1);
+        profile.setPlacement(cpus);
+
+        // Process the model here (rather than within MocoTrack) so that the
+        // processed model can be shared with customize().
+        Model model = profile.time("model_processing", [&] {
+            Model processed = m_modelCache ? m_modelCache->process(job.model)
+                                           : job.model.process();
+            if (!job.external_loads_file.empty()) {
+                m_dataStore->addExternalLoads(
+                        processed, job.external_loads_file);
+            }
+            return processed;
+        });
+        profile.addEvaluationCounter(model);
+        model.initSystem();
+        const ModelNameIndex names(model);
+        MocoTrack track;
+        track.setName(job.name);
+        track.setModel(ModelProcessor(model));
+        if (job.states_reference) {
+            // Pass MocoTrack only the tracked columns, with the speeds
+            // already computed from the shared splines, so that MocoTrack
+            // does not spline unused columns; see StatesReferenceCache.
+            track.setStatesReference(profile.time("reference_loading", [&] {
+                return TableProcessor(m_referenceCache->createReference(
+                        *job.states_reference, model, job.states_weight_set,
+                        job.track_reference_position_derivatives));
+            }));
+            track.set_states_global_tracking_weight(
+                    job.states_global_tracking_weight);
+            track.set_states_weight_set(job.states_weight_set);
+            track.set_track_reference_position_derivatives(false);
+        }
+        if (!job.markers_trc_file.empty()) {
+            // Read only the markers and rows that the problem uses. The
+            // store reads them once; MocoTrack keeps its own copy.
+            TRCMarkerReader reader(job.markers_trc_file);
+            reader.setTimeWindow(job.initial_time, job.final_time);
+            reader.selectMarkers(model, job.markers_weight_set);
+            track.setMarkersReference(*profile.time("reference_loading",
+                    [&] { return m_dataStore->getMarkers(reader); }));
+            track.set_markers_global_tracking_weight(
+                    job.markers_global_tracking_weight);
+            track.set_markers_weight_set(job.markers_weight_set);
+        }
+        track.set_allow_unused_references(job.allow_unused_references);
+        track.set_initial_time(job.initial_time);
+        track.set_final_time(job.final_time);
+
+        const auto createStudy = [&](double meshInterval) {
+            return profile.time("initialization", [&] {
+                track.set_mesh_interval(meshInterval);
+                MocoStudy study = track.initialize();
+                auto& solver = study.updSolver<MocoCasADiSolver>();
+                solver.set_parallel(calcParallelSetting(numThreads));
+                if (job.finite_difference_hessian) {
+                    setFiniteDifferenceHessian(solver);
+                }
+                if (job.customize) job.customize(study, model, names);
+                return study;
+            });
+        };
+
+        MocoDynamicsModeProbe probe(createStudy,
+                job.coarse_mesh_intervals.empty()
+                        ? 4 * job.mesh_interval
+                        : job.coarse_mesh_intervals.front());
+        probe.setCaptureSolverOutput(m_jobs.size() == 1);
+        probe.setTopologyCache(m_topologyCache);
+        const std::string mode = job.multibody_dynamics_mode == "auto"
+                ? profile.time("dynamics_mode_probe",
+                          [&] { return probe.select(job.mesh_interval); })
+                : job.multibody_dynamics_mode;
+
+        std::vector<double> meshIntervals = job.coarse_mesh_intervals;
+        meshIntervals.push_back(job.mesh_interval);
+        MocoMeshRefinement refinement(
+                [&](double meshInterval) {
+                    MocoStudy study = createStudy(meshInterval);
+                    probe.apply(study.updSolver<MocoCasADiSolver>(), mode);
+                    return study;
+                },
+                meshIntervals, job.mesh_refinement_tolerance);
+        std::string topologyKey;
+        refinement.setSolveFunction([&](const MocoStudy& study) {
+            if (m_topologyCache && topologyKey.empty()) {
+                topologyKey = MocoTopologyCache::calcKey(study);
+                if (m_topologyCache->hasSolution(topologyKey)) {
+                    const MocoTrajectory guess = m_topologyCache->createGuess(
+                            topologyKey, job.initial_time, job.final_time);
+                    // Implicit solutions also contain the accelerations (as
+                    // derivatives), so a solution in the other mode does not
+                    // fit the problem.
+                    if ((mode == "implicit") ==
+                            !guess.getDerivativeNames().empty()) {
+                        MocoStudy guessed = study;
+                        guessed.updSolver<MocoCasADiSolver>().setGuess(guess);
+                        return profile.solve(guessed);
+                    }
+                }
+            }
+            return profile.solve(study);
+        });
+
+        MocoSolution solution = refinement.solve();
+        if (m_topologyCache && solution.success()) {
+            m_topologyCache->writeSolution(topologyKey, solution);
+        }
+        result.success = solution.success();
+        result.message = solution.getStatus();
+        const std::string solutionPath = job.name + "_solution.sto";
+        refinement.writeSolution(solution, solutionPath);
+        profile.writeJSON(MocoSolveProfile::createProfilePath(solutionPath));
+        result.solution = std::move(solution);
+    } catch (const std::exception& e) {
+        result.success = false;
+        result.message = e.what();
+    }
+    result.duration = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    return result;
+}
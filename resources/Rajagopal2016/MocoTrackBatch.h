@@ -0,0 +1,264 @@
+#ifndef MOCOPAPER_MOCOTRACKBATCH_H
+#define MOCOPAPER_MOCOTRACKBATCH_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: MocoTrackBatch.h                                             *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "MocoDynamicsModeProbe.h"
+#include "MocoFiniteDifferenceHessian.h"
+#include "MocoMeshRefinement.h"
+#include "MocoTopologyCache.h"
+#include "ModelNameIndex.h"
+#include "ModelProcessorCache.h"
+#include "ReferenceDataStore.h"
+#include "StatesReferenceCache.h"
+
+#include <Moco/osimMoco.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace OpenSim {
+
+/// The settings for a single MocoTrack problem solved by MocoTrackBatch. These
+/// mirror the MocoTrack settings used in exampleMocoTrack.cpp.
+struct MocoTrackJob {
+    /// Used as the MocoTrack name and as the prefix of the solution file
+    /// (<name>_solution.sto).
+    std::string name;
+    ModelProcessor model;
+    /// Optional. An ExternalLoads XML file whose loads are added to the
+    /// processed model as a SharedExternalLoads force, in place of
+    /// ModOpAddExternalLoads in `model`. The loads are read and splined once
+    /// per ReferenceDataStore and shared by all jobs and solver threads.
+    std::string external_loads_file;
+
+    /// Leave empty to skip state tracking. Only the columns for model states
+    /// with a nonzero weight are tracked (and splined), and speeds for
+    /// track_reference_position_derivatives are computed from splines shared
+    /// by jobs with the same reference; see StatesReferenceCache.
+    std::shared_ptr<TableProcessor> states_reference;
+    double states_global_tracking_weight = 1;
+    MocoWeightSet states_weight_set;
+    bool track_reference_position_derivatives = false;
+
+    /// Leave empty to skip marker tracking. The data is filtered at 6 Hz and,
+    /// if in millimeters, converted to meters. Only the markers in the model
+    /// or in markers_weight_set, and only the rows in the time window, are
+    /// read, so the filtered values near the ends of the window differ
+    /// slightly from setMarkersReferenceFromTRC() (see TRCMarkerReader).
+    std::string markers_trc_file;
+    double markers_global_tracking_weight = 1;
+    MocoWeightSet markers_weight_set;
+
+    bool allow_unused_references = false;
+    double initial_time = 0;
+    double final_time = 0;
+    double mesh_interval = 0;
+
+    /// Optional. Coarser mesh intervals (from coarse to fine) to solve before
+    /// mesh_interval, each solution serving as the guess for the next mesh
+    /// (see MocoMeshRefinement). The refinement history is added to the
+    /// solution file's metadata.
+    std::vector<double> coarse_mesh_intervals;
+    /// If positive, stop refining once the relative change in the objective
+    /// is below this value; the solution may then be on a coarser mesh than
+    /// mesh_interval.
+    double mesh_refinement_tolerance = 0;
+
+    /// Use a sparse Hessian computed by central finite differences instead
+    /// of IPOPT's limited-memory approximation; see
+    /// setFiniteDifferenceHessian(). Off by default.
+    bool finite_difference_hessian = false;
+
+    /// "explicit" (Moco's default), "implicit", or "auto" to choose between
+    /// them by solving both on a coarse mesh (the coarsest of
+    /// coarse_mesh_intervals, or four times mesh_interval); see
+    /// MocoDynamicsModeProbe. Implicit mode minimizes the accelerations and
+    /// auxiliary derivatives with a small weight. With a topology cache
+    /// (MocoTrackBatch::setTopologyCache()), the choice is made once per
+    /// problem topology.
+    std::string multibody_dynamics_mode = "explicit";
+
+    /// Relative cost of solving this job, used to split the thread budget.
+    /// If zero, the number of mesh intervals is used. Muscle-driven problems
+    /// should be given a larger cost than torque-driven problems with the same
+    /// mesh.
+    double cost = 0;
+
+    /// Peak memory of the solve (bytes), used when the batch has a memory
+    /// limit (see MocoTrackBatch::setMemoryLimit()). If zero, the batch
+    /// estimates it with estimateSolveMemory(). The peak resident set size
+    /// of an earlier run of the same job is a better value.
+    double memory_budget = 0;
+
+    /// Optional. Customize the MocoStudy returned by MocoTrack::initialize()
+    /// (e.g., set per-control effort weights) before it is solved. The second
+    /// argument is the processed model, so that the model does not need to
+    /// be processed again to find component paths, and the third is an index
+    /// of its control and state names, built once per job and shared by all
+    /// meshes.
+    std::function<void(MocoStudy&, const Model&, const ModelNameIndex&)>
+            customize;
+
+    /// The number of mesh intervals implied by the time window and mesh
+    /// interval.
+    int getNumMeshIntervals() const;
+};
+
+/// A rough estimate of the peak memory (bytes) of a MocoCasADiSolver solve
+/// with Hermite-Simpson transcription, from the problem dimensions. The
+/// estimate is dominated by the sparse factorization of IPOPT's KKT matrix,
+/// whose size grows with the number of nonzeros in the constraint Jacobian
+/// and (with a finite-difference Hessian) the Hessian, plus a copy of the
+/// model per thread. It is meant for admission control, not as a bound.
+double estimateSolveMemory(int numStates, int numControls,
+        int numMeshIntervals, int numThreads, bool finiteDifferenceHessian);
+
+/// The outcome of a single MocoTrackJob.
+struct MocoTrackBatchResult {
+    std::string name;
+    /// True if the solve finished and the solver converged.
+    bool success = false;
+    /// The exception message if the job threw, or the solver status.
+    std::string message;
+    /// Number of threads given to MocoCasADiSolver for this job.
+    int num_threads = 0;
+    /// The CPUs the job was pinned to (see
+    /// MocoTrackBatch::setPinToNumaNodes()); empty if it was not pinned.
+    std::vector<int> cpus;
+    /// Wall time for the whole job, including model processing (seconds).
+    double duration = 0;
+    MocoSolution solution;
+};
+
+/// Solve multiple MocoTrack problems concurrently within a fixed thread
+/// budget. Each job receives a share of the budget proportional to its cost
+/// (at least one thread), which is passed to MocoCasADiSolver's `parallel`
+/// setting (a one-thread job runs serially). Whenever threads are free, the
+/// most costly waiting job that fits is started, so a large job that waits
+/// for threads does not hold up smaller jobs behind it; in this way, small
+/// torque-driven problems are solved alongside large muscle-driven problems
+/// rather than after them.
+///
+/// Each job's solution is written to <name>_solution.sto in the current
+/// directory, and its MocoSolveProfile to <name>_solution_profile.json. The
+/// profile includes the parsed solver output only if the batch has a single
+/// job, since concurrent jobs write to standard output at the same time. An
+/// exception in one job does not stop the other jobs; it is reported in the
+/// job's MocoTrackBatchResult.
+///
+/// With a memory limit (setMemoryLimit()), a job also waits until the
+/// memory budgets of the running jobs leave room for its own budget, so that
+/// concurrent fine-mesh solves are not killed for running out of memory.
+///
+/// @note The environment variable OPENSIM_MOCO_PARALLEL is read only when
+/// MocoCasADiSolver's `parallel` setting is unset; this class always sets
+/// it, so the variable has no effect on the jobs.
+class MocoTrackBatch {
+public:
+    /// @param numThreads The total number of threads to use across all jobs.
+    /// If zero, the number of hardware threads is used.
+    explicit MocoTrackBatch(int numThreads = 0);
+
+    void addJob(MocoTrackJob job);
+
+    /// Share processed models across jobs (and, if the cache has a
+    /// directory, across processes). Jobs with the same ModelProcessor
+    /// process their model only once.
+    void setModelCache(std::shared_ptr<ModelProcessorCache> cache) {
+        m_modelCache = std::move(cache);
+    }
+    /// Load tables, marker references and external loads once for all jobs
+    /// (and batches); each job's MocoTrack still copies its references (see
+    /// ReferenceDataStore). By default, the jobs of this batch share a store.
+    /// This also sets the reference cache to the store's.
+    void setReferenceDataStore(std::shared_ptr<ReferenceDataStore> store) {
+        m_dataStore = std::move(store);
+        m_referenceCache = m_dataStore->getStatesReferenceCache();
+    }
+    /// Share states references and their splines across jobs. By default,
+    /// the jobs of this batch share a cache; set a cache to share it with
+    /// other batches.
+    void setReferenceCache(std::shared_ptr<StatesReferenceCache> cache) {
+        m_referenceCache = std::move(cache);
+    }
+    /// Start each job's coarsest mesh from the latest successful solution of
+    /// a problem with the same topology (e.g., another subject), and store
+    /// each job's successful solution for later jobs and runs. This is a
+    /// cache of initial guesses, not of results: every job is still solved,
+    /// but its solution may depend on which jobs ran before it. By default,
+    /// no topology cache is used.
+    void setTopologyCache(std::shared_ptr<MocoTopologyCache> cache) {
+        m_topologyCache = std::move(cache);
+    }
+    /// Run jobs concurrently only while the sum of their memory budgets
+    /// (MocoTrackJob::memory_budget) is within this limit (bytes). A job
+    /// whose budget exceeds the limit on its own is solved with IPOPT's
+    /// limited-memory Hessian approximation if it requested a
+    /// finite-difference Hessian and that brings it within the limit;
+    /// otherwise, it runs alone. If zero (the default), memory is not
+    /// limited.
+    void setMemoryLimit(double bytes) { m_memoryLimit = bytes; }
+    /// Pin each job to CPUs of as few NUMA nodes as possible (one node, if
+    /// the job's threads fit on the node with the most free CPUs). The job's
+    /// thread processes its model and creates MocoCasADiSolver's per-thread
+    /// model copies, and the solver's threads inherit the job's CPUs, so the
+    /// job's memory stays on its node instead of being spread across
+    /// sockets. The CPUs are recorded in the job's result and profile. Pin
+    /// only if the batch owns the CPUs that the process may run on, and the
+    /// thread budget does not exceed them (jobs that do not get enough free
+    /// CPUs, as when the budget is larger, run unpinned).
+    ///
+    /// This helps batches of jobs that each fit on one node. It does not
+    /// make a single solve scale across sockets: a job whose threads span
+    /// nodes (e.g., one 80-muscle solve on all cores of a dual-socket
+    /// machine) still shares one model and the solver's workspace allocated
+    /// by the job's thread, and MocoCasADiSolver offers no way to keep a
+    /// replica per node or to partition the mesh points by node.
+    void setPinToNumaNodes(bool pin) { m_pinToNumaNodes = pin; }
+    int getNumJobs() const { return (int)m_jobs.size(); }
+    int getNumThreads() const { return m_numThreads; }
+
+    /// The number of threads each job would receive, in the order that the
+    /// jobs were added.
+    std::vector<int> calcThreadAllocation() const;
+
+    /// Solve all jobs and return their results in the order that the jobs
+    /// were added.
+    std::vector<MocoTrackBatchResult> solve() const;
+
+private:
+    MocoTrackBatchResult solveJob(const MocoTrackJob& job, int numThreads,
+            const std::vector<int>& cpus) const;
+    /// Fill in memory budgets and apply the memory limit to the jobs.
+    std::vector<MocoTrackJob> createBudgetedJobs(
+            const std::vector<int>& allocation) const;
+
+    int m_numThreads;
+    double m_memoryLimit = 0;
+    bool m_pinToNumaNodes = false;
+    std::vector<MocoTrackJob> m_jobs;
+    std::shared_ptr<ModelProcessorCache> m_modelCache;
+    std::shared_ptr<ReferenceDataStore> m_dataStore;
+    std::shared_ptr<StatesReferenceCache> m_referenceCache;
+    std::shared_ptr<MocoTopologyCache> m_topologyCache;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_MOCOTRACKBATCH_H
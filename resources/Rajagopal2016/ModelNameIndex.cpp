@@ -0,0 +1,119 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: ModelNameIndex.cpp                                           *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "ModelNameIndex.h"
+
+#include <regex>
+
+using namespace OpenSim;
+
+namespace {
+
+std::vector<std::string> select(const std::vector<std::string>& names,
+        const std::string& pattern) {
+    const std::regex regex(pattern);
+    std::vector<std::string> selected;
+    for (const auto& name : names) {
+        if (std::regex_match(name, regex)) selected.push_back(name);
+    }
+    return selected;
+}
+
+} // anonymous namespace
+
+ModelNameIndex::ModelNameIndex(const Model& model) {
+    const auto stateNames = model.getStateVariableNames();
+    for (int i = 0; i < stateNames.getSize(); ++i) {
+        m_stateIndices[stateNames[i]] = i;
+        m_stateNames.push_back(stateNames[i]);
+    }
+
+    // The control vector holds each actuator's controls in the order of the
+    // model's actuators; Moco names single-control actuators by their path.
+    const auto& actuators = model.getActuators();
+    for (int i = 0; i < actuators.getSize(); ++i) {
+        const auto& actuator = actuators.get(i);
+        const std::string path = actuator.getAbsolutePathString();
+        if (actuator.numControls() == 1) {
+            m_controlNames.push_back(path);
+        } else {
+            for (int ic = 0; ic < actuator.numControls(); ++ic) {
+                m_controlNames.push_back(path + "_" + std::to_string(ic));
+            }
+        }
+    }
+    for (int i = 0; i < (int)m_controlNames.size(); ++i) {
+        m_controlIndices[m_controlNames[i]] = i;
+    }
+}
+
+int ModelNameIndex::getControlIndex(const std::string& name) const {
+    const auto it = m_controlIndices.find(name);
+    return it == m_controlIndices.end() ? -1 : it->second;
+}
+
+int ModelNameIndex::getStateIndex(const std::string& name) const {
+    const auto it = m_stateIndices.find(name);
+    return it == m_stateIndices.end() ? -1 : it->second;
+}
+
+std::vector<std::string> ModelNameIndex::selectControls(
+        const std::string& pattern) const {
+    return select(m_controlNames, pattern);
+}
+
+std::vector<std::string> ModelNameIndex::selectStates(
+        const std::string& pattern) const {
+    return select(m_stateNames, pattern);
+}
+
+int ModelNameIndex::setWeightForControls(MocoControlGoal& goal,
+        const std::string& pattern, double weight) const {
+    const auto names = selectControls(pattern);
+    OPENSIM_THROW_IF(names.empty(), Exception,
+            "No controls match '" + pattern + "'.");
+    for (const auto& name : names) goal.setWeightForControl(name, weight);
+    return (int)names.size();
+}
+
+MocoWeightSet ModelNameIndex::createStateWeightSet(
+        const std::string& pattern, double weight) const {
+    const auto names = selectStates(pattern);
+    OPENSIM_THROW_IF(names.empty(), Exception,
+            "No states match '" + pattern + "'.");
+    MocoWeightSet weightSet;
+    for (const auto& name : names) {
+        weightSet.cloneAndAppend(MocoWeight(name, weight));
+    }
+    return weightSet;
+}
+
+std::string ModelNameIndex::convertGlob(const std::string& glob) {
+    std::string regex;
+    for (const char c : glob) {
+        if (c == '*') {
+            regex += ".*";
+        } else if (c == '?') {
+            regex += '.';
+        } else if (std::string("\\^$.|+()[]{}").find(c) != std::string::npos) {
+            regex += '\\';
+            regex += c;
+        } else {
+            regex += c;
+        }
+    }
+    return regex;
+}
@@ -0,0 +1,91 @@
+#ifndef MOCOPAPER_MODELNAMEINDEX_H
+#define MOCOPAPER_MODELNAMEINDEX_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: ModelNameIndex.h                                             *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <Moco/osimMoco.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace OpenSim {
+
+/// An index of a model's control and state variable names, built once from
+/// the model, for configuring goals by name. Controls are named as in
+/// MocoProblem: an actuator's absolute path, with the suffix _<i> for
+/// actuators with multiple controls. Selection patterns are ECMAScript
+/// regular expressions that must match the whole name (see convertGlob() for
+/// shell-style patterns), and are matched against the stored names without
+/// traversing the model's components or building paths again.
+///
+/// @code
+/// const ModelNameIndex names(model);
+/// names.setWeightForControls(effort, ".*pelvis.*", 10);
+/// track.set_states_weight_set(
+///         names.createStateWeightSet(".*hip_rotation.*", 0));
+/// @endcode
+///
+/// The index does not refer to the model after construction, so one index
+/// can be shared by all studies created from the same processed model.
+class ModelNameIndex {
+public:
+    /// The model must have been initialized with initSystem().
+    explicit ModelNameIndex(const Model& model);
+
+    const std::vector<std::string>& getControlNames() const {
+        return m_controlNames;
+    }
+    const std::vector<std::string>& getStateNames() const {
+        return m_stateNames;
+    }
+    /// The index in getControlNames() (the order of the model's control
+    /// vector), or -1 if there is no such control.
+    int getControlIndex(const std::string& name) const;
+    /// The index in getStateNames() (the order of
+    /// Model::getStateVariableNames()), or -1 if there is no such state.
+    int getStateIndex(const std::string& name) const;
+
+    /// The control names that match the pattern, in index order.
+    std::vector<std::string> selectControls(const std::string& pattern) const;
+    /// The state names that match the pattern, in index order.
+    std::vector<std::string> selectStates(const std::string& pattern) const;
+
+    /// Set the weight of every control that matches the pattern. Returns the
+    /// number of controls set; it is an error if no control matches.
+    int setWeightForControls(MocoControlGoal& goal, const std::string& pattern,
+            double weight) const;
+    /// A MocoWeightSet (e.g., for MocoTrack's states_weight_set) with the
+    /// weight for every state that matches the pattern. It is an error if no
+    /// state matches.
+    MocoWeightSet createStateWeightSet(
+            const std::string& pattern, double weight) const;
+
+    /// Convert a shell-style pattern (`*` matches any sequence of
+    /// characters, `?` matches one character) to a regular expression for
+    /// the select functions.
+    static std::string convertGlob(const std::string& glob);
+
+private:
+    std::vector<std::string> m_controlNames;
+    std::vector<std::string> m_stateNames;
+    std::unordered_map<std::string, int> m_controlIndices;
+    std::unordered_map<std::string, int> m_stateIndices;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_MODELNAMEINDEX_H
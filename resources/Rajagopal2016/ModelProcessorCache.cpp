@@ -0,0 +1,203 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: ModelProcessorCache.cpp                                      *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "ModelProcessorCache.h"
+
+#include <OpenSim/version.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+    #include <process.h>
+#else
+    #include <unistd.h>
+#endif
+
+using namespace OpenSim;
+
+namespace {
+
+/// 64-bit FNV-1a. This is not a cryptographic hash, but it is more than
+/// sufficient to distinguish models.
+std::uint64_t hashBytes(const std::string& bytes, std::uint64_t hash) {
+    for (const unsigned char c : bytes) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string readFile(const std::string& path) {
+    std::ifstream stream(path, std::ios::binary);
+    OPENSIM_THROW_IF(!stream, Exception, "Could not read '" + path + "'.");
+    return std::string(std::istreambuf_iterator<char>(stream),
+            std::istreambuf_iterator<char>());
+}
+
+bool fileExists(const std::string& path) {
+    return std::ifstream(path).good();
+}
+
+std::string getDirectory(const std::string& path) {
+    const auto sep = path.find_last_of("/\\");
+    return sep == std::string::npos ? "" : path.substr(0, sep + 1);
+}
+
+std::string resolvePath(const std::string& directory, const std::string& path) {
+    if (path.empty() || path[0] == '/' || path[0] == '\\' ||
+            (path.size() > 1 && path[1] == ':')) {
+        return path;
+    }
+    return directory + path;
+}
+
+/// A temporary path next to `path` that no other process or thread uses, so
+/// that concurrent writers of the same cache file do not overwrite each
+/// other's partially-written files.
+std::string createTempPath(const std::string& path) {
+    static std::atomic<unsigned> counter(0);
+#ifdef _WIN32
+    const int pid = _getpid();
+#else
+    const int pid = (int)getpid();
+#endif
+    std::stringstream ss;
+    ss << path << "." << pid << "."
+       << std::hash<std::thread::id>()(std::this_thread::get_id()) << "."
+       << counter++ << ".tmp";
+    return ss.str();
+}
+
+/// The external loads XML files used by the processor's operators, in the
+/// order in which the operators are applied.
+std::vector<std::string> getExternalLoadsFiles(
+        const ModelProcessor& processor) {
+    std::vector<std::string> files;
+    for (int iop = 0; iop < processor.getProperty_operators().size(); ++iop) {
+        const auto* addExtLoads = dynamic_cast<const ModOpAddExternalLoads*>(
+                &processor.get_operators(iop));
+        if (addExtLoads) { files.push_back(addExtLoads->get_filepath()); }
+    }
+    return files;
+}
+
+} // anonymous namespace
+
+ModelProcessorCache::ModelProcessorCache(std::string cacheDir)
+        : m_cacheDir(std::move(cacheDir)) {
+    if (!m_cacheDir.empty()) {
+        if (m_cacheDir.back() != '/') m_cacheDir += '/';
+        IO::makeDir(m_cacheDir);
+    }
+}
+
+std::string ModelProcessorCache::calcKey(const ModelProcessor& processor) {
+    // The serialized processor contains the base model path (or the base
+    // model itself) and the ordered operators with all of their properties.
+    std::uint64_t hash = hashBytes(processor.dump(), 14695981039346656037ull);
+    // Operators of another version of OpenSim or Moco may process the
+    // model differently.
+    hash = hashBytes(GetVersionAndDate(), hash);
+    hash = hashBytes(GetMocoVersionAndDate(), hash);
+    if (!processor.get_filepath().empty()) {
+        hash = hashBytes(readFile(processor.get_filepath()), hash);
+    }
+    for (const auto& xml : getExternalLoadsFiles(processor)) {
+        hash = hashBytes(readFile(xml), hash);
+        ExternalLoads extLoads(xml, true);
+        hash = hashBytes(readFile(resolvePath(getDirectory(xml),
+                                 extLoads.getDataFileName())),
+                hash);
+    }
+    std::stringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return ss.str();
+}
+
+Model ModelProcessorCache::process(const ModelProcessor& processor) {
+    const std::string key = calcKey(processor);
+    std::shared_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& slot = m_entries[key];
+        if (!slot) slot = std::make_shared<Entry>();
+        entry = slot;
+    }
+
+    std::call_once(entry->once, [&] {
+        const std::string cachePath =
+                m_cacheDir.empty() ? "" : m_cacheDir + key + ".osim";
+        if (!cachePath.empty() && fileExists(cachePath)) {
+            auto model = std::unique_ptr<Model>(new Model(cachePath));
+            model->finalizeConnections();
+            entry->model = std::move(model);
+            ++m_numLoadedFromDisk;
+            return;
+        }
+
+        auto model = std::unique_ptr<Model>(new Model(processor.process()));
+        ++m_numProcessed;
+
+        if (!cachePath.empty()) {
+            // Data files are loaded relative to the external loads XML file,
+            // but the cached model lives in a different directory.
+            Model toPrint(*model);
+            toPrint.finalizeFromProperties();
+            const auto xmlFiles = getExternalLoadsFiles(processor);
+            auto extLoadsList = toPrint.updComponentList<ExternalLoads>();
+            int numExtLoads = 0;
+            for (const auto& extLoads : extLoadsList) {
+                (void)extLoads;
+                ++numExtLoads;
+            }
+            if (numExtLoads == (int)xmlFiles.size()) {
+                int i = 0;
+                for (auto& extLoads : extLoadsList) {
+                    extLoads.setDataFileName(
+                            resolvePath(getDirectory(xmlFiles[i++]),
+                                    extLoads.getDataFileName()));
+                }
+                // Print to a temporary file first so that other processes
+                // never read a partially-written model. Another process may
+                // write the same key; the last rename wins, and both files
+                // are complete.
+                const std::string tempPath = createTempPath(cachePath);
+                toPrint.print(tempPath);
+                if (std::rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+                    std::remove(tempPath.c_str());
+                }
+            } else {
+                std::cout << "ModelProcessorCache: not writing " << cachePath
+                          << " because the base model already contains "
+                             "ExternalLoads." << std::endl;
+            }
+        }
+        entry->model = std::move(model);
+    });
+
+    // Copying is much cheaper than processing, but Component copying is not
+    // guaranteed to be thread-safe.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return Model(*entry->model);
+}
@@ -0,0 +1,81 @@
+#ifndef MOCOPAPER_MODELPROCESSORCACHE_H
+#define MOCOPAPER_MODELPROCESSORCACHE_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: ModelProcessorCache.h                                        *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <Moco/osimMoco.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace OpenSim {
+
+/// A content-addressed cache of the models produced by ModelProcessor%s.
+///
+/// The key is a hash of the base model file, the external loads XML files
+/// (and the data files they reference) used by ModOpAddExternalLoads, and the
+/// serialized ModelProcessor, which contains the ordered list of
+/// ModelOperator%s and their parameters, and the OpenSim and Moco versions.
+/// Editing any of these files or operators, or updating OpenSim or Moco,
+/// produces a new key.
+///
+/// Processed models are kept in memory for the lifetime of the cache. If a
+/// cache directory is provided, processed models are also printed to
+/// <cache_dir>/<key>.osim so that later processes can skip muscle replacement
+/// and the other operators; loading a cached model still requires parsing
+/// its XML. Data files referenced by ExternalLoads are stored with absolute
+/// paths in the cached model file.
+///
+/// This class is thread-safe; processing of distinct keys happens in
+/// parallel, and concurrent requests for the same key process it only once.
+class ModelProcessorCache {
+public:
+    explicit ModelProcessorCache(std::string cacheDir = "");
+
+    /// The key for the model that the ModelProcessor would produce.
+    static std::string calcKey(const ModelProcessor& processor);
+
+    /// Obtain a copy of the processed model, processing it only if neither
+    /// the memory nor the disk cache contains it.
+    Model process(const ModelProcessor& processor);
+
+    /// Convenience for passing a cached model to MocoTrack::setModel() or
+    /// MocoInverse::setModel().
+    ModelProcessor createProcessor(const ModelProcessor& processor) {
+        return ModelProcessor(process(processor));
+    }
+
+    int getNumProcessed() const { return m_numProcessed; }
+    int getNumLoadedFromDisk() const { return m_numLoadedFromDisk; }
+
+private:
+    struct Entry {
+        std::once_flag once;
+        std::unique_ptr<const Model> model;
+    };
+    std::string m_cacheDir;
+    std::mutex m_mutex;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> m_entries;
+    std::atomic<int> m_numProcessed{0};
+    std::atomic<int> m_numLoadedFromDisk{0};
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_MODELPROCESSORCACHE_H
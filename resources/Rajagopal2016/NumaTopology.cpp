@@ -0,0 +1,136 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: NumaTopology.cpp                                             *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "NumaTopology.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+using namespace OpenSim;
+
+namespace {
+
+// Parse a Linux CPU list, such as "0-31,64-95".
+std::vector<int> parseCpuList(const std::string& text) {
+    std::vector<int> cpus;
+    std::stringstream ss(text);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.find_first_of("0123456789") == std::string::npos) continue;
+        const auto dash = range.find('-');
+        const int first = std::stoi(range.substr(0, dash));
+        const int last = dash == std::string::npos
+                                 ? first
+                                 : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+bool readFirstLine(const std::string& path, std::string& line) {
+    std::ifstream file(path);
+    return file && std::getline(file, line);
+}
+
+} // anonymous namespace
+
+NumaTopology::NumaTopology() {
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    const bool haveAffinity =
+            sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    std::string online;
+    if (readFirstLine("/sys/devices/system/node/online", online)) {
+        for (const int node : parseCpuList(online)) {
+            std::string list;
+            if (!readFirstLine("/sys/devices/system/node/node" +
+                                       std::to_string(node) + "/cpulist",
+                        list)) {
+                continue;
+            }
+            std::vector<int> cpus;
+            for (const int cpu : parseCpuList(list)) {
+                if (!haveAffinity || (cpu < CPU_SETSIZE &&
+                                             CPU_ISSET(cpu, &allowed))) {
+                    cpus.push_back(cpu);
+                }
+            }
+            // Skip nodes without (allowed) CPUs, such as memory-only nodes.
+            if (!cpus.empty()) m_cpus.push_back(cpus);
+        }
+    }
+    if (m_cpus.empty() && haveAffinity) {
+        m_cpus.emplace_back();
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) m_cpus.back().push_back(cpu);
+        }
+    }
+#endif
+    if (m_cpus.empty()) {
+        m_cpus.emplace_back();
+        const int numCpus = std::max(1u, std::thread::hardware_concurrency());
+        for (int cpu = 0; cpu < numCpus; ++cpu) m_cpus.back().push_back(cpu);
+    }
+    for (int node = 0; node < (int)m_cpus.size(); ++node) {
+        for (const int cpu : m_cpus[node]) {
+            if (cpu >= (int)m_nodeOfCpu.size()) m_nodeOfCpu.resize(cpu + 1, -1);
+            m_nodeOfCpu[cpu] = node;
+        }
+    }
+}
+
+int NumaTopology::getNumCpus() const {
+    int numCpus = 0;
+    for (const auto& cpus : m_cpus) numCpus += (int)cpus.size();
+    return numCpus;
+}
+
+int NumaTopology::getNodeOfCpu(int cpu) const {
+    if (cpu < 0 || cpu >= (int)m_nodeOfCpu.size()) return -1;
+    return m_nodeOfCpu[cpu];
+}
+
+bool NumaTopology::pinCurrentThread(const std::vector<int>& cpus) {
+#ifdef __linux__
+    if (cpus.empty()) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int cpu : cpus) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+int NumaTopology::getCurrentCpu() {
+#ifdef __linux__
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
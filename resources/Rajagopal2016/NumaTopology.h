@@ -0,0 +1,62 @@
+#ifndef MOCOPAPER_NUMATOPOLOGY_H
+#define MOCOPAPER_NUMATOPOLOGY_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: NumaTopology.h                                               *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <string>
+#include <vector>
+
+namespace OpenSim {
+
+/// The NUMA nodes of the machine (usually one per socket) and the CPUs of
+/// each, restricted to the CPUs that the process may run on (e.g., those
+/// given by taskset or a batch scheduler).
+///
+/// Memory is allocated on the node of the thread that first touches it, so
+/// a thread that creates its own copy of a Model and SimTK::State after
+/// being pinned to a node keeps its working set local, and threads created
+/// by a pinned thread (e.g., MocoCasADiSolver's threads) inherit its CPUs.
+/// See WorkStealingPool (pinToNumaNodes) and
+/// MocoTrackBatch::setPinToNumaNodes(). Only the work that this directory
+/// schedules itself (batch jobs and the pool's tasks) is placed on nodes;
+/// the threads of a single MocoCasADiSolver solve are not.
+class NumaTopology {
+public:
+    /// Read the topology from /sys/devices/system/node (on Linux). Elsewhere,
+    /// or if the topology cannot be read, all CPUs form a single node.
+    NumaTopology();
+
+    int getNumNodes() const { return (int)m_cpus.size(); }
+    int getNumCpus() const;
+    /// The CPUs of a node, in increasing order.
+    const std::vector<int>& getCpus(int node) const { return m_cpus[node]; }
+    /// The node of a CPU, or -1 if the process may not run on the CPU.
+    int getNodeOfCpu(int cpu) const;
+
+    /// Restrict the calling thread to the given CPUs. Returns false if this
+    /// is not supported (outside of Linux) or the CPUs are invalid.
+    static bool pinCurrentThread(const std::vector<int>& cpus);
+    /// The CPU that the calling thread is running on, or -1 if unknown.
+    static int getCurrentCpu();
+
+private:
+    std::vector<std::vector<int>> m_cpus;
+    std::vector<int> m_nodeOfCpu;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_NUMATOPOLOGY_H
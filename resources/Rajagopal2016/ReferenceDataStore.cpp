@@ -0,0 +1,93 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: ReferenceDataStore.cpp                                       *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "ReferenceDataStore.h"
+
+using namespace OpenSim;
+
+ReferenceDataStore::ReferenceDataStore()
+        : m_statesReferenceCache(std::make_shared<StatesReferenceCache>()) {
+    Object::registerType(SharedExternalLoads());
+}
+
+template <typename T>
+std::shared_ptr<const T> ReferenceDataStore::get(const std::string& key,
+        const std::function<std::shared_ptr<const T>()>& load) {
+    std::shared_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& slot = m_entries[key];
+        if (!slot) slot = std::make_shared<Entry>();
+        entry = slot;
+    }
+    std::call_once(entry->once, [&] {
+        entry->value = load();
+        ++m_numLoaded;
+    });
+    return std::static_pointer_cast<const T>(entry->value);
+}
+
+std::shared_ptr<const TimeSeriesTable> ReferenceDataStore::getTable(
+        const std::string& path) {
+    return get<TimeSeriesTable>("table:" + path, [&] {
+        return std::make_shared<const TimeSeriesTable>(path);
+    });
+}
+
+std::shared_ptr<const TimeSeriesTable_<SimTK::Vec3>>
+ReferenceDataStore::getMarkers(const TRCMarkerReader& reader) {
+    return get<TimeSeriesTable_<SimTK::Vec3>>(
+            "markers:" + reader.calcKey(), [&] {
+                return std::make_shared<const TimeSeriesTable_<SimTK::Vec3>>(
+                        reader.read());
+            });
+}
+
+std::shared_ptr<const ExternalLoadsData> ReferenceDataStore::getExternalLoads(
+        const std::string& xmlPath) {
+    return get<ExternalLoadsData>("external_loads:" + xmlPath, [&] {
+        return ExternalLoadsData::create(xmlPath,
+                getTable(ExternalLoadsData::getDataFilePath(xmlPath)));
+    });
+}
+
+void ReferenceDataStore::addExternalLoads(
+        Model& model, const std::string& xmlPath) {
+    model.addForce(new SharedExternalLoads(getExternalLoads(xmlPath)));
+    model.finalizeConnections();
+}
+
+int ReferenceDataStore::releaseUnused() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int numReleased = 0;
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        // Entries that are still being loaded have no value yet and are held
+        // by the loading thread.
+        if (it->second.use_count() == 1 && it->second->value &&
+                it->second->value.use_count() == 1) {
+            it = m_entries.erase(it);
+            ++numReleased;
+        } else {
+            ++it;
+        }
+    }
+    return numReleased;
+}
+
+int ReferenceDataStore::getNumItems() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (int)m_entries.size();
+}
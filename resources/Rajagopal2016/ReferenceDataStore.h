@@ -0,0 +1,110 @@
+#ifndef MOCOPAPER_REFERENCEDATASTORE_H
+#define MOCOPAPER_REFERENCEDATASTORE_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: ReferenceDataStore.h                                         *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "SharedExternalLoads.h"
+#include "StatesReferenceCache.h"
+#include "TRCMarkerReader.h"
+
+#include <Moco/osimMoco.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace OpenSim {
+
+/// Reference data loaded once for the problems of a process (e.g., the jobs
+/// of a MocoTrackBatch for the same subject): data tables, marker
+/// references, external loads with their splines, and states references
+/// (through a StatesReferenceCache).
+///
+/// What is shared is the work of reading, filtering and splining the data,
+/// and the store's own copy of it. MocoTrack takes its references by value
+/// (setMarkersReference() and the TableProcessor given to
+/// setStatesReference() each copy the table), and its tracking goals build
+/// their own splines, so each MocoTrack problem still holds a copy of its
+/// tracked columns. Only external loads added with addExternalLoads() are
+/// shared by the problems themselves, because the SharedExternalLoads force
+/// evaluates the store's splines directly.
+///
+/// Each item is loaded the first time it is requested and is returned as a
+/// shared_ptr to const data, so all users share one copy; concurrent
+/// requests for the same item load it once. Files are identified by path
+/// and must not change during the lifetime of the store. The store keeps
+/// every item until releaseUnused() is called, which drops the items that
+/// no one else holds. This class is thread-safe.
+///
+/// External loads are applied by a SharedExternalLoads force (see
+/// addExternalLoads()) instead of ModOpAddExternalLoads, so that the
+/// per-thread model copies made by the solver, and the models of other
+/// problems, share one set of splines of the data.
+class ReferenceDataStore {
+public:
+    ReferenceDataStore();
+
+    /// A table read from a data file (e.g., .sto or .mot).
+    std::shared_ptr<const TimeSeriesTable> getTable(const std::string& path);
+    /// The marker reference that the reader produces; readers with the same
+    /// file and settings (TRCMarkerReader::calcKey()) share it.
+    std::shared_ptr<const TimeSeriesTable_<SimTK::Vec3>> getMarkers(
+            const TRCMarkerReader& reader);
+    /// The loads of an ExternalLoads XML file, splined once. The data file is
+    /// shared with getTable().
+    std::shared_ptr<const ExternalLoadsData> getExternalLoads(
+            const std::string& xmlPath);
+
+    /// Add a SharedExternalLoads force with the loads of the XML file to a
+    /// processed model (in place of ModOpAddExternalLoads in its
+    /// ModelProcessor), and finalize the model's connections.
+    void addExternalLoads(Model& model, const std::string& xmlPath);
+
+    /// The cache of states references shared by users of this store.
+    std::shared_ptr<StatesReferenceCache> getStatesReferenceCache() const {
+        return m_statesReferenceCache;
+    }
+
+    /// Drop the items that are no longer used outside of the store. Returns
+    /// the number of items dropped.
+    int releaseUnused();
+
+    int getNumItems() const;
+    /// The number of items loaded (tables read, references filtered, loads
+    /// splined) since the store was created.
+    int getNumLoaded() const { return m_numLoaded; }
+
+private:
+    struct Entry {
+        std::once_flag once;
+        std::shared_ptr<const void> value;
+    };
+    template <typename T>
+    std::shared_ptr<const T> get(const std::string& key,
+            const std::function<std::shared_ptr<const T>()>& load);
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> m_entries;
+    std::shared_ptr<StatesReferenceCache> m_statesReferenceCache;
+    std::atomic<int> m_numLoaded{0};
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_REFERENCEDATASTORE_H
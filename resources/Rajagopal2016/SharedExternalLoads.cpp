@@ -0,0 +1,178 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: SharedExternalLoads.cpp                                      *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "SharedExternalLoads.h"
+
+using namespace OpenSim;
+
+namespace {
+
+std::string getDirectory(const std::string& path) {
+    const auto sep = path.find_last_of("/\\");
+    return sep == std::string::npos ? "" : path.substr(0, sep + 1);
+}
+
+std::string resolvePath(const std::string& directory, const std::string& path) {
+    if (path.empty() || path[0] == '/' || path[0] == '\\' ||
+            (path.size() > 1 && path[1] == ':')) {
+        return path;
+    }
+    return directory + path;
+}
+
+// Force, point and torque.
+const int numValuesPerLoad = 9;
+
+void evaluate(const std::vector<std::shared_ptr<const Function>>& f,
+        const SimTK::Vector& time, double* values) {
+    for (int i = 0; i < (int)f.size(); ++i) values[i] = f[i]->calcValue(time);
+}
+
+} // anonymous namespace
+
+std::string ExternalLoadsData::getDataFilePath(const std::string& xmlPath) {
+    const ExternalLoads extLoads(xmlPath, true);
+    return resolvePath(getDirectory(xmlPath), extLoads.getDataFileName());
+}
+
+std::shared_ptr<const ExternalLoadsData> ExternalLoadsData::create(
+        const std::string& xmlPath,
+        std::shared_ptr<const TimeSeriesTable> table) {
+    const ExternalLoads extLoads(xmlPath, true);
+    if (!table) {
+        table = std::make_shared<const TimeSeriesTable>(
+                getDataFilePath(xmlPath));
+    }
+    const std::vector<double>& time = table->getIndependentColumn();
+    const auto createSplines = [&](const std::string& identifier,
+                                       const std::vector<std::string>&
+                                               suffixes) {
+        std::vector<std::shared_ptr<const Function>> splines;
+        if (identifier.empty()) return splines;
+        for (const auto& suffix : suffixes) {
+            const std::string label = identifier + suffix;
+            OPENSIM_THROW_IF(!table->hasColumn(label), Exception,
+                    "Column '" + label + "' is not in the data of '" +
+                            xmlPath + "'.");
+            // GCVSpline requires contiguous values.
+            const SimTK::Vector column = table->getDependentColumn(label);
+            splines.push_back(std::make_shared<const GCVSpline>(3,
+                    (int)time.size(), time.data(), &column[0], label, 0));
+        }
+        return splines;
+    };
+
+    auto data = std::make_shared<ExternalLoadsData>();
+    data->name = extLoads.getName();
+    for (int i = 0; i < extLoads.getSize(); ++i) {
+        const ExternalForce& force = extLoads[i];
+        Load load;
+        load.name = force.getName();
+        load.applied_to_body = force.get_applied_to_body();
+        load.force_expressed_in_body = force.get_force_expressed_in_body();
+        load.point_expressed_in_body = force.get_point_expressed_in_body();
+        load.force = createSplines(force.get_force_identifier(),
+                {"x", "y", "z"});
+        load.point = createSplines(force.get_point_identifier(),
+                {"x", "y", "z"});
+        load.torque = createSplines(force.get_torque_identifier(),
+                {"x", "y", "z"});
+        data->loads.push_back(std::move(load));
+    }
+    return data;
+}
+
+SharedExternalLoads::SharedExternalLoads(
+        std::shared_ptr<const ExternalLoadsData> data)
+        : m_data(std::move(data)) {
+    OPENSIM_THROW_IF(!m_data, Exception, "Expected external loads data.");
+    setName(m_data->name);
+}
+
+void SharedExternalLoads::extendConnectToModel(Model& model) {
+    Super::extendConnectToModel(model);
+    OPENSIM_THROW_IF_FRMOBJ(!m_data, Exception,
+            "No external loads data; this force cannot be read from a file.");
+    const auto findFrame = [&](const std::string& name)
+            -> const PhysicalFrame* {
+        if (name == "ground") return &model.getGround();
+        return &model.getBodySet().get(name);
+    };
+    m_frames.clear();
+    for (const auto& load : m_data->loads) {
+        m_frames.push_back({});
+        m_frames.back()[0].reset(findFrame(load.applied_to_body));
+        m_frames.back()[1].reset(findFrame(load.force_expressed_in_body));
+        m_frames.back()[2].reset(findFrame(load.point_expressed_in_body));
+    }
+}
+
+const double* SharedExternalLoads::getValues(double time) const {
+    const auto it = m_cache.rows.find(time);
+    if (it != m_cache.rows.end()) {
+        return &m_cache.values[it->second * numValuesPerLoad *
+                               m_data->loads.size()];
+    }
+    const int numValues = numValuesPerLoad * (int)m_data->loads.size();
+    double* values;
+    if ((int)m_cache.rows.size() < m_maxNumCachedTimes) {
+        const int row = (int)m_cache.rows.size();
+        m_cache.rows.emplace(time, row);
+        m_cache.values.resize((row + 1) * numValues, 0.0);
+        values = &m_cache.values[row * numValues];
+    } else {
+        m_cache.uncached.assign(numValues, 0.0);
+        values = m_cache.uncached.data();
+    }
+    const SimTK::Vector timeVector(1, time);
+    for (int i = 0; i < (int)m_data->loads.size(); ++i) {
+        const auto& load = m_data->loads[i];
+        double* loadValues = values + i * numValuesPerLoad;
+        evaluate(load.force, timeVector, loadValues);
+        evaluate(load.point, timeVector, loadValues + 3);
+        evaluate(load.torque, timeVector, loadValues + 6);
+    }
+    return values;
+}
+
+void SharedExternalLoads::computeForce(const SimTK::State& state,
+        SimTK::Vector_<SimTK::SpatialVec>& bodyForces,
+        SimTK::Vector&) const {
+    const double* values = getValues(state.getTime());
+    for (int i = 0; i < (int)m_data->loads.size(); ++i) {
+        const auto& load = m_data->loads[i];
+        const double* loadValues = values + i * numValuesPerLoad;
+        const PhysicalFrame& appliedTo = *m_frames[i][0];
+        const PhysicalFrame& forceFrame = *m_frames[i][1];
+        if (!load.force.empty()) {
+            const SimTK::Vec3 force = forceFrame.expressVectorInGround(
+                    state, SimTK::Vec3::getAs(loadValues));
+            // Without a point, the force is applied at the body's origin.
+            SimTK::Vec3 point(0);
+            if (!load.point.empty()) {
+                point = m_frames[i][2]->findStationLocationInAnotherFrame(
+                        state, SimTK::Vec3::getAs(loadValues + 3), appliedTo);
+            }
+            applyForceToPoint(state, appliedTo, point, force, bodyForces);
+        }
+        if (!load.torque.empty()) {
+            applyTorque(state, appliedTo,
+                    forceFrame.expressVectorInGround(
+                            state, SimTK::Vec3::getAs(loadValues + 6)),
+                    bodyForces);
+        }
+    }
+}
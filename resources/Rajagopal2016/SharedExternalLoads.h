@@ -0,0 +1,138 @@
+#ifndef MOCOPAPER_SHAREDEXTERNALLOADS_H
+#define MOCOPAPER_SHAREDEXTERNALLOADS_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: SharedExternalLoads.h                                        *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <Moco/osimMoco.h>
+
+#include <array>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace OpenSim {
+
+/// The data of an ExternalLoads file (e.g., grf_walk.xml) and its data file,
+/// with the force, point and torque of each ExternalForce splined once.
+struct ExternalLoadsData {
+    struct Load {
+        std::string name;
+        std::string applied_to_body;
+        std::string force_expressed_in_body;
+        std::string point_expressed_in_body;
+        /// Splines of the x, y and z components; a vector is empty if the
+        /// ExternalForce has no such identifier.
+        std::vector<std::shared_ptr<const Function>> force;
+        std::vector<std::shared_ptr<const Function>> point;
+        std::vector<std::shared_ptr<const Function>> torque;
+    };
+    std::string name;
+    std::vector<Load> loads;
+
+    /// Read the XML file and its data file (relative to the XML file). The
+    /// columns are splined with GCVSplines of degree 3, as in ExternalForce.
+    /// If `table` is given, it is used instead of reading the data file.
+    static std::shared_ptr<const ExternalLoadsData> create(
+            const std::string& xmlPath,
+            std::shared_ptr<const TimeSeriesTable> table = nullptr);
+    /// The path of the data file of an ExternalLoads XML file.
+    static std::string getDataFilePath(const std::string& xmlPath);
+};
+
+/// A Force that applies the loads of an ExternalLoadsData in the same way
+/// as the ExternalForces that ModOpAddExternalLoads adds. Copies of this
+/// force (e.g., MocoCasADiSolver's per-thread copies of the model, and the
+/// models of other problems with the same loads) share the data and its
+/// splines instead of each holding a Storage and its own splines.
+///
+/// The values of the data (forces, points and torques, before they are
+/// expressed in ground, which depends on the state) are cached for each
+/// distinct time at which the force is evaluated, in a flat array. A direct
+/// collocation solver evaluates the forces at the same mesh and collocation
+/// times in every iteration and for every finite-difference perturbation of
+/// the states, so after the first iteration the splines are no longer
+/// evaluated. The cache belongs to each copy of the force and is not copied;
+/// like the rest of the model, a copy must not be evaluated by multiple
+/// threads at once (MocoCasADiSolver gives each thread its own copy of the
+/// model). Once the cache holds the maximum number of times (e.g., when the
+/// final time is a variable), additional times are evaluated directly.
+///
+/// The data is not serialized: a model containing this force can be copied
+/// but not printed and read back. Use ReferenceDataStore::addExternalLoads()
+/// to add the force to a processed model.
+///
+/// The force is used only where the C++ code processes the model itself:
+/// MocoTrackBatch jobs with an external_loads_file (e.g., those in
+/// exampleMocoTrackJobs.h) and exampleMocoTrackAdvanced.cpp. Problems whose
+/// ModelProcessor contains ModOpAddExternalLoads, such as those in
+/// exampleMocoTrack.cpp (kept as plain MocoTrack usage) and the Python
+/// scripts (the force has no Python bindings), still get one set of
+/// ExternalForce splines per model copy.
+class SharedExternalLoads : public Force {
+    OpenSim_DECLARE_CONCRETE_OBJECT(SharedExternalLoads, Force);
+
+public:
+    SharedExternalLoads() = default;
+    explicit SharedExternalLoads(std::shared_ptr<const ExternalLoadsData> data);
+
+    const ExternalLoadsData& getData() const { return *m_data; }
+
+    /// The maximum number of times for which values are cached (default:
+    /// 100000). Zero disables the cache.
+    void setMaxNumCachedTimes(int maxNumTimes) {
+        m_maxNumCachedTimes = maxNumTimes;
+    }
+    int getNumCachedTimes() const { return (int)m_cache.rows.size(); }
+
+    void computeForce(const SimTK::State& state,
+            SimTK::Vector_<SimTK::SpatialVec>& bodyForces,
+            SimTK::Vector& generalizedForces) const override;
+
+protected:
+    void extendConnectToModel(Model& model) override;
+
+private:
+    /// The data values at the given time: for each load, the force, point
+    /// and torque (zero if the load lacks them).
+    const double* getValues(double time) const;
+
+    /// Copies of the force start with an empty cache.
+    struct TimeCache {
+        TimeCache() = default;
+        TimeCache(const TimeCache&) {}
+        TimeCache& operator=(const TimeCache&) {
+            rows.clear();
+            values.clear();
+            return *this;
+        }
+        std::unordered_map<double, int> rows;
+        std::vector<double> values;
+        std::vector<double> uncached;
+    };
+
+    std::shared_ptr<const ExternalLoadsData> m_data;
+    int m_maxNumCachedTimes = 100000;
+    mutable TimeCache m_cache;
+    /// For each load, the applied-to, force-expressed-in and
+    /// point-expressed-in frames.
+    std::vector<std::array<SimTK::ReferencePtr<const PhysicalFrame>, 3>>
+            m_frames;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_SHAREDEXTERNALLOADS_H
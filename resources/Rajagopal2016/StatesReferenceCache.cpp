@@ -0,0 +1,158 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: StatesReferenceCache.cpp                                     *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "StatesReferenceCache.h"
+
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+
+using namespace OpenSim;
+
+namespace {
+
+/// 64-bit FNV-1a, as in ModelProcessorCache.
+std::uint64_t hashBytes(const std::string& bytes, std::uint64_t hash) {
+    for (const unsigned char c : bytes) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string readFile(const std::string& path) {
+    std::ifstream stream(path, std::ios::binary);
+    OPENSIM_THROW_IF(!stream, Exception, "Could not read '" + path + "'.");
+    return std::string(std::istreambuf_iterator<char>(stream),
+            std::istreambuf_iterator<char>());
+}
+
+double getWeight(const MocoWeightSet& weights, const std::string& name) {
+    return weights.contains(name) ? weights.get(name).getWeight() : 1.0;
+}
+
+bool endsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() &&
+           s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // anonymous namespace
+
+std::shared_ptr<StatesReferenceCache::Entry> StatesReferenceCache::getEntry(
+        const TableProcessor& processor, const Model& model) {
+    // TableProcessor::process() uses the model to convert degrees to radians
+    // and to find absolute state names.
+    std::uint64_t hash = hashBytes(processor.dump(), 14695981039346656037ull);
+    if (!processor.get_filepath().empty()) {
+        hash = hashBytes(readFile(processor.get_filepath()), hash);
+    }
+    const auto stateNames = model.getStateVariableNames();
+    for (int i = 0; i < stateNames.getSize(); ++i) {
+        hash = hashBytes(stateNames[i] + '\n', hash);
+    }
+
+    std::shared_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& slot = m_entries[std::to_string(hash)];
+        if (!slot) slot = std::make_shared<Entry>();
+        entry = slot;
+    }
+    std::call_once(entry->once, [&] {
+        entry->table.reset(new TimeSeriesTable(processor.process("", &model)));
+        ++m_numTablesProcessed;
+    });
+    return entry;
+}
+
+std::shared_ptr<const GCVSpline> StatesReferenceCache::getSpline(
+        Entry& entry, const std::string& label) {
+    std::lock_guard<std::mutex> lock(entry.mutex);
+    auto& spline = entry.splines[label];
+    if (!spline) {
+        const auto& time = entry.table->getIndependentColumn();
+        // Copy the column, since the spline needs contiguous values.
+        const SimTK::Vector column = entry.table->getDependentColumn(label);
+        spline = std::make_shared<const GCVSpline>(5, (int)time.size(),
+                time.data(), &column[0], label, 0);
+        ++m_numSplinesCreated;
+    }
+    return spline;
+}
+
+TimeSeriesTable StatesReferenceCache::createReference(
+        const TableProcessor& processor, const Model& model,
+        const MocoWeightSet& weights, bool trackPositionDerivatives) {
+    const auto entry = getEntry(processor, model);
+    const TimeSeriesTable& table = *entry->table;
+    const auto& time = table.getIndependentColumn();
+
+    std::vector<std::string> labels;
+    std::vector<SimTK::Vector> columns;
+    const auto stateNames = model.getStateVariableNames();
+    for (int i = 0; i < stateNames.getSize(); ++i) {
+        const std::string& name = stateNames[i];
+        if (getWeight(weights, name) == 0) continue;
+        if (table.hasColumn(name)) {
+            labels.push_back(name);
+            columns.push_back(table.getDependentColumn(name));
+        } else if (trackPositionDerivatives && endsWith(name, "/speed")) {
+            const std::string value =
+                    name.substr(0, name.size() - std::string("speed").size()) +
+                    "value";
+            if (!table.hasColumn(value)) continue;
+            const auto spline = getSpline(*entry, value);
+            SimTK::Vector speed((int)time.size());
+            for (int itime = 0; itime < (int)time.size(); ++itime) {
+                speed[itime] = spline->calcDerivative(
+                        {0}, SimTK::Vector(1, time[itime]));
+            }
+            labels.push_back(name);
+            columns.push_back(speed);
+        }
+    }
+    OPENSIM_THROW_IF(labels.empty(), Exception,
+            "The states reference has no columns for tracked states.");
+
+    SimTK::Matrix matrix((int)time.size(), (int)labels.size());
+    for (int icol = 0; icol < (int)labels.size(); ++icol) {
+        matrix.updCol(icol) = columns[icol];
+    }
+    TimeSeriesTable reference(time, matrix, labels);
+    for (const auto& key : table.getTableMetaDataKeys()) {
+        reference.addTableMetaData(key, table.getTableMetaDataAsString(key));
+    }
+    return reference;
+}
+
+SimTK::Matrix StatesReferenceCache::evaluate(const TableProcessor& processor,
+        const Model& model, const std::vector<std::string>& labels,
+        const SimTK::Vector& times, int derivativeOrder) {
+    OPENSIM_THROW_IF(derivativeOrder < 0 || derivativeOrder > 1, Exception,
+            "Expected a derivative order of 0 or 1.");
+    const auto entry = getEntry(processor, model);
+    SimTK::Matrix values(times.size(), (int)labels.size());
+    for (int icol = 0; icol < (int)labels.size(); ++icol) {
+        const auto spline = getSpline(*entry, labels[icol]);
+        for (int itime = 0; itime < times.size(); ++itime) {
+            const SimTK::Vector x(1, times[itime]);
+            values(itime, icol) = derivativeOrder == 0
+                    ? spline->calcValue(x)
+                    : spline->calcDerivative({0}, x);
+        }
+    }
+    return values;
+}
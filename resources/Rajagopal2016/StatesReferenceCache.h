@@ -0,0 +1,99 @@
+#ifndef MOCOPAPER_STATESREFERENCECACHE_H
+#define MOCOPAPER_STATESREFERENCECACHE_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: StatesReferenceCache.h                                       *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <Moco/osimMoco.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace OpenSim {
+
+/// A cache of state tracking references, shared by problems that track the
+/// same reference table, that builds splines only for the columns that a
+/// problem tracks. The splines are used to compute the reference; the table
+/// returned to each problem is its own copy, which MocoTrack splines again
+/// for its tracking goal (but only in the tracked columns).
+///
+/// MocoTrack splines every column of its states reference, including columns
+/// that do not correspond to model states and columns whose weight is zero,
+/// and it differentiates every coordinate value column when
+/// track_reference_position_derivatives is set. createReference() instead
+/// returns a table with only the tracked columns, with the speed columns
+/// computed here from (cached) splines of the position columns, so the
+/// table can be passed to MocoTrack with
+/// track_reference_position_derivatives disabled:
+///
+/// @code
+/// track.setStatesReference(TableProcessor(cache.createReference(
+///         TableProcessor("coordinates.sto"), model, weights, true)));
+/// track.set_track_reference_position_derivatives(false);
+/// @endcode
+///
+/// Each reference table is processed once (keyed by the serialized
+/// TableProcessor, the contents of its file, and the model's state names),
+/// and each column's spline is created the first time a problem tracks that
+/// column. The splines have the same settings as MocoTrack's (GCVSpline of
+/// degree 5). This class is thread-safe.
+class StatesReferenceCache {
+public:
+    /// The tracked columns of the processed reference: each model state with
+    /// a nonzero weight (weights that are not in the set are 1). If
+    /// trackPositionDerivatives is true, a coordinate speed that the
+    /// reference lacks is the derivative of the spline of the coordinate's
+    /// value. The model must have been initialized with initSystem().
+    TimeSeriesTable createReference(const TableProcessor& processor,
+            const Model& model,
+            const MocoWeightSet& weights = MocoWeightSet(),
+            bool trackPositionDerivatives = false);
+
+    /// Evaluate the splines of the given columns of the processed reference
+    /// (or their first derivatives, if derivativeOrder is 1) at each time.
+    /// Returns a matrix with a row per time and a column per label.
+    SimTK::Matrix evaluate(const TableProcessor& processor, const Model& model,
+            const std::vector<std::string>& labels, const SimTK::Vector& times,
+            int derivativeOrder = 0);
+
+    int getNumTablesProcessed() const { return m_numTablesProcessed; }
+    int getNumSplinesCreated() const { return m_numSplinesCreated; }
+
+private:
+    struct Entry {
+        std::once_flag once;
+        std::unique_ptr<const TimeSeriesTable> table;
+        std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<const GCVSpline>>
+                splines;
+    };
+    std::shared_ptr<Entry> getEntry(
+            const TableProcessor& processor, const Model& model);
+    std::shared_ptr<const GCVSpline> getSpline(
+            Entry& entry, const std::string& label);
+
+    std::mutex m_mutex;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> m_entries;
+    std::atomic<int> m_numTablesProcessed{0};
+    std::atomic<int> m_numSplinesCreated{0};
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_STATESREFERENCECACHE_H
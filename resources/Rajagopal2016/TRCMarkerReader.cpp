@@ -0,0 +1,245 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: TRCMarkerReader.cpp                                          *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "TRCMarkerReader.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+using namespace OpenSim;
+
+namespace {
+
+// Split on tabs, keeping empty fields and trimming spaces around each field.
+std::vector<std::string> splitTabs(const std::string& line) {
+    std::vector<std::string> fields;
+    std::size_t begin = 0;
+    while (true) {
+        const std::size_t end = line.find('\t', begin);
+        std::string field = line.substr(begin,
+                end == std::string::npos ? std::string::npos : end - begin);
+        const auto first = field.find_first_not_of(" \r");
+        const auto last = field.find_last_not_of(" \r");
+        fields.push_back(first == std::string::npos
+                                 ? ""
+                                 : field.substr(first, last - first + 1));
+        if (end == std::string::npos) break;
+        begin = end + 1;
+    }
+    return fields;
+}
+
+double toMeters(const std::string& units) {
+    if (units == "mm") return 1e-3;
+    if (units == "cm") return 1e-2;
+    if (units == "m") return 1;
+    OPENSIM_THROW(Exception, "Unrecognized TRC units '" + units + "'.");
+}
+
+} // anonymous namespace
+
+TRCMarkerReader::TRCMarkerReader(std::string path) : m_path(std::move(path)) {}
+
+void TRCMarkerReader::setTimeWindow(double initialTime, double finalTime) {
+    OPENSIM_THROW_IF(finalTime < initialTime, Exception,
+            "Expected the final time to be at least the initial time.");
+    m_initialTime = initialTime;
+    m_finalTime = finalTime;
+}
+
+void TRCMarkerReader::setMarkerNames(std::vector<std::string> names) {
+    m_selectMarkers = true;
+    m_markerNames = std::set<std::string>(names.begin(), names.end());
+}
+
+void TRCMarkerReader::selectMarkers(
+        const Model& model, const MocoWeightSet& weightSet) {
+    std::vector<std::string> names;
+    const auto& markerSet = model.getMarkerSet();
+    for (int i = 0; i < markerSet.getSize(); ++i) {
+        names.push_back(markerSet.get(i).getName());
+    }
+    for (int i = 0; i < weightSet.getSize(); ++i) {
+        names.push_back(weightSet.get(i).getName());
+    }
+    setMarkerNames(std::move(names));
+}
+
+std::string TRCMarkerReader::calcKey() const {
+    std::stringstream ss;
+    ss.precision(17);
+    ss << m_path << "\n" << m_initialTime << " " << m_finalTime << " "
+       << m_cutoffFrequency << " " << m_padding << "\n";
+    if (m_selectMarkers) {
+        for (const auto& name : m_markerNames) ss << name << "\n";
+    } else {
+        ss << "all markers\n";
+    }
+    return ss.str();
+}
+
+TimeSeriesTable_<SimTK::Vec3> TRCMarkerReader::read() const {
+    std::ifstream stream(m_path);
+    OPENSIM_THROW_IF(!stream, Exception, "Could not open '" + m_path + "'.");
+
+    // Header: the file type line, the names and values of the metadata
+    // (DataRate, Units, etc.), the marker labels, and the X1/Y1/Z1 line.
+    std::string line;
+    std::getline(stream, line);
+    std::string keysLine, valuesLine, labelsLine;
+    std::getline(stream, keysLine);
+    std::getline(stream, valuesLine);
+    std::getline(stream, labelsLine);
+    std::getline(stream, line);
+    OPENSIM_THROW_IF(!stream, Exception,
+            "'" + m_path + "' does not have a complete TRC header.");
+    std::map<std::string, std::string> metadata;
+    {
+        std::vector<std::string> keys, values;
+        for (const auto& key : splitTabs(keysLine)) {
+            if (!key.empty()) keys.push_back(key);
+        }
+        for (const auto& value : splitTabs(valuesLine)) {
+            if (!value.empty()) values.push_back(value);
+        }
+        for (int i = 0; i < (int)std::min(keys.size(), values.size()); ++i) {
+            metadata[keys[i]] = values[i];
+        }
+    }
+    const double scale =
+            toMeters(metadata.count("Units") ? metadata["Units"] : "m");
+
+    // The labels line is "Frame#, Time, marker, , , marker, , , ...". For
+    // each selected marker, record the field index of its X coordinate.
+    std::vector<std::string> labels;
+    std::vector<int> fields;
+    {
+        const auto allLabels = splitTabs(labelsLine);
+        for (int i = 2; i < (int)allLabels.size(); ++i) {
+            const std::string& label = allLabels[i];
+            if (label.empty()) continue;
+            if (m_selectMarkers && !m_markerNames.count(label)) continue;
+            labels.push_back(label);
+            // The X coordinate is in the same field as the label.
+            fields.push_back(i);
+        }
+    }
+    OPENSIM_THROW_IF(labels.empty(), Exception,
+            "None of the selected markers are in '" + m_path + "'.");
+
+    const bool filter = m_cutoffFrequency > 0;
+    const double padding = filter ? m_padding : 0;
+    const double initialTime = m_initialTime - padding;
+    const double finalTime = m_finalTime + padding;
+
+    std::vector<double> times;
+    std::vector<std::vector<double>> rows;
+    const auto appendRow = [&](const std::string& text, double time) {
+        const auto rowFields = splitTabs(text);
+        times.push_back(time);
+        rows.emplace_back(3 * labels.size());
+        std::vector<double>& row = rows.back();
+        for (int im = 0; im < (int)labels.size(); ++im) {
+            for (int ic = 0; ic < 3; ++ic) {
+                const int ifield = fields[im] + ic;
+                const bool present = ifield < (int)rowFields.size() &&
+                                     !rowFields[ifield].empty();
+                row[3 * im + ic] = present
+                                   ? scale * std::stod(rowFields[ifield])
+                                   : SimTK::NaN;
+            }
+        }
+    };
+    // Keep one row on each side of the window so that the reference covers
+    // the whole window.
+    std::string previousLine;
+    double previousTime = SimTK::NaN;
+    while (std::getline(stream, line)) {
+        const std::size_t timeBegin = line.find('\t');
+        if (timeBegin == std::string::npos) continue;
+        // Parse only the time until we reach the window.
+        const char* timeText = line.c_str() + timeBegin + 1;
+        char* end = nullptr;
+        const double time = std::strtod(timeText, &end);
+        if (end == timeText) continue;
+        if (time < initialTime) {
+            previousLine.swap(line);
+            previousTime = time;
+            continue;
+        }
+        if (!previousLine.empty()) {
+            appendRow(previousLine, previousTime);
+            previousLine.clear();
+        }
+        appendRow(line, time);
+        if (time > finalTime) break;
+    }
+    OPENSIM_THROW_IF(times.empty(), Exception,
+            "'" + m_path + "' has no data in the time window.");
+
+    // Filter the selected columns only.
+    std::vector<std::string> flatLabels;
+    for (const auto& label : labels) {
+        for (const auto& suffix : {"_x", "_y", "_z"}) {
+            flatLabels.push_back(label + suffix);
+        }
+    }
+    SimTK::Matrix flat((int)times.size(), (int)flatLabels.size());
+    for (int irow = 0; irow < (int)times.size(); ++irow) {
+        for (int icol = 0; icol < (int)flatLabels.size(); ++icol) {
+            flat(irow, icol) = rows[irow][icol];
+        }
+    }
+    rows.clear();
+    TimeSeriesTable flatTable(times, flat, flatLabels);
+    if (filter) {
+        TableUtilities::filterLowpass(flatTable, m_cutoffFrequency, true);
+    }
+
+    // Drop the padding (keeping one row on each side of the window) and pack
+    // the coordinates into Vec3s.
+    const auto& filteredTimes = flatTable.getIndependentColumn();
+    const auto& filtered = flatTable.getMatrix();
+    int first = 0;
+    while (first + 1 < (int)filteredTimes.size() &&
+            filteredTimes[first + 1] <= m_initialTime) {
+        ++first;
+    }
+    int last = (int)filteredTimes.size() - 1;
+    while (last - 1 > first && filteredTimes[last - 1] >= m_finalTime) {
+        --last;
+    }
+    TimeSeriesTable_<SimTK::Vec3> table;
+    table.setColumnLabels(labels);
+    for (int irow = first; irow <= last; ++irow) {
+        SimTK::RowVector_<SimTK::Vec3> row((int)labels.size());
+        for (int im = 0; im < (int)labels.size(); ++im) {
+            row[im] = SimTK::Vec3(filtered(irow, 3 * im),
+                    filtered(irow, 3 * im + 1), filtered(irow, 3 * im + 2));
+        }
+        table.appendRow(filteredTimes[irow], row);
+    }
+    for (const auto& entry : metadata) {
+        if (entry.first == "Units" || entry.first == "NumFrames") continue;
+        table.addTableMetaData(entry.first, entry.second);
+    }
+    table.addTableMetaData<std::string>("Units", "m");
+    table.addTableMetaData<std::string>(
+            "NumFrames", std::to_string(table.getNumRows()));
+    return table;
+}
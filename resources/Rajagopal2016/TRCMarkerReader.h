@@ -0,0 +1,98 @@
+#ifndef MOCOPAPER_TRCMARKERREADER_H
+#define MOCOPAPER_TRCMARKERREADER_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: TRCMarkerReader.h                                            *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <Moco/osimMoco.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+namespace OpenSim {
+
+/// Read a marker reference from a TRC file, keeping only the markers and the
+/// time window that a tracking problem uses. Like
+/// MocoTrack::setMarkersReferenceFromTRC(), the reference is lowpass-filtered
+/// and in meters, but:
+///   - rows before the time window (minus padding for the filter) are
+///     skipped without parsing their marker values, and reading stops at the
+///     first row after the window (plus padding), so the cost does not grow
+///     with the length of the recording;
+///   - only the selected markers are parsed, converted and filtered, and no
+///     table of all markers is created;
+///   - units are converted while parsing.
+///
+/// Because only the padded window is filtered, the filtered values differ
+/// from MocoTrack's (which filters the whole recording) near the ends of the
+/// window, by an amount that shrinks as the padding grows. With a padding of
+/// SimTK::Infinity, the whole recording is read and filtered, and the values
+/// in the window are those of MocoTrack::setMarkersReferenceFromTRC(). The
+/// table keeps one row on each side of the window, and its "NumFrames"
+/// metadata is the number of rows in the table.
+///
+/// @code
+/// TRCMarkerReader reader("marker_trajectories.trc");
+/// reader.setTimeWindow(0.81, 1.65);
+/// reader.selectMarkers(model, markerWeights);
+/// track.setMarkersReference(reader.read());
+/// @endcode
+class TRCMarkerReader {
+public:
+    explicit TRCMarkerReader(std::string path);
+
+    /// Keep only the rows needed for [initialTime, finalTime]. By default,
+    /// all rows are kept.
+    void setTimeWindow(double initialTime, double finalTime);
+
+    /// Keep only these markers (markers that are not in the file are
+    /// ignored). By default, all markers are kept.
+    void setMarkerNames(std::vector<std::string> names);
+    /// Keep the markers in the model's MarkerSet and the markers that have a
+    /// weight in the weight set.
+    void selectMarkers(const Model& model,
+            const MocoWeightSet& weightSet = MocoWeightSet());
+
+    /// The cutoff frequency (Hz) of the lowpass filter. If zero or negative,
+    /// the data is not filtered. The default is 6 Hz, as in MocoTrack.
+    void setLowpassCutoffFrequency(double frequency) {
+        m_cutoffFrequency = frequency;
+    }
+    /// Extra data (seconds) read on each side of the time window so that the
+    /// filter's edge effects fall outside of the window. The default is 0.5.
+    /// Use SimTK::Infinity to filter the whole recording.
+    void setFilterPadding(double seconds) { m_padding = seconds; }
+
+    /// Read the file. The table's "Units" metadata is "m".
+    TimeSeriesTable_<SimTK::Vec3> read() const;
+
+    /// A string that identifies the file and the settings, so that readers
+    /// with the same key produce the same table (see ReferenceDataStore).
+    std::string calcKey() const;
+
+private:
+    std::string m_path;
+    double m_initialTime = -SimTK::Infinity;
+    double m_finalTime = SimTK::Infinity;
+    bool m_selectMarkers = false;
+    std::set<std::string> m_markerNames;
+    double m_cutoffFrequency = 6;
+    double m_padding = 0.5;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_TRCMARKERREADER_H
@@ -0,0 +1,312 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: TrajectoryDynamicsEvaluator.cpp                              *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "TrajectoryDynamicsEvaluator.h"
+
+#include "ModelNameIndex.h"
+
+#include <algorithm>
+#include <regex>
+#include <unordered_map>
+
+using namespace OpenSim;
+
+namespace {
+
+// For each name, the index of the same name in `columns`, or -1.
+std::vector<int> createColumnMap(const std::vector<std::string>& names,
+        const std::vector<std::string>& columns) {
+    std::unordered_map<std::string, int> indices;
+    for (int i = 0; i < (int)columns.size(); ++i) indices[columns[i]] = i;
+    std::vector<int> map;
+    for (const auto& name : names) {
+        const auto it = indices.find(name);
+        map.push_back(it == indices.end() ? -1 : it->second);
+    }
+    return map;
+}
+
+} // anonymous namespace
+
+TrajectoryDynamicsEvaluator::TrajectoryDynamicsEvaluator(
+        const Model& model, std::shared_ptr<WorkStealingPool> pool)
+        : m_model(model), m_pool(std::move(pool)) {
+    if (!m_pool) m_pool = std::make_shared<WorkStealingPool>();
+    m_contexts.resize(m_pool->getNumThreads());
+
+    const SimTK::State& state = m_model.initSystem();
+    const ModelNameIndex names(m_model);
+    m_stateNames = names.getStateNames();
+    m_controlNames = names.getControlNames();
+    m_defaultStates = m_model.getStateVariableValues(state);
+    m_defaultControls = m_model.getDefaultControls();
+}
+
+TrajectoryDynamicsEvaluator::Context& TrajectoryDynamicsEvaluator::getContext(
+        int worker) {
+    auto& context = m_contexts[worker];
+    if (!context) {
+        context.reset(new Context());
+        context->model.reset(m_model.clone());
+        context->state = context->model->initSystem();
+    }
+    return *context;
+}
+
+TimeSeriesTable TrajectoryDynamicsEvaluator::evaluate(
+        const MocoTrajectory& trajectory,
+        const std::vector<std::string>& labels,
+        const std::function<void(const Model&, const SimTK::State&, int,
+                SimTK::RowVector&)>& f) {
+    return evaluateContexts(trajectory, labels,
+            [&](Context& context, int itime, SimTK::RowVector& row) {
+                f(*context.model, context.state, itime, row);
+            });
+}
+
+TimeSeriesTable TrajectoryDynamicsEvaluator::evaluateContexts(
+        const MocoTrajectory& trajectory,
+        const std::vector<std::string>& labels,
+        const std::function<void(Context&, int, SimTK::RowVector&)>& f) {
+    const SimTK::Vector time = trajectory.getTime();
+    const SimTK::Matrix& states = trajectory.getStatesTrajectory();
+    const SimTK::Matrix& controls = trajectory.getControlsTrajectory();
+    const std::vector<int> stateMap =
+            createColumnMap(m_stateNames, trajectory.getStateNames());
+    const std::vector<int> controlMap =
+            createColumnMap(m_controlNames, trajectory.getControlNames());
+
+    SimTK::Matrix values(time.size(), (int)labels.size());
+    m_pool->parallelFor(time.size(), [&](int itime, int worker) {
+        Context& context = getContext(worker);
+        const Model& model = *context.model;
+        SimTK::State& state = context.state;
+
+        state.setTime(time[itime]);
+        SimTK::Vector stateValues = m_defaultStates;
+        for (int i = 0; i < (int)stateMap.size(); ++i) {
+            if (stateMap[i] >= 0) stateValues[i] = states(itime, stateMap[i]);
+        }
+        model.setStateVariableValues(state, stateValues);
+
+        SimTK::Vector controlValues = m_defaultControls;
+        for (int i = 0; i < (int)controlMap.size(); ++i) {
+            if (controlMap[i] >= 0) {
+                controlValues[i] = controls(itime, controlMap[i]);
+            }
+        }
+        model.realizeVelocity(state);
+        model.setControls(state, controlValues);
+        model.realizeAcceleration(state);
+
+        SimTK::RowVector row((int)labels.size(), 0.0);
+        f(context, itime, row);
+        values[itime] = row;
+    });
+
+    std::vector<double> times(time.size());
+    for (int itime = 0; itime < time.size(); ++itime) times[itime] = time[itime];
+    return TimeSeriesTable(times, values, labels);
+}
+
+TimeSeriesTable TrajectoryDynamicsEvaluator::calcStateDerivatives(
+        const MocoTrajectory& trajectory) {
+    return evaluate(trajectory, m_stateNames,
+            [](const Model& model, const SimTK::State& state, int,
+                    SimTK::RowVector& row) {
+                const SimTK::Vector derivatives =
+                        model.getStateVariableDerivativeValues(state);
+                for (int i = 0; i < derivatives.size(); ++i) {
+                    row[i] = derivatives[i];
+                }
+            });
+}
+
+TimeSeriesTable TrajectoryDynamicsEvaluator::analyze(
+        const MocoTrajectory& trajectory,
+        const std::vector<std::string>& outputPaths) {
+    std::vector<std::regex> patterns;
+    for (const auto& path : outputPaths) patterns.emplace_back(path);
+
+    // Find the matching Outputs in the evaluator's model; the workers find
+    // the same Outputs in their copies of the model.
+    std::vector<std::string> componentPaths;
+    std::vector<std::string> outputNames;
+    std::vector<int> numColumns;
+    std::vector<std::string> labels;
+    for (const auto& component : m_model.getComponentList()) {
+        for (const auto& name : component.getOutputNames()) {
+            const AbstractOutput& output = component.getOutput(name);
+            const std::string path = output.getPathName();
+            if (std::none_of(patterns.begin(), patterns.end(),
+                        [&](const std::regex& pattern) {
+                            return std::regex_match(path, pattern);
+                        })) {
+                continue;
+            }
+            int n = 0;
+            if (dynamic_cast<const Output<double>*>(&output)) {
+                n = 1;
+            } else if (dynamic_cast<const Output<SimTK::Vec3>*>(&output)) {
+                n = 3;
+            } else if (dynamic_cast<const Output<SimTK::SpatialVec>*>(
+                               &output)) {
+                n = 6;
+            } else {
+                continue;
+            }
+            componentPaths.push_back(component.getAbsolutePathString());
+            outputNames.push_back(name);
+            numColumns.push_back(n);
+            if (n == 1) {
+                labels.push_back(path);
+            } else {
+                for (int i = 0; i < n; ++i) {
+                    labels.push_back(path + "_" + std::to_string(i + 1));
+                }
+            }
+        }
+    }
+    for (auto& context : m_contexts) {
+        if (context) context->outputs.clear();
+    }
+
+    return evaluateContexts(trajectory, labels,
+            [&](Context& context, int, SimTK::RowVector& row) {
+                const Model& model = *context.model;
+                const SimTK::State& state = context.state;
+                auto& outputs = context.outputs;
+                if (outputs.size() != componentPaths.size()) {
+                    outputs.clear();
+                    for (int i = 0; i < (int)componentPaths.size(); ++i) {
+                        outputs.push_back(&model.getComponent(componentPaths[i])
+                                                   .getOutput(outputNames[i]));
+                    }
+                }
+                int icol = 0;
+                for (int i = 0; i < (int)outputs.size(); ++i) {
+                    if (numColumns[i] == 1) {
+                        row[icol] = static_cast<const Output<double>*>(
+                                outputs[i])->getValue(state);
+                    } else if (numColumns[i] == 3) {
+                        const SimTK::Vec3& value =
+                                static_cast<const Output<SimTK::Vec3>*>(
+                                        outputs[i])->getValue(state);
+                        for (int j = 0; j < 3; ++j) row[icol + j] = value[j];
+                    } else {
+                        const SimTK::SpatialVec& value =
+                                static_cast<const Output<SimTK::SpatialVec>*>(
+                                        outputs[i])->getValue(state);
+                        for (int j = 0; j < 3; ++j) {
+                            row[icol + j] = value[0][j];
+                            row[icol + 3 + j] = value[1][j];
+                        }
+                    }
+                    icol += numColumns[i];
+                }
+            });
+}
+
+TimeSeriesTable TrajectoryDynamicsEvaluator::calcGeneralizedForces(
+        const MocoTrajectory& trajectory) {
+    // The coordinates are in the order of the generalized speeds.
+    const auto coordinates = m_model.getCoordinatesInMultibodyTreeOrder();
+    OPENSIM_THROW_IF((int)coordinates.size() !=
+                             m_model.getWorkingState().getNU(),
+            Exception,
+            "Expected one generalized speed per coordinate (no quaternions).");
+    const SimTK::Vector time = trajectory.getTime();
+    OPENSIM_THROW_IF(time.size() < 6, Exception,
+            "Expected at least 6 time points to spline the speeds (with "
+            "degree 5), but the trajectory has " +
+                    std::to_string(time.size()) + ".");
+
+    // The columns are in the order of the CoordinateSet, as in the
+    // InverseDynamicsTool's output; columnOfSpeed[i] is the column of the
+    // i-th generalized speed.
+    const CoordinateSet& coordinateSet = m_model.getCoordinateSet();
+    std::vector<std::string> labels;
+    std::vector<int> columnOfSpeed(coordinates.size(), -1);
+    for (int icol = 0; icol < coordinateSet.getSize(); ++icol) {
+        const Coordinate& coordinate = coordinateSet.get(icol);
+        labels.push_back(coordinate.getName() +
+                         (coordinate.getMotionType() == Coordinate::Rotational
+                                         ? "_moment"
+                                         : "_force"));
+        for (int i = 0; i < (int)coordinates.size(); ++i) {
+            if (coordinates[i].get() == &coordinate) columnOfSpeed[i] = icol;
+        }
+    }
+
+    // Differentiate the splined speeds. Speeds that the trajectory lacks
+    // (e.g., those prescribed by a PositionMotion in a MocoInverse solution)
+    // keep the accelerations of the realized state.
+    const std::vector<std::string> stateNames = trajectory.getStateNames();
+    std::vector<bool> splined(coordinates.size(), false);
+    SimTK::Matrix accelerations(time.size(), (int)coordinates.size(), 0.0);
+    for (int i = 0; i < (int)coordinates.size(); ++i) {
+        const Coordinate& coordinate = *coordinates[i];
+        const std::string speedName =
+                coordinate.getAbsolutePathString() + "/speed";
+        if (std::find(stateNames.begin(), stateNames.end(), speedName) ==
+                stateNames.end()) {
+            continue;
+        }
+        // GCVSpline requires contiguous values.
+        const SimTK::Vector speed = trajectory.getState(speedName);
+        const GCVSpline spline(
+                5, time.size(), &time[0], &speed[0], speedName, 0);
+        for (int itime = 0; itime < time.size(); ++itime) {
+            accelerations(itime, i) = spline.calcDerivative(
+                    {0}, SimTK::Vector(1, time[itime]));
+        }
+        splined[i] = true;
+    }
+
+    return evaluateContexts(trajectory, labels,
+            [&](Context& context, int itime, SimTK::RowVector& row) {
+                const Model& model = *context.model;
+                SimTK::State& state = context.state;
+                SimTK::Vector udot = state.getUDot();
+                for (int i = 0; i < (int)splined.size(); ++i) {
+                    if (splined[i]) udot[i] = accelerations(itime, i);
+                }
+
+                // Exclude the actuators, as the InverseDynamicsTool does
+                // with "ACTUATORS". Whether a force is applied is part of
+                // the state, so it is restored for later time points.
+                std::vector<const Actuator*> disabled;
+                for (const auto& actuator :
+                        model.getComponentList<Actuator>()) {
+                    if (actuator.appliesForce(state)) {
+                        actuator.setAppliesForce(state, false);
+                        disabled.push_back(&actuator);
+                    }
+                }
+                if (!context.inverseDynamicsSolver) {
+                    context.inverseDynamicsSolver.reset(
+                            new InverseDynamicsSolver(model));
+                }
+                const SimTK::Vector forces =
+                        context.inverseDynamicsSolver->solve(state, udot);
+                for (const auto* actuator : disabled) {
+                    actuator->setAppliesForce(state, true);
+                }
+                for (int i = 0; i < forces.size(); ++i) {
+                    row[columnOfSpeed[i]] = forces[i];
+                }
+            });
+}
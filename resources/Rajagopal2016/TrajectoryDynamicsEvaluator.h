@@ -0,0 +1,117 @@
+#ifndef MOCOPAPER_TRAJECTORYDYNAMICSEVALUATOR_H
+#define MOCOPAPER_TRAJECTORYDYNAMICSEVALUATOR_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: TrajectoryDynamicsEvaluator.h                                *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "WorkStealingPool.h"
+
+#include <Moco/osimMoco.h>
+#include <Simulation/InverseDynamicsSolver.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace OpenSim {
+
+/// Evaluate the model's dynamics at every time point of a MocoTrajectory in
+/// parallel, using a WorkStealingPool. Each worker keeps its own copy of the
+/// model and a SimTK::State, which are created on the worker's first time
+/// point and reused for later time points and later calls, so no locking or
+/// model copying happens per time point. Time points whose dynamics are
+/// costlier (e.g., stiff tendons or foot contact) are balanced by stealing
+/// rather than by a fixed split of the time points across threads. With a
+/// pool whose workers are pinned to NUMA nodes (see WorkStealingPool), each
+/// worker's model copy and state are allocated by the worker itself, and so
+/// on its node's memory, and steals prefer workers of the same node.
+///
+/// The trajectory's states and controls are matched to the model's by name;
+/// states and controls that the trajectory lacks keep their default values.
+class TrajectoryDynamicsEvaluator {
+public:
+    /// The model is copied; it must have been finalized (e.g., processed by
+    /// a ModelProcessor or had initSystem() called).
+    explicit TrajectoryDynamicsEvaluator(const Model& model,
+            std::shared_ptr<WorkStealingPool> pool = nullptr);
+
+    /// The derivative of every state variable at each time point of the
+    /// trajectory. The columns are labeled by the names of the state
+    /// variables (in the order of Model::getStateVariableNames()).
+    TimeSeriesTable calcStateDerivatives(const MocoTrajectory& trajectory);
+
+    /// Compute any per-time-point quantity: f(model, state, itime, row)
+    /// receives the worker's model and a state realized to Acceleration at
+    /// time point itime, and fills `row` (of length labels.size()).
+    TimeSeriesTable evaluate(const MocoTrajectory& trajectory,
+            const std::vector<std::string>& labels,
+            const std::function<void(const Model&, const SimTK::State&,
+                    int itime, SimTK::RowVector& row)>& f);
+
+    /// The parallel equivalent of OpenSim::analyze(): the value of every
+    /// Output whose path ("<component path>|<output name>") matches one of
+    /// the regular expressions, at each time point of the trajectory. The
+    /// columns are labeled by the Output paths. Outputs of type double,
+    /// SimTK::Vec3 and SimTK::SpatialVec are supported; Vec3 and SpatialVec
+    /// Outputs are flattened into 3 and 6 columns with the suffixes _1, _2,
+    /// ..., as by TimeSeriesTable_::flatten(). For example, the knee
+    /// reactions are the Outputs matching ".*walker_knee.*reaction_on_parent".
+    TimeSeriesTable analyze(const MocoTrajectory& trajectory,
+            const std::vector<std::string>& outputPaths);
+
+    /// The net generalized forces that the actuators (including muscles)
+    /// must apply to produce the trajectory's motion, as computed by the
+    /// InverseDynamicsTool with the actuators excluded. The generalized
+    /// accelerations are the derivatives of splined generalized speeds,
+    /// which requires at least 6 time points. The columns are labeled by
+    /// coordinate name with the suffix "_moment" or "_force", in the order
+    /// of the model's CoordinateSet, as in the InverseDynamicsTool's
+    /// output.
+    TimeSeriesTable calcGeneralizedForces(const MocoTrajectory& trajectory);
+
+    WorkStealingPool& updPool() { return *m_pool; }
+
+private:
+    struct Context {
+        std::unique_ptr<Model> model;
+        SimTK::State state;
+        /// The Outputs of the current analyze() call, found in this
+        /// worker's model on the worker's first time point.
+        std::vector<const AbstractOutput*> outputs;
+        /// For calcGeneralizedForces(), created on the worker's first time
+        /// point.
+        std::unique_ptr<InverseDynamicsSolver> inverseDynamicsSolver;
+    };
+    Context& getContext(int worker);
+
+    /// evaluate(), with f also receiving the worker's context.
+    TimeSeriesTable evaluateContexts(const MocoTrajectory& trajectory,
+            const std::vector<std::string>& labels,
+            const std::function<void(Context& context, int itime,
+                    SimTK::RowVector& row)>& f);
+
+    Model m_model;
+    std::vector<std::string> m_stateNames;
+    std::vector<std::string> m_controlNames;
+    SimTK::Vector m_defaultStates;
+    SimTK::Vector m_defaultControls;
+    std::shared_ptr<WorkStealingPool> m_pool;
+    std::vector<std::unique_ptr<Context>> m_contexts;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_TRAJECTORYDYNAMICSEVALUATOR_H
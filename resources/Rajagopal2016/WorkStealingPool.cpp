@@ -0,0 +1,177 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: WorkStealingPool.cpp                                         *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "WorkStealingPool.h"
+
+#include "NumaTopology.h"
+
+#include <algorithm>
+
+using namespace OpenSim;
+
+WorkStealingPool::WorkStealingPool(int numThreads, bool pinToNumaNodes) {
+    if (numThreads <= 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < numThreads; ++i) {
+        m_queues.emplace_back(new Queue());
+    }
+
+    // Divide the workers among the nodes in proportion to their CPUs.
+    m_nodes.assign(numThreads, 0);
+    std::vector<std::vector<int>> cpus(numThreads);
+    if (pinToNumaNodes) {
+        const NumaTopology topology;
+        m_numNodes = topology.getNumNodes();
+        const int numCpus = topology.getNumCpus();
+        int firstCpu = 0;
+        for (int node = 0; node < m_numNodes; ++node) {
+            const int lastCpu = firstCpu + (int)topology.getCpus(node).size();
+            for (int i = 0; i < numThreads; ++i) {
+                const long long cpu = (long long)i * numCpus / numThreads;
+                if (cpu >= firstCpu && cpu < lastCpu) {
+                    m_nodes[i] = node;
+                    cpus[i] = topology.getCpus(node);
+                }
+            }
+            firstCpu = lastCpu;
+        }
+    }
+    for (int i = 0; i < numThreads; ++i) {
+        std::vector<int> order;
+        for (int offset = 0; offset < numThreads; ++offset) {
+            const int j = (i + offset) % numThreads;
+            if (m_nodes[j] == m_nodes[i]) order.push_back(j);
+        }
+        for (int offset = 0; offset < numThreads; ++offset) {
+            const int j = (i + offset) % numThreads;
+            if (m_nodes[j] != m_nodes[i]) order.push_back(j);
+        }
+        m_queueOrders.push_back(order);
+    }
+
+    for (int i = 0; i < numThreads; ++i) {
+        const std::vector<int> workerCpus = cpus[i];
+        m_threads.emplace_back([this, i, workerCpus] {
+            if (!workerCpus.empty()) {
+                NumaTopology::pinCurrentThread(workerCpus);
+            }
+            run(i);
+        });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_taskAdded.notify_all();
+    for (auto& thread : m_threads) { thread.join(); }
+}
+
+void WorkStealingPool::push(int iqueue, Task task) {
+    {
+        // Count the task before a worker can pop it (which also holds the
+        // queue's lock while it decrements the counts), so that the counts
+        // never go negative and wait() cannot see zero pending tasks early.
+        // The locks are taken in the same order as in pop().
+        std::lock_guard<std::mutex> lock(m_queues[iqueue]->mutex);
+        std::lock_guard<std::mutex> countLock(m_mutex);
+        m_queues[iqueue]->tasks.push_back(std::move(task));
+        ++m_numQueued;
+        ++m_numPending;
+    }
+    m_taskAdded.notify_one();
+}
+
+void WorkStealingPool::submit(Task task) {
+    push((int)(m_nextQueue++ % m_queues.size()), std::move(task));
+}
+
+bool WorkStealingPool::pop(int worker, Task& task) {
+    for (const int iqueue : m_queueOrders[worker]) {
+        Queue& queue = *m_queues[iqueue];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) continue;
+        if (iqueue == worker) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        } else {
+            // Steal from the back, away from where the owner is working.
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            ++m_numStolen;
+            if (m_nodes[iqueue] != m_nodes[worker]) ++m_numStolenAcrossNodes;
+        }
+        std::lock_guard<std::mutex> countLock(m_mutex);
+        --m_numQueued;
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::run(int worker) {
+    while (true) {
+        Task task;
+        if (pop(worker, task)) {
+            try {
+                task(worker);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_exception) m_exception = std::current_exception();
+            }
+            bool idle;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                idle = --m_numPending == 0;
+            }
+            if (idle) m_idle.notify_all();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_taskAdded.wait(lock, [&] { return m_stop || m_numQueued > 0; });
+        if (m_stop && m_numQueued == 0) return;
+    }
+}
+
+void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [&] { return m_numPending == 0; });
+    if (m_exception) {
+        std::exception_ptr exception = m_exception;
+        m_exception = nullptr;
+        std::rethrow_exception(exception);
+    }
+}
+
+void WorkStealingPool::parallelFor(int n,
+        const std::function<void(int index, int worker)>& f, int grainSize) {
+    if (n <= 0) return;
+    grainSize = std::max(1, grainSize);
+    const int numBlocks = (n + grainSize - 1) / grainSize;
+    const int numQueues = (int)m_queues.size();
+    for (int iblock = 0; iblock < numBlocks; ++iblock) {
+        const int begin = iblock * grainSize;
+        const int end = std::min(n, begin + grainSize);
+        // Give each queue a contiguous range of blocks.
+        const int iqueue = (int)((long long)iblock * numQueues / numBlocks);
+        push(iqueue, [&f, begin, end](int worker) {
+            for (int index = begin; index < end; ++index) f(index, worker);
+        });
+    }
+    wait();
+}
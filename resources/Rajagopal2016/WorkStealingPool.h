@@ -0,0 +1,130 @@
+#ifndef MOCOPAPER_WORKSTEALINGPOOL_H
+#define MOCOPAPER_WORKSTEALINGPOOL_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: WorkStealingPool.h                                           *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace OpenSim {
+
+/// A fixed set of worker threads, each with its own queue of tasks. A worker
+/// takes tasks from the front of its own queue; once its queue is empty, it
+/// steals tasks from the back of the other workers' queues. This balances
+/// work whose cost is uneven (e.g., evaluating the dynamics at time points
+/// during contact versus swing) without a shared queue that every task goes
+/// through.
+///
+/// Each task receives the index of the worker that runs it (in [0,
+/// getNumThreads())), so that tasks can use per-worker resources, such as a
+/// copy of a Model and a SimTK::State, without locking:
+/// @code
+/// WorkStealingPool pool;
+/// std::vector<std::unique_ptr<Model>> models(pool.getNumThreads());
+/// pool.parallelFor(numTimes, [&](int itime, int worker) {
+///     if (!models[worker]) models[worker].reset(model.clone());
+///     ...
+/// });
+/// @endcode
+///
+/// On machines with multiple NUMA nodes (sockets), the pool can pin its
+/// workers to the nodes (see NumaTopology): the workers are divided among the
+/// nodes in proportion to their CPUs, with consecutive workers on the same
+/// node, and a worker steals from workers on its own node before those on
+/// other nodes. Per-worker resources created within a task (as above) are
+/// then allocated on the worker's node, and parallelFor() gives the workers
+/// of each node a contiguous range of indices.
+class WorkStealingPool {
+public:
+    using Task = std::function<void(int worker)>;
+
+    /// @param numThreads If zero, the number of hardware threads is used.
+    /// @param pinToNumaNodes Pin each worker to the CPUs of a NUMA node.
+    explicit WorkStealingPool(int numThreads = 0, bool pinToNumaNodes = false);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    int getNumThreads() const { return (int)m_threads.size(); }
+
+    /// Queue a task. Tasks are dealt to the workers' queues in turn.
+    void submit(Task task);
+
+    /// Block until all submitted tasks have finished. If any task threw an
+    /// exception, the first such exception is rethrown here (the remaining
+    /// tasks still run).
+    void wait();
+
+    /// Call f(index, worker) for each index in [0, n), and wait for all calls
+    /// to finish. Contiguous blocks of `grainSize` indices form one task, and
+    /// neighboring blocks start in the same worker's queue, so that a worker
+    /// evaluates neighboring indices unless it steals. This must not be
+    /// called from within a task.
+    void parallelFor(int n, const std::function<void(int index, int worker)>& f,
+            int grainSize = 1);
+
+    /// The number of tasks that were run by a worker other than the one
+    /// whose queue they were placed on.
+    long long getNumStolen() const { return m_numStolen; }
+    /// The number of stolen tasks whose queue belonged to a worker on another
+    /// NUMA node; these tasks read and write the other node's memory.
+    long long getNumStolenAcrossNodes() const {
+        return m_numStolenAcrossNodes;
+    }
+    /// The NUMA node of a worker (0 if the workers are not pinned).
+    int getNode(int worker) const { return m_nodes[worker]; }
+    int getNumNodes() const { return m_numNodes; }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    void push(int iqueue, Task task);
+    bool pop(int worker, Task& task);
+    void run(int worker);
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    std::vector<int> m_nodes;
+    int m_numNodes = 1;
+    /// For each worker, the queues to take tasks from, in order: its own,
+    /// then those of the workers on its node, then the others.
+    std::vector<std::vector<int>> m_queueOrders;
+    std::atomic<unsigned> m_nextQueue{0};
+    std::atomic<long long> m_numStolen{0};
+    std::atomic<long long> m_numStolenAcrossNodes{0};
+
+    std::mutex m_mutex;
+    std::condition_variable m_taskAdded;
+    std::condition_variable m_idle;
+    // Tasks in the queues, and tasks in the queues or running.
+    int m_numQueued = 0;
+    int m_numPending = 0;
+    bool m_stop = false;
+    std::exception_ptr m_exception;
+};
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_WORKSTEALINGPOOL_H
@@ -0,0 +1,203 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: benchmarkMocoTrack.cpp                                       *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+/// Benchmark the two tracking problems from exampleMocoTrack.cpp at small,
+/// medium and large mesh sizes with a fixed number of threads. Each solve
+/// starts from the default guess on a single mesh, and appends one row to the
+/// CSV file in the format written by code/benchmark.py (see COLUMNS there),
+/// so that the C++ and Python benchmarks can be compared directly.
+///
+/// Usage: benchmarkMocoTrack [num_threads [output_csv [sizes...]]]
+///
+/// Build it (and the examples) with the CMakeLists.txt in this directory.
+///
+/// The defaults are 4 threads, benchmark.csv, and all sizes. An existing
+/// file with a different header (e.g., an older format version) is moved
+/// aside to <name>.v<version>.csv instead of being appended to. To remove
+/// the known differences in the results between thread counts, run the
+/// benchmark in the deterministic environment of code/deterministic.py:
+///
+///     python3 code/deterministic.py benchmarkMocoTrack 8
+
+#include "exampleMocoTrackJobs.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#ifndef _WIN32
+    #include <sys/utsname.h>
+    #include <unistd.h>
+#endif
+
+using namespace OpenSim;
+
+namespace {
+
+const int formatVersion = 2;
+const std::string header = "format_version,moco_version,host,processor,"
+                           "problem,size,num_mesh_intervals,num_threads,"
+                           "repeat,success,num_iterations,solver_duration,"
+                           "time_per_iteration,wall_time,objective,"
+                           "deterministic";
+const std::vector<std::string> sizes = {"small", "medium", "large"};
+
+struct Problem {
+    std::string name;
+    std::function<MocoTrackJob()> createJob;
+    std::vector<int> numMeshIntervals;
+};
+
+std::string getHostName() {
+#ifndef _WIN32
+    char name[256] = {};
+    if (gethostname(name, sizeof(name) - 1) == 0) return name;
+#endif
+    return "";
+}
+
+std::string getProcessor() {
+#ifndef _WIN32
+    struct utsname info;
+    if (uname(&info) == 0) return info.machine;
+#endif
+    return "";
+}
+
+/// Whether the process runs in code/deterministic.py's environment.
+bool isDeterministic() {
+    const char* flag = std::getenv("MOCOPAPER_DETERMINISTIC");
+    return flag && std::string(flag) == "1";
+}
+
+bool exists(const std::string& path) {
+    return std::ifstream(path).good();
+}
+
+/// Move an existing file whose header differs from ours to
+/// <name>.v<version><extension>, as code/benchmark.py's rotate() does, so
+/// that rows of different formats are never mixed in one file.
+void rotate(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) return;
+    std::string firstLine, secondLine;
+    std::getline(file, firstLine);
+    std::getline(file, secondLine);
+    file.close();
+    if (!firstLine.empty() && firstLine.back() == '\r') firstLine.pop_back();
+    if (firstLine == header) return;
+
+    std::string version = "unknown";
+    if (firstLine.compare(0, 15, "format_version,") == 0 &&
+            !secondLine.empty()) {
+        version = secondLine.substr(0, secondLine.find(','));
+    }
+    const auto dot = path.rfind('.');
+    const auto slash = path.find_last_of("/\\");
+    const bool hasExtension = dot != std::string::npos &&
+            (slash == std::string::npos || dot > slash);
+    const std::string stem = hasExtension ? path.substr(0, dot) : path;
+    const std::string extension = hasExtension ? path.substr(dot) : "";
+    std::string rotated = stem + ".v" + version + extension;
+    for (int count = 1; exists(rotated); ++count) {
+        rotated = stem + ".v" + version + "-" + std::to_string(count) +
+                  extension;
+    }
+    OPENSIM_THROW_IF(std::rename(path.c_str(), rotated.c_str()) != 0,
+            Exception, "Could not move '" + path + "' to '" + rotated + "'.");
+    std::cout << "Moved " << path << ", which has a different header, to "
+              << rotated << "." << std::endl;
+}
+
+std::string format(double value, int precision, bool scientific = false) {
+    std::stringstream ss;
+    if (scientific) ss << std::scientific;
+    else ss << std::fixed;
+    ss << std::setprecision(precision) << value;
+    return ss.str();
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+
+    const int numThreads = argc > 1 ? std::atoi(argv[1]) : 4;
+    const std::string output = argc > 2 ? argv[2] : "benchmark.csv";
+    std::vector<std::string> requestedSizes(argv + std::min(argc, 3),
+            argv + argc);
+    if (requestedSizes.empty()) requestedSizes = sizes;
+
+    const std::vector<Problem> problems = {
+            {"torque-driven-marker-tracking",
+                    createTorqueDrivenMarkerTrackingJob, {10, 20, 40}},
+            {"muscle-driven-state-tracking",
+                    createMuscleDrivenStateTrackingJob, {5, 10, 20}}};
+
+    rotate(output);
+    const bool newFile = !exists(output);
+    std::ofstream csv(output, std::ios::app);
+    OPENSIM_THROW_IF(!csv, Exception, "Could not write '" + output + "'.");
+    if (newFile) csv << header << std::endl;
+
+    bool success = true;
+    for (const auto& problem : problems) {
+        for (const auto& size : requestedSizes) {
+            const auto it = std::find(sizes.begin(), sizes.end(), size);
+            OPENSIM_THROW_IF(it == sizes.end(), Exception,
+                    "Unrecognized size '" + size + "'.");
+            const int numMeshIntervals =
+                    problem.numMeshIntervals[it - sizes.begin()];
+
+            MocoTrackJob job = problem.createJob();
+            job.name = "benchmark_" + job.name + "_" + size;
+            job.mesh_interval =
+                    (job.final_time - job.initial_time) / numMeshIntervals;
+            // Solve cold on a single mesh.
+            job.coarse_mesh_intervals.clear();
+
+            // A batch with a single job gives the job all of the threads.
+            MocoTrackBatch batch(numThreads);
+            batch.addJob(job);
+            const MocoTrackBatchResult result = batch.solve()[0];
+            const MocoSolution& solution = result.solution;
+            // The solution is empty if the job threw an exception.
+            const bool solved = solution.getNumTimes() > 0;
+            const int numIterations = solved ? solution.getNumIterations() : 0;
+            const double solverDuration =
+                    solved ? solution.getSolverDuration() : 0;
+            const double objective =
+                    solved ? solution.getObjective() : SimTK::NaN;
+
+            csv << formatVersion << "," << GetMocoVersion() << ","
+                << getHostName() << "," << getProcessor() << ","
+                << problem.name << "," << size << "," << numMeshIntervals
+                << "," << numThreads << ",0," << (result.success ? 1 : 0)
+                << "," << numIterations << "," << format(solverDuration, 6)
+                << ","
+                << format(solverDuration / std::max(numIterations, 1), 6)
+                << "," << format(result.duration, 6) << ","
+                << format(objective, 12, true) << ","
+                << (isDeterministic() ? 1 : 0) << std::endl;
+            success = success && result.success;
+        }
+    }
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
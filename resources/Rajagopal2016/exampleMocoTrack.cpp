@@ -22,6 +22,13 @@
 ///    to solve a torque-driven marker tracking problem. 
 ///  - The second problem shows how to customize a muscle-driven state tracking 
 ///    problem using more advanced features of the tool interface.
+///
+/// Usage: exampleMocoTrack [--headless]
+///
+/// With --headless, the solutions are not shown in the Simbody visualizer,
+/// which waits for the window to be closed. exampleMocoTrackAdvanced.cpp
+/// solves the muscle-driven problem again with profiling, mesh refinement,
+/// checkpointing and other tools for long solves.
 /// 
 /// Data and model source: https://simtk.org/projects/full_body
 /// 
@@ -41,12 +48,14 @@
 /// model distribution. The coordinates were computed using inverse kinematics
 /// and modified via the Residual Reduction Algorithm (RRA). 
 
+#include "ModelNameIndex.h"
+
 #include <Moco/osimMoco.h>
 #include <Actuators/CoordinateActuator.h>
 
 using namespace OpenSim;
 
-void torqueDrivenMarkerTracking() {
+void torqueDrivenMarkerTracking(bool visualize) {
 
     // Create and name an instance of the MocoTrack tool.
     MocoTrack track;
@@ -110,10 +119,10 @@ void torqueDrivenMarkerTracking() {
     track.set_mesh_interval(0.05);
 
     // Solve! The boolean argument indicates to visualize the solution.
-    MocoSolution solution = track.solve(true);
+    MocoSolution solution = track.solve(visualize);
 }
 
-void muscleDrivenStateTracking() {
+void muscleDrivenStateTracking(bool visualize) {
 
     // Create and name an instance of the MocoTrack tool.
     MocoTrack track;
@@ -131,7 +140,12 @@ void muscleDrivenStateTracking() {
             ModOpIgnorePassiveFiberForcesDGF() |
             // Only valid for DeGrooteFregly2016Muscles.
             ModOpScaleActiveFiberForceCurveWidthDGF(1.5);
-    track.setModel(modelProcessor);
+
+    // Process the model once here so that we can also use it below to find
+    // the pelvis CoordinateActuators. A ModelProcessor can also be created
+    // from an already-processed model.
+    Model model = modelProcessor.process();
+    track.setModel(ModelProcessor(model));
 
     // Construct a TableProcessor of the coordinate data and pass it to the 
     // tracking tool. TableProcessors can be used in the same way as
@@ -169,30 +183,32 @@ void muscleDrivenStateTracking() {
     // Put a large weight on the pelvis CoordinateActuators, which act as the
     // residual, or 'hand-of-god', forces which we would like to keep as small
     // as possible.
-     Model model = modelProcessor.process();
-     for (const auto& coordAct : model.getComponentList<CoordinateActuator>()) {
-        auto coordPath = coordAct.getAbsolutePathString();
-        if (coordPath.find("pelvis") != std::string::npos) {
-            effort.setWeightForControl(coordPath, 10);
-        }
-    }
-    
+    model.initSystem();
+    ModelNameIndex(model).setWeightForControls(
+            effort, "/forceset/.*pelvis.*", 10);
+
     // Solve and visualize.
     MocoSolution solution = moco.solve();
-    moco.visualize(solution);
+    solution.write("muscle_driven_state_tracking_solution.sto");
+    if (visualize) moco.visualize(solution);
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+
+    bool visualize = true;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--headless") visualize = false;
+    }
 
     // Solve the torque-driven marker tracking problem.
     // This problem takes a few minutes to solve.
-    torqueDrivenMarkerTracking();
+    torqueDrivenMarkerTracking(visualize);
 
     // Solve the muscle-driven state tracking problem.
     // This problem could take an hour or more to solve, depending on the 
     // number of processor cores available for parallelization. With 12 cores,
     // it takes around 25 minutes.
-    muscleDrivenStateTracking();
+    muscleDrivenStateTracking(visualize);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,236 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: exampleMocoTrackAdvanced.cpp                                 *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+/// This example solves the muscle-driven state tracking problem from
+/// exampleMocoTrack.cpp with the tools in this directory for long solves:
+///  - the time spent in each phase of the solve is recorded (see
+///    MocoSolveProfile.h);
+///  - the ground reactions are applied by a SharedExternalLoads force, so
+///    the solver's per-thread model copies share one set of splines of the
+///    data (SharedExternalLoads.h);
+///  - the problem is solved on coarser meshes first (MocoMeshRefinement.h);
+///  - the solve on each mesh is checkpointed, so an interrupted run resumes
+///    where it stopped (MocoCheckpoint.h), or, with --screening, stops once
+///    the kinematics, activations and joint moments stop changing
+///    (MocoConvergenceMonitor.h);
+///  - the iterates and the solution are recorded as body poses in
+///    muscle_driven_state_tracking_frames.bin (MocoFrameSink.h);
+///  - the tendon forces, joint moments and knee reactions of the solution are
+///    computed in parallel (TrajectoryDynamicsEvaluator.h).
+/// See exampleMocoTrack.cpp for the problem itself.
+///
+/// Usage: exampleMocoTrackAdvanced [--headless] [--screening]
+///
+/// With --headless, the solution is not shown in the Simbody visualizer,
+/// which waits for the window to be closed.
+
+#include "MocoCheckpoint.h"
+#include "MocoConvergenceMonitor.h"
+#include "MocoFrameSink.h"
+#include "MocoMeshRefinement.h"
+#include "MocoSolveProfile.h"
+#include "ModelNameIndex.h"
+#include "ReferenceDataStore.h"
+#include "TrajectoryDynamicsEvaluator.h"
+
+#include <Moco/osimMoco.h>
+
+using namespace OpenSim;
+
+void muscleDrivenStateTracking(bool visualize, bool screening) {
+
+    // Create and name an instance of the MocoTrack tool.
+    MocoTrack track;
+    track.setName("muscle_driven_state_tracking");
+
+    // Construct a ModelProcessor and set it on the tool. The default
+    // muscles in the model are replaced with optimization-friendly
+    // DeGrooteFregly2016Muscles, and adjustments are made to the default muscle
+    // parameters. The external loads are added after processing, in place of
+    // ModOpAddExternalLoads.
+    ModelProcessor modelProcessor =
+            ModelProcessor("subject_walk_armless.osim") |
+            ModOpReplaceMusclesWithDeGrooteFregly2016() |
+            // Only valid for DeGrooteFregly2016Muscles.
+            ModOpIgnorePassiveFiberForcesDGF() |
+            // Only valid for DeGrooteFregly2016Muscles.
+            ModOpScaleActiveFiberForceCurveWidthDGF(1.5);
+    // Record the time spent in each phase of the solve, along with the
+    // number of multibody dynamics evaluations; see MocoSolveProfile.h.
+    MocoSolveProfile profile;
+
+    // Process the model once here so that we can also use it below to find
+    // the pelvis CoordinateActuators. A ModelProcessor can also be created
+    // from an already-processed model.
+    ReferenceDataStore dataStore;
+    Model model = profile.time("model_processing", [&] {
+        Model processed = modelProcessor.process();
+        dataStore.addExternalLoads(processed, "grf_walk.xml");
+        return processed;
+    });
+    profile.addEvaluationCounter(model);
+    track.setModel(ModelProcessor(model));
+
+    // Index the model's control and state names once, rather than
+    // traversing the model's components on every mesh.
+    model.initSystem();
+    const ModelNameIndex names(model);
+
+    // Construct a TableProcessor of the coordinate data and pass it to the 
+    // tracking tool. TableProcessors can be used in the same way as
+    // ModelProcessors by appending TableOperators to modify the base table.
+    // A TableProcessor with no operators, as we have here, simply returns the
+    // base table.
+    track.setStatesReference(TableProcessor("coordinates.sto"));
+    track.set_states_global_tracking_weight(10);
+
+    // This setting allows extra data columns contained in the states
+    // reference that don't correspond to model coordinates.
+    track.set_allow_unused_references(true);
+
+    // Since there is only coordinate position data the states references, this
+    // setting is enabled to fill in the missing coordinate speed data using
+    // the derivative of splined position data.
+    track.set_track_reference_position_derivatives(true);
+
+    // Initial time and final time. The mesh interval is set below.
+    track.set_initial_time(0.81);
+    track.set_final_time(1.65);
+
+    // Instead of calling solve(), call initialize() to receive a pre-configured
+    // MocoStudy object based on the settings above. Use this to customize the
+    // problem beyond the MocoTrack interface.
+    const auto createStudy = [&](double meshInterval) {
+        track.set_mesh_interval(meshInterval);
+        MocoStudy moco = profile.time(
+                "initialization", [&] { return track.initialize(); });
+
+        // Get a reference to the MocoControlGoal that is added to every
+        // MocoTrack problem by default.
+        MocoProblem& problem = moco.updProblem();
+        MocoControlGoal& effort = dynamic_cast<MocoControlGoal&>(
+                problem.updGoal("control_effort"));
+
+        // Put a large weight on the pelvis CoordinateActuators, which act as
+        // the residual, or 'hand-of-god', forces which we would like to keep
+        // as small as possible.
+        names.setWeightForControls(effort, "/forceset/.*pelvis.*", 10);
+        return moco;
+    };
+
+    // Rather than solving on the target mesh (0.08 s) from the default guess,
+    // solve on coarser meshes first, using each solution as the guess for the
+    // next mesh. Refinement stops early if the objective changes by less than
+    // 1% between meshes.
+    MocoMeshRefinement refinement(createStudy, {0.28, 0.14, 0.08}, 0.01);
+    // Record the body poses of the checkpointed iterates (at most one
+    // iterate every 10 seconds) and of the solution on a background thread.
+    MocoFrameSink frames(model, "muscle_driven_state_tracking_frames.bin");
+    frames.setPeriod(10);
+    // With --screening, stop each solve once the coordinate values (rad or
+    // m), activations and net joint moments (N-m or N) have changed by less
+    // than these tolerances for 50 iterations.
+    MocoConvergenceMonitor monitor(50);
+    monitor.addVariableCriterion("kinematics", "/jointset/.*/value", 1e-4);
+    monitor.addVariableCriterion(
+            "activations", "/forceset/.*/activation", 1e-3);
+    monitor.addGeneralizedForceCriterion("joint_moments",
+            std::make_shared<TrajectoryDynamicsEvaluator>(model), 0.5);
+    monitor.setSolveFunction(
+            [&](const MocoStudy& study) { return profile.solve(study); });
+    if (screening) {
+        // Record the iterations and duration of all of the monitor's rounds,
+        // not only the last round's.
+        refinement.setStepFunction([&](MocoMeshRefinementStep& step) {
+            const MocoConvergenceReport& report = monitor.getReport();
+            step.num_iterations = report.num_iterations;
+            step.solver_duration = report.solver_duration;
+            step.status = report.reason;
+        });
+    }
+    refinement.setSolveFunction([&](const MocoStudy& moco) {
+        if (screening) return monitor.solve(moco);
+        // Checkpoint the solve on each mesh every 50 iterations. If the
+        // process is killed, running the example again resumes the solve
+        // from the last checkpoint; see MocoCheckpoint.h.
+        const int numMeshIntervals =
+                moco.getSolver<MocoCasADiSolver>().get_num_mesh_intervals();
+        MocoCheckpoint checkpoint("muscle_driven_state_tracking_checkpoint_" +
+                std::to_string(numMeshIntervals) + ".trj");
+        checkpoint.setSolveFunction(
+                [&](const MocoStudy& study) { return profile.solve(study); });
+        checkpoint.setIterateCallback(
+                [&](const MocoTrajectory& iterate, int iteration) {
+                    frames.push(iterate, iteration);
+                });
+        return checkpoint.solve(moco);
+    });
+
+    // Solve. The solution's metadata contains the mesh interval, objective
+    // and status on each mesh (and, with --screening, the monitor's report
+    // for the finest mesh), and the profile (with timings for each IPOPT
+    // iteration) is written next to the solution.
+    const std::string solutionPath =
+            "muscle_driven_state_tracking_solution.sto";
+    MocoSolution solution = refinement.solve();
+    refinement.writeSolution(solution, solutionPath);
+    if (screening) {
+        // Add how the solve on the finest mesh ended.
+        TimeSeriesTable table(solutionPath);
+        monitor.addMetaData(table);
+        STOFileAdapter::write(table, solutionPath);
+    }
+    frames.push(solution);
+
+    // Compute the tendon forces, net joint moments and knee reactions of the
+    // solution, evaluating the time points in parallel on copies of the
+    // model; see TrajectoryDynamicsEvaluator.h. The pool's workers are
+    // pinned to NUMA nodes, so that their model copies stay on their node.
+    // Only this evaluation is NUMA-aware: the solve above uses
+    // MocoCasADiSolver's own threads, which are not placed on nodes.
+    TrajectoryDynamicsEvaluator evaluator(
+            model, std::make_shared<WorkStealingPool>(0, true));
+    STOFileAdapter::write(evaluator.analyze(solution, {".*\\|tendon_force"}),
+            "muscle_driven_state_tracking_tendon_forces.sto");
+    STOFileAdapter::write(evaluator.calcGeneralizedForces(solution),
+            "muscle_driven_state_tracking_joint_moments.sto");
+    STOFileAdapter::write(
+            evaluator.analyze(solution, {".*walker_knee.*reaction_on_parent"}),
+            "muscle_driven_state_tracking_knee_reactions.sto");
+    profile.addThreadPool("trajectory_dynamics", evaluator.updPool());
+    profile.writeJSON(MocoSolveProfile::createProfilePath(solutionPath));
+
+    if (visualize) {
+        createStudy(refinement.getHistory().back().mesh_interval)
+                .visualize(solution);
+    }
+}
+
+int main(int argc, char* argv[]) {
+
+    bool visualize = true;
+    bool screening = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--headless") visualize = false;
+        if (std::string(argv[i]) == "--screening") screening = true;
+    }
+
+    // With 12 cores, this takes around 25 minutes. See
+    // muscle_driven_state_tracking_solution_profile.json for a breakdown.
+    muscleDrivenStateTracking(visualize, screening);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: exampleMocoTrackBatch.cpp                                    *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+/// This example solves the two tracking problems from exampleMocoTrack.cpp at
+/// the same time using MocoTrackBatch. The torque-driven marker tracking
+/// problem is solved alongside the muscle-driven state tracking problem
+/// instead of before it, so the total wall time is roughly that of the
+/// muscle-driven problem alone.
+///
+/// Usage: exampleMocoTrackBatch [num_threads] [--topology-cache]
+///
+/// With --topology-cache, each problem starts from the solution of the
+/// previous run (see MocoTopologyCache.h), so the results depend on earlier
+/// runs; by default, every run solves from the same initial guesses.
+///
+/// See exampleMocoTrack.cpp for a description of the model, the data, and
+/// the MocoTrack settings used here.
+
+#include "exampleMocoTrackJobs.h"
+
+using namespace OpenSim;
+
+int main(int argc, char* argv[]) {
+
+    // By default, use all hardware threads.
+    int numThreads = 0;
+    bool topologyCache = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--topology-cache") {
+            topologyCache = true;
+        } else {
+            numThreads = std::atoi(argv[i]);
+        }
+    }
+
+    MocoTrackBatch batch(numThreads);
+    // Processed models are stored here and reused by later runs.
+    batch.setModelCache(
+            std::make_shared<ModelProcessorCache>("model_cache"));
+    if (topologyCache) {
+        // Start from the latest solution of each problem (e.g., for another
+        // subject) instead of the usual guess; see MocoTopologyCache.h.
+        batch.setTopologyCache(
+                std::make_shared<MocoTopologyCache>("topology_cache"));
+    }
+    // Keep each job (and its solver's threads) on as few NUMA nodes as
+    // possible.
+    batch.setPinToNumaNodes(true);
+    batch.addJob(createTorqueDrivenMarkerTrackingJob());
+    batch.addJob(createMuscleDrivenStateTrackingJob());
+
+    bool success = true;
+    for (const auto& result : batch.solve()) {
+        std::cout << result.name << ": " << result.message << " ("
+                  << result.num_threads << " threads, "
+                  << result.cpus.size() << " pinned CPUs, "
+                  << result.duration << " seconds)" << std::endl;
+        success = success && result.success;
+    }
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
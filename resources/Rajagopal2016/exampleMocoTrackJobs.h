@@ -0,0 +1,97 @@
+#ifndef MOCOPAPER_EXAMPLEMOCOTRACKJOBS_H
+#define MOCOPAPER_EXAMPLEMOCOTRACKJOBS_H
+/* -------------------------------------------------------------------------- *
+ * OpenSim Moco: exampleMocoTrackJobs.h                                       *
+ * -------------------------------------------------------------------------- *
+ * Copyright (c) 2020 Stanford University and the Authors                     *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0          *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+/// The two tracking problems from exampleMocoTrack.cpp as MocoTrackJob%s, used
+/// by exampleMocoTrackBatch.cpp and benchmarkMocoTrack.cpp. See
+/// exampleMocoTrack.cpp for a description of the model, the data, and the
+/// MocoTrack settings.
+
+#include "MocoTrackBatch.h"
+
+namespace OpenSim {
+
+inline MocoTrackJob createTorqueDrivenMarkerTrackingJob() {
+    MocoTrackJob job;
+    job.name = "torque_driven_marker_tracking";
+    job.model = ModelProcessor("subject_walk_armless.osim") |
+                ModOpRemoveMuscles() |
+                ModOpAddReserves(250);
+    // Instead of ModOpAddExternalLoads, so that both jobs (and all solver
+    // threads) share one copy of the ground reaction data and its splines.
+    job.external_loads_file = "grf_walk.xml";
+    job.markers_trc_file = "marker_trajectories.trc";
+    job.allow_unused_references = true;
+    job.markers_global_tracking_weight = 10;
+    MocoWeightSet& markerWeights = job.markers_weight_set;
+    markerWeights.cloneAndAppend({"R.ASIS", 20});
+    markerWeights.cloneAndAppend({"L.ASIS", 20});
+    markerWeights.cloneAndAppend({"R.PSIS", 20});
+    markerWeights.cloneAndAppend({"L.PSIS", 20});
+    markerWeights.cloneAndAppend({"R.Knee", 10});
+    markerWeights.cloneAndAppend({"R.Ankle", 10});
+    markerWeights.cloneAndAppend({"R.Heel", 10});
+    markerWeights.cloneAndAppend({"R.MT5", 5});
+    markerWeights.cloneAndAppend({"R.Toe", 2});
+    markerWeights.cloneAndAppend({"L.Knee", 10});
+    markerWeights.cloneAndAppend({"L.Ankle", 10});
+    markerWeights.cloneAndAppend({"L.Heel", 10});
+    markerWeights.cloneAndAppend({"L.MT5", 5});
+    markerWeights.cloneAndAppend({"L.Toe", 2});
+    job.initial_time = 0.81;
+    job.final_time = 1.65;
+    job.mesh_interval = 0.05;
+    return job;
+}
+
+inline MocoTrackJob createMuscleDrivenStateTrackingJob() {
+    MocoTrackJob job;
+    job.name = "muscle_driven_state_tracking";
+    job.model = ModelProcessor("subject_walk_armless.osim") |
+                ModOpReplaceMusclesWithDeGrooteFregly2016() |
+                ModOpIgnorePassiveFiberForcesDGF() |
+                ModOpScaleActiveFiberForceCurveWidthDGF(1.5);
+    job.external_loads_file = "grf_walk.xml";
+    job.states_reference =
+            std::make_shared<TableProcessor>("coordinates.sto");
+    job.states_global_tracking_weight = 10;
+    job.allow_unused_references = true;
+    job.track_reference_position_derivatives = true;
+    job.initial_time = 0.81;
+    job.final_time = 1.65;
+    job.mesh_interval = 0.08;
+    // Solve on a coarse mesh first to obtain a guess for the target mesh.
+    job.coarse_mesh_intervals = {0.28};
+    // This problem takes roughly 10 times as long as the torque-driven
+    // problem, despite having fewer mesh intervals.
+    job.cost = 10 * job.getNumMeshIntervals();
+
+    job.customize = [](MocoStudy& study, const Model&,
+                            const ModelNameIndex& names) {
+        // Put a large weight on the pelvis CoordinateActuators, which act as
+        // the residual, or 'hand-of-god', forces.
+        MocoProblem& problem = study.updProblem();
+        MocoControlGoal& effort = dynamic_cast<MocoControlGoal&>(
+                problem.updGoal("control_effort"));
+        names.setWeightForControls(effort, "/forceset/.*pelvis.*", 10);
+    };
+    return job;
+}
+
+} // namespace OpenSim
+
+#endif // MOCOPAPER_EXAMPLEMOCOTRACKJOBS_H